@@ -0,0 +1,45 @@
+#!/bin/sh
+# Times each benchmark walking the tree and on the bytecode VM.
+#
+# Usage: bench/bench.sh [runs] [files...]   (from Chapter 14)
+#
+# Builds the interpreter with -O2 and prints the best time of several runs
+# for each mode. Output is discarded; run a program directly to see what
+# it prints, such as the bytes per value from values.lspy. Set CC, CFLAGS
+# or LIBS to change how it is built.
+
+cd "$(dirname "$0")/.." || exit 1
+
+RUNS=${1:-5}
+[ $# -gt 0 ] && shift
+FILES=${*:-bench/*.lspy}
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:-"-std=c11 -O2"}
+LIBS=${LIBS:-"-ledit -lm"}
+BIN=${TMPDIR:-/tmp}/lispy-bench.$$
+
+$CC $CFLAGS lisp.c ../mpc.c $LIBS -o "$BIN" || exit 1
+trap 'rm -f "$BIN"' EXIT
+
+# Best wall time in seconds of $RUNS runs of the given command
+best() {
+  b=
+  i=0
+  while [ $i -lt "$RUNS" ]; do
+    s=$(date +%s%N)
+    "$@" > /dev/null 2>&1
+    t=$(( $(date +%s%N) - s ))
+    if [ -z "$b" ] || [ $t -lt $b ]; then
+      b=$t
+    fi
+    i=$((i + 1))
+  done
+  echo "$b" | awk '{ printf "%.3f", $1 / 1e9 }'
+}
+
+printf "%-20s %10s %10s\n" "benchmark" "tree" "vm"
+for f in $FILES; do
+  printf "%-20s %10s %10s\n" "$(basename "$f")" "$(best "$BIN" "$f")" \
+    "$(best "$BIN" --vm "$f")"
+done
@@ -0,0 +1,97 @@
+#!/bin/sh
+# Times symbol lookup by name against the size of the frame it is in.
+#
+# Usage: bench/globals.sh [runs]   (from Chapter 14)
+#
+# A global case defines that many globals beyond std's, then reads the
+# last one defined. A local case calls a function that defines that many
+# locals with =, then reads the last one from a lambda called by map.
+# Neither is a formal, so both are looked up by name in a frame of that
+# size. Each reads the symbol 1000 times per evaluation, 10000 times over,
+# and prints nanoseconds per lookup, less the time of reading a number
+# instead. The interpreter is built once for each LENV_LINEAR_MAX in
+# LINEAR (default 8), the largest frame searched without a hash index.
+# Set CC, CFLAGS or LIBS to change how it is built.
+
+cd "$(dirname "$0")/.." || exit 1
+
+RUNS=${1:-3}
+LINEAR=${LINEAR:-8}
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:-"-std=c11 -O2"}
+LIBS=${LIBS:-"-ledit -lm"}
+BIN=${TMPDIR:-/tmp}/lispy-globals.$$
+SRC=${TMPDIR:-/tmp}/lispy-globals.$$.lspy
+
+trap 'rm -f "$BIN".* "$SRC"' EXIT
+for l in $LINEAR; do
+  $CC $CFLAGS -DLENV_LINEAR_MAX="$l" lisp.c ../mpc.c $LIBS -o "$BIN.$l" ||
+    exit 1
+done
+
+# Best wall time in nanoseconds of $RUNS runs of the given command
+best() {
+  b=
+  i=0
+  while [ $i -lt "$RUNS" ]; do
+    s=$(date +%s%N)
+    "$@" > /dev/null 2>&1
+    t=$(( $(date +%s%N) - s ))
+    if [ -z "$b" ] || [ $t -lt $b ]; then
+      b=$t
+    fi
+    i=$((i + 1))
+  done
+  echo "$b"
+}
+
+# An expression adding $1 to itself 1000 times
+reads() {
+  printf '(+'
+  i=0
+  while [ $i -lt 1000 ]; do
+    printf ' %s' "$1"
+    i=$((i + 1))
+  done
+  echo ')'
+}
+
+# Writes to $SRC a program with $2 globals (if $1 is g) or locals (if $1
+# is l), reading the last one, or the number 1 if $3 is set
+program() {
+  {
+    echo '(def {reps} {'"$(seq 1 10000 | tr '\n' ' ')"'})'
+    x=$1$2
+    [ -n "$3" ] && x=1
+    if [ "$1" = g ]; then
+      seq 1 "$2" | sed 's/.*/(def {g&} &)/'
+      echo "(map (\\ {_} {$(reads "$x")}) reps)"
+    else
+      echo "(fun {f x} {do"
+      seq 1 "$2" | sed 's/.*/  (= {l&} &)/'
+      echo "  (map (\\ {_} {$(reads "$x")}) reps)})"
+      echo "(f 0)"
+    fi
+  } > "$SRC"
+}
+
+printf "%-10s" "case"
+for l in $LINEAR; do
+  printf " %10s" "linear=$l"
+done
+echo
+
+for c in "l 2" "l 4" "l 8" "l 16" "l 32" "l 64" \
+         "g 10" "g 100" "g 1000" "g 10000"; do
+  set -- $c
+  printf "%-10s" "$([ "$1" = g ] && echo global || echo local) $2"
+  for l in $LINEAR; do
+    program "$1" "$2"
+    t=$(best "$BIN.$l" "$SRC")
+    program "$1" "$2" base
+    base=$(best "$BIN.$l" "$SRC")
+    echo "$t $base" | awk '{ printf " %10.1f", ($1 - $2) / 10000000 }'
+  done
+  echo
+done
@@ -0,0 +1,70 @@
+#!/bin/sh
+# Times reading source files, with the reader and with --mpc-reader.
+#
+# Usage: bench/read.sh [runs] [sizes...]   (from Chapter 14)
+#
+# The first files each hold one Q-Expression of that many numbers. The
+# others hold 1 MB and 10 MB of lines of code with strings and comments,
+# each line quoted so that evaluating it costs little. The time printed is
+# the best of several runs, less the best time of an empty file. Set CC,
+# CFLAGS or LIBS to change how the interpreter is built.
+
+cd "$(dirname "$0")/.." || exit 1
+
+RUNS=${1:-3}
+[ $# -gt 0 ] && shift
+SIZES=${*:-10000 100000 1000000}
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:-"-std=c11 -O2"}
+LIBS=${LIBS:-"-ledit -lm"}
+BIN=${TMPDIR:-/tmp}/lispy-read.$$
+SRC=${TMPDIR:-/tmp}/lispy-read.$$.lspy
+
+$CC $CFLAGS lisp.c ../mpc.c $LIBS -o "$BIN" || exit 1
+trap 'rm -f "$BIN" "$SRC"' EXIT
+
+# Best wall time in nanoseconds of $RUNS runs of the given command
+best() {
+  b=
+  i=0
+  while [ $i -lt "$RUNS" ]; do
+    s=$(date +%s%N)
+    "$@" > /dev/null 2>&1
+    t=$(( $(date +%s%N) - s ))
+    if [ -z "$b" ] || [ $t -lt $b ]; then
+      b=$t
+    fi
+    i=$((i + 1))
+  done
+  echo "$b"
+}
+
+: > "$SRC"
+base=$(best "$BIN" "$SRC")
+mpc_base=$(best "$BIN" --mpc-reader "$SRC")
+
+# Times $SRC with both readers and prints a row for it named $1
+row() {
+  t=$(best "$BIN" "$SRC")
+  m=$(best "$BIN" --mpc-reader "$SRC")
+  echo "$1 $(wc -c < "$SRC") $t $base $m $mpc_base" | awk '{
+    printf "%-12s %10.1f %9.4fs %9.4fs\n", $1, $2 / 1048576,
+      ($3 - $4) / 1e9, ($5 - $6) / 1e9 }'
+}
+
+printf "%-12s %10s %10s %10s\n" "file" "MB" "reader" "mpc"
+for n in $SIZES; do
+  {
+    printf '{'
+    seq 0 $((n - 1)) | tr '\n' ' '
+    echo '}'
+  } > "$SRC"
+  row "{$n}"
+done
+
+LINE='{fun {f x} {if (> x 0) {f (- x 1)} {"done\n"}}} ; a comment'
+for mb in 1 10; do
+  yes "$LINE" | head -c $((mb * 1048576)) | sed '$d' > "$SRC"
+  row "code"
+done
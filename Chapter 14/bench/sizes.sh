@@ -0,0 +1,111 @@
+#!/bin/sh
+# Times the list builtins on lists of 1k, 100k and 1M numbers.
+#
+# Usage: bench/sizes.sh [runs] [sizes...]   (from Chapter 14)
+#
+# For each size a prelude defines xs, the numbers from 0, and ps, xs
+# zipped with itself. The first cases build or walk a list one element at
+# a time, and print the seconds the whole loop takes. The others call a
+# builtin on the whole list, 10000000 / size times over, and print the
+# milliseconds per call. Each time is the best of several runs, less the
+# best time of the prelude followed by the same loop doing (+ 0 0). That
+# includes the collection the prelude's allocations bring on at the next
+# evaluation. Set CC, CFLAGS or LIBS to change how it is built.
+
+cd "$(dirname "$0")/.." || exit 1
+
+RUNS=${1:-3}
+[ $# -gt 0 ] && shift
+SIZES=${*:-1000 100000 1000000}
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:-"-std=c11 -O2"}
+LIBS=${LIBS:-"-ledit -lm"}
+BIN=${TMPDIR:-/tmp}/lispy-sizes.$$
+SRC=${TMPDIR:-/tmp}/lispy-sizes.$$.lspy
+
+$CC $CFLAGS lisp.c ../mpc.c $LIBS -o "$BIN" || exit 1
+trap 'rm -f "$BIN" "$SRC"' EXIT
+
+# Best wall time in nanoseconds of $RUNS runs of the given command
+best() {
+  b=
+  i=0
+  while [ $i -lt "$RUNS" ]; do
+    s=$(date +%s%N)
+    "$@" > /dev/null 2>&1
+    t=$(( $(date +%s%N) - s ))
+    if [ -z "$b" ] || [ $t -lt $b ]; then
+      b=$t
+    fi
+    i=$((i + 1))
+  done
+  echo "$b"
+}
+
+# Writes the prelude for $n elements followed by the case $1 to $SRC
+program() {
+  {
+    printf '(def {xs} {'
+    seq 0 $((n - 1)) | tr '\n' ' '
+    echo '})'
+    echo '(def {ps} (zip xs xs))'
+    echo "$1"
+  } > "$SRC"
+}
+
+LOOPS='
+(fun {app i n acc} {if (== i n) {acc} {app (+ i 1) n (join acc (list i))}})
+(fun {pre i n acc} {if (== i n) {acc} {pre (+ i 1) n (join (list i) acc)}})
+(fun {walk l} {if (== l nil) {0} {walk (tail l)}})
+(fun {heads l k} {if (== k 0) {0} {do (head l) (heads l (- k 1))}})'
+
+# Prints the time of case $2 for each size, in seconds or, if $1 is set,
+# in milliseconds per call
+row() {
+  printf "%-10s" "$3"
+  for n in $SIZES; do
+    reps=1
+    if [ -n "$1" ]; then
+      reps=$((10000000 / n))
+    fi
+    program "(fun {rep k} {if (== k 0) {0} {do $2 (rep (- k 1))}}) (rep $reps)"
+    t=$(best "$BIN" "$SRC")
+    program "(fun {rep k} {if (== k 0) {0} {do (+ 0 0) (rep (- k 1))}}) (rep $reps)"
+    base=$(best "$BIN" "$SRC")
+    echo "$t $base $reps $1" | awk '{
+      if ($4) { printf " %10.4f", ($1 - $2) / 1e6 / $3 }
+      else { printf " %10.3f", ($1 - $2) / 1e9 } }'
+  done
+  echo
+}
+
+header() {
+  printf "%-10s" "$1"
+  for n in $SIZES; do
+    printf " %10s" "$n"
+  done
+  echo
+}
+
+header "loop (s)"
+row "" "$LOOPS (app 0 (len xs) nil)" "append"
+row "" "$LOOPS (pre 0 (len xs) nil)" "prepend"
+row "" "$LOOPS (walk xs)" "tail"
+row "" "$LOOPS (heads xs (len xs))" "head"
+echo
+header "call (ms)"
+row 1 "(join xs xs)" "join"
+row 1 "(eval (join {list} xs))" "eval"
+row 1 "(len xs)" "len"
+row 1 "(nth (- (len xs) 1) xs)" "nth"
+row 1 "(map (\\ {x} {+ x 1}) xs)" "map"
+row 1 "(filter (\\ {x} {> x 0}) xs)" "filter"
+row 1 "(foldl + 0 xs)" "foldl"
+row 1 "(reverse xs)" "reverse"
+row 1 "(take (/ (len xs) 2) xs)" "take"
+row 1 "(drop (/ (len xs) 2) xs)" "drop"
+row 1 "(elem -1 xs)" "elem"
+row 1 "(lookup -1 ps)" "lookup"
+row 1 "(zip xs xs)" "zip"
+row 1 "(unzip ps)" "unzip"
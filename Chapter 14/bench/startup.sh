@@ -0,0 +1,79 @@
+#!/bin/sh
+# Times starting the interpreter by loading std.lspy and by loading an
+# image made from it.
+#
+# Usage: bench/startup.sh [runs]   (from Chapter 14)
+#
+# Each start runs an empty file, so only the startup is timed. The warm
+# times are the best of several runs, with std.lspy, the image and the
+# interpreter all in the page cache. The cold times drop the page cache
+# before each run, which needs root; otherwise they are left out. Set CC,
+# CFLAGS or LIBS to change how the interpreter is built.
+
+cd "$(dirname "$0")/.." || exit 1
+
+RUNS=${1:-5}
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:-"-std=c11 -O2"}
+LIBS=${LIBS:-"-ledit -lm"}
+BIN=${TMPDIR:-/tmp}/lispy-startup.$$
+SRC=${TMPDIR:-/tmp}/lispy-startup.$$.lspy
+IMG=${TMPDIR:-/tmp}/lispy-startup.$$.img
+
+$CC $CFLAGS lisp.c ../mpc.c $LIBS -o "$BIN" || exit 1
+trap 'rm -f "$BIN" "$SRC" "$IMG"' EXIT
+
+: > "$SRC"
+"$BIN" --make-image "$IMG" || exit 1
+
+COLD=
+if [ -w /proc/sys/vm/drop_caches ]; then
+  COLD=1
+fi
+
+# Best wall time in nanoseconds of $RUNS runs of the given command,
+# dropping the page cache before each if $1 is set
+best() {
+  cold=$1
+  shift
+  b=
+  i=0
+  while [ $i -lt "$RUNS" ]; do
+    if [ -n "$cold" ]; then
+      sync
+      echo 3 > /proc/sys/vm/drop_caches
+    fi
+    s=$(date +%s%N)
+    "$@" > /dev/null 2>&1
+    t=$(( $(date +%s%N) - s ))
+    if [ -z "$b" ] || [ $t -lt $b ]; then
+      b=$t
+    fi
+    i=$((i + 1))
+  done
+  echo "$b"
+}
+
+# Prints the warm and, if it can, the cold start time of the command
+row() {
+  name=$1
+  shift
+  w=$(best "" "$@")
+  c=
+  if [ -n "$COLD" ]; then
+    c=$(best 1 "$@")
+  fi
+  echo "$name $w $c" | awk '{
+    printf "%-10s %9.2fms", $1, $2 / 1e6
+    if ($3 != "") { printf " %9.2fms", $3 / 1e6 }
+    printf "\n" }'
+}
+
+if [ -n "$COLD" ]; then
+  printf "%-10s %11s %11s\n" "start" "warm" "cold"
+else
+  printf "%-10s %11s\n" "start" "warm"
+fi
+row "std.lspy" "$BIN" "$SRC"
+row "image" "$BIN" --image "$IMG" "$SRC"
@@ -1,4 +1,8 @@
 #include "../mpc.h"
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
 
 #ifdef _WIN32
 
@@ -17,6 +21,10 @@ void add_history(char* unused) {}
 
 #else
 #include <editline/readline.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #endif
 
 /* Parser Declariations */
@@ -30,12 +38,116 @@ mpc_parser_t* Qexpr;
 mpc_parser_t* Expr;
 mpc_parser_t* Lispy;
 
+/* Ids mpca_lang gives the nodes each rule builds, in the order the
+ * parsers are passed to it in main */
+enum {
+  LRULE_NUMBER = 1,
+  LRULE_SYMBOL,
+  LRULE_STRING,
+  LRULE_COMMENT,
+  LRULE_SEXPR,
+  LRULE_QEXPR,
+  LRULE_EXPR,
+  LRULE_LISPY
+};
+
 /* Forward Declarations */
 
 struct lval;
 struct lenv;
 typedef struct lval lval;
 typedef struct lenv lenv;
+typedef struct lcode lcode;
+typedef struct lcells lcells;
+
+/* Heap */
+
+/* Every lval, lenv and cell buffer is registered here so the collector can
+ * walk the whole heap. Each object remembers its slot for constant-time
+ * removal. */
+
+enum { GC_LVAL, GC_LENV, GC_CELLS };
+
+typedef struct {
+  void* obj;
+  int kind;
+  int refs;
+} gc_slot;
+
+#define GC_MIN_THRESHOLD 100000
+
+struct {
+  gc_slot* slots;
+  int count;
+  int cap;
+  long allocs;
+  long threshold;
+  long collections;
+  long freed;
+  long pause_last;
+  long pause_max;
+  long pause_total;
+} gc = {NULL, 0, 0, 0, GC_MIN_THRESHOLD, 0, 0, 0, 0, 0};
+
+int gc_track(void* obj, int kind) {
+  if (gc.count == gc.cap) {
+    gc.cap = gc.cap ? gc.cap * 2 : 1024;
+    gc.slots = realloc(gc.slots, sizeof(gc_slot) * gc.cap);
+  }
+  gc.slots[gc.count].obj = obj;
+  gc.slots[gc.count].kind = kind;
+  gc.allocs++;
+  return gc.count++;
+}
+
+void gc_untrack(int i);
+
+/* Fixed size objects come from per-type pools that carve slabs into free
+ * lists. Build with -DLISPY_NO_POOL to use plain malloc and free instead,
+ * e.g. so AddressSanitizer can see each object individually.
+ *
+ * A pool counts the objects it hands out and the slabs it mallocs for them
+ * (one per object without pools). List cells, frame arrays, the symbol
+ * table and strings are allocated elsewhere and are not counted. */
+
+#define POOL_SLAB_BYTES 65536
+
+typedef struct {
+  size_t size;
+  void* free;
+  long pooled;
+  long slabs;
+} pool;
+
+void* pool_alloc(pool* p) {
+#ifdef LISPY_NO_POOL
+  p->slabs++;
+  return malloc(p->size);
+#else
+  if (!p->free) {
+    size_t n = POOL_SLAB_BYTES / p->size;
+    char* slab = malloc(p->size * n);
+    p->slabs++;
+    for (size_t i = 0; i < n; i++) {
+      *(void**)(slab + i * p->size) = p->free;
+      p->free = slab + i * p->size;
+    }
+  }
+  void* x = p->free;
+  p->free = *(void**)x;
+  p->pooled++;
+  return x;
+#endif
+}
+
+void pool_free(pool* p, void* x) {
+#ifdef LISPY_NO_POOL
+  free(x);
+#else
+  *(void**)x = p->free;
+  p->free = x;
+#endif
+}
 
 /* Lisp Value */
 
@@ -51,64 +163,198 @@ enum {
 
 typedef lval* (*lbuiltin)(lenv*, lval*);
 
+/* How far a Q-Expression used as a lambda body has been resolved; see
+ * Lexical Addressing */
+enum { LVAL_UNRESOLVED, LVAL_RESOLVED, LVAL_CLOSURE };
+
+/* Strings shorter than this are stored inside the lval itself */
+#define LVAL_SMALL_STR 24
+
 struct lval {
   int type;
+  int ref;
+  int gc;
+
+  union {
+    /* Number */
+    long num;
+
+    /* Error, Symbol and String */
+    struct {
+      union {
+        char* err;
+        char* sym;
+        char* str;
+      };
+      union {
+        char small[LVAL_SMALL_STR];
+
+        /* Symbol address from lval_resolve, depth -1 if unresolved */
+        struct {
+          int depth;
+          int slot;
+        };
+      };
+    };
+
+    /* Function */
+    struct {
+      lbuiltin builtin;
+      lenv* env;
+      lval* formals;
+      lval* body;
+    };
+
+    /* Expression: count cells of buf starting at cell, with bytecode
+     * compiled from it on first evaluation */
+    struct {
+      int count;
+      int resolved;
+      lval** cell;
+      lcode* code;
+      lcells* buf;
+    };
+  };
+};
 
-  /* Basic */
-  long num;
-  char* err;
-  char* sym;
-  char* str;
+pool lval_pool = {sizeof(lval), NULL, 0, 0};
 
-  /* Function */
-  lbuiltin builtin;
-  lenv* env;
-  lval* formals;
-  lval* body;
+/* Copy s into v's inline buffer if it fits, otherwise onto the heap */
+char* lval_text(lval* v, char* s) {
+  size_t len = strlen(s);
+  char* t = len < LVAL_SMALL_STR ? v->small : malloc(len + 1);
+  memcpy(t, s, len + 1);
+  return t;
+}
+
+void lval_text_del(lval* v, char* t) {
+  if (t != v->small) {
+    free(t);
+  }
+}
+
+/* Symbols */
+
+/* Every symbol name is interned once, so symbols can be compared by
+ * pointer. Interned names live for the rest of the program. Each name also
+ * counts how many environment frames currently bind it, and is marked when
+ * compiled code depends on what it is bound to; see Bytecode. */
+
+typedef struct {
+  int binds;
+  int linked;
+  char name[];
+} lsym;
 
-  /* Expression */
+lsym* sym_info(char* s) { return (lsym*)(s - offsetof(lsym, name)); }
+
+struct {
+  char** names;
   int count;
-  lval** cell;
-};
+  int cap;
+} symtab = {NULL, 0, 0};
+
+unsigned long sym_hash(char* s) {
+  unsigned long h = 5381;
+  while (*s) {
+    h = h * 33 + (unsigned char)*s++;
+  }
+  return h;
+}
+
+char* sym_intern(char* s) {
+  if (symtab.count * 2 >= symtab.cap) {
+    int cap = symtab.cap ? symtab.cap * 2 : 256;
+    char** names = calloc(cap, sizeof(char*));
+    for (int i = 0; i < symtab.cap; i++) {
+      if (symtab.names[i]) {
+        unsigned long j = sym_hash(symtab.names[i]) & (cap - 1);
+        while (names[j]) {
+          j = (j + 1) & (cap - 1);
+        }
+        names[j] = symtab.names[i];
+      }
+    }
+    free(symtab.names);
+    symtab.names = names;
+    symtab.cap = cap;
+  }
+
+  unsigned long i = sym_hash(s) & (symtab.cap - 1);
+  while (symtab.names[i]) {
+    if (strcmp(symtab.names[i], s) == 0) {
+      return symtab.names[i];
+    }
+    i = (i + 1) & (symtab.cap - 1);
+  }
+  lsym* info = malloc(sizeof(lsym) + strlen(s) + 1);
+  info->binds = 0;
+  info->linked = 0;
+  strcpy(info->name, s);
+  symtab.names[i] = info->name;
+  symtab.count++;
+  return symtab.names[i];
+}
+
+void vm_link(char* sym);
+
+/* Count a frame starting (d is 1) or ceasing (d is -1) to bind s, or
+ * binding it to a new value (d is 0) */
+void sym_bound(char* s, int d) {
+  lsym* info = sym_info(s);
+  info->binds += d;
+  if (info->linked) {
+    vm_link(s);
+  }
+}
+
+/* Values are reference counted and shared between owners. Anything that
+ * modifies a value in place must first take a private copy with lval_own. */
+lval* lval_new(int type) {
+  lval* v = pool_alloc(&lval_pool);
+  v->type = type;
+  v->ref = 1;
+  v->gc = gc_track(v, GC_LVAL);
+  return v;
+}
+
+lval* lval_retain(lval* v) {
+  v->ref++;
+  return v;
+}
 
 lval* lval_num(long x) {
-  lval* v = malloc(sizeof(lval));
-  v->type = LVAL_NUM;
+  lval* v = lval_new(LVAL_NUM);
   v->num = x;
   return v;
 }
 
 lval* lval_err(char* fmt, ...) {
-  lval* v = malloc(sizeof(lval));
-  v->type = LVAL_ERR;
+  lval* v = lval_new(LVAL_ERR);
+  char buf[512];
   va_list va;
   va_start(va, fmt);
-  v->err = malloc(512);
-  vsnprintf(v->err, 511, fmt, va);
-  v->err = realloc(v->err, strlen(v->err) + 1);
+  vsnprintf(buf, 511, fmt, va);
   va_end(va);
+  v->err = lval_text(v, buf);
   return v;
 }
 
 lval* lval_sym(char* s) {
-  lval* v = malloc(sizeof(lval));
-  v->type = LVAL_SYM;
-  v->sym = malloc(strlen(s) + 1);
-  strcpy(v->sym, s);
+  lval* v = lval_new(LVAL_SYM);
+  v->sym = sym_intern(s);
+  v->depth = -1;
   return v;
 }
 
 lval* lval_str(char* s) {
-  lval* v = malloc(sizeof(lval));
-  v->type = LVAL_STR;
-  v->str = malloc(strlen(s) + 1);
-  strcpy(v->str, s);
+  lval* v = lval_new(LVAL_STR);
+  v->str = lval_text(v, s);
   return v;
 }
 
 lval* lval_builtin(lbuiltin func) {
-  lval* v = malloc(sizeof(lval));
-  v->type = LVAL_FUN;
+  lval* v = lval_new(LVAL_FUN);
   v->builtin = func;
   return v;
 }
@@ -116,8 +362,7 @@ lval* lval_builtin(lbuiltin func) {
 lenv* lenv_new(void);
 
 lval* lval_lambda(lval* formals, lval* body) {
-  lval* v = malloc(sizeof(lval));
-  v->type = LVAL_FUN;
+  lval* v = lval_new(LVAL_FUN);
   v->builtin = NULL;
   v->env = lenv_new();
   v->formals = formals;
@@ -126,25 +371,147 @@ lval* lval_lambda(lval* formals, lval* body) {
 }
 
 lval* lval_sexpr(void) {
-  lval* v = malloc(sizeof(lval));
-  v->type = LVAL_SEXPR;
+  lval* v = lval_new(LVAL_SEXPR);
   v->count = 0;
+  v->resolved = LVAL_UNRESOLVED;
   v->cell = NULL;
+  v->code = NULL;
+  v->buf = NULL;
   return v;
 }
 
 lval* lval_qexpr(void) {
-  lval* v = malloc(sizeof(lval));
-  v->type = LVAL_QEXPR;
+  lval* v = lval_new(LVAL_QEXPR);
   v->count = 0;
+  v->resolved = LVAL_UNRESOLVED;
   v->cell = NULL;
+  v->code = NULL;
+  v->buf = NULL;
   return v;
 }
 
 void lenv_del(lenv* e);
+void lcode_del(lcode* c);
+
+/* Cells */
+
+/* The children of an expression are a view of a buffer that other
+ * expressions may share, so copying a list or taking its tail is constant
+ * time. The buffer holds the references to the values in its slots lo to
+ * hi. A view ending at hi, or starting at lo, can grow into the spare slots
+ * past that end, since no other view can see them; that makes adding to
+ * either end of a list amortised constant time. */
+
+struct lcells {
+  int ref;
+  int gc;
+  int lo;
+  int hi;
+  int cap;
+  lval* items[];
+};
+
+lcells* lcells_new(int cap, int lo) {
+  lcells* b = malloc(sizeof(lcells) + sizeof(lval*) * cap);
+  b->ref = 1;
+  b->gc = gc_track(b, GC_CELLS);
+  b->lo = lo;
+  b->hi = lo;
+  b->cap = cap;
+  return b;
+}
+
+void lval_del(lval* v);
+
+void lcells_del(lcells* b) {
+  if (--b->ref > 0) {
+    return;
+  }
+  for (int i = b->lo; i < b->hi; i++) {
+    lval_del(b->items[i]);
+  }
+  gc_untrack(b->gc);
+  free(b);
+}
+
+/* Move the cells of v into a new buffer of its own, with room for front more
+ * cells before them and back more after. A list that is growing gets half
+ * as much again, so adding to it reallocates only a logarithmic number of
+ * times; an empty one gets exactly what was asked for. */
+void lval_rebuffer(lval* v, int front, int back) {
+  int n = v->count + front + back;
+  int cap = v->count ? n + n / 2 + 4 : n;
+  int lo = back == 0 && front > 0 ? cap - v->count : front;
+  lcells* b = v->buf;
+  lcells* nb = lcells_new(cap, lo);
+
+  if (b && b->ref == 1) {
+    int start = v->cell - b->items;
+    for (int i = b->lo; i < start; i++) {
+      lval_del(b->items[i]);
+    }
+    for (int i = start + v->count; i < b->hi; i++) {
+      lval_del(b->items[i]);
+    }
+    memcpy(nb->items + lo, v->cell, sizeof(lval*) * v->count);
+    gc_untrack(b->gc);
+    free(b);
+  } else {
+    for (int i = 0; i < v->count; i++) {
+      nb->items[lo + i] = lval_retain(v->cell[i]);
+    }
+    if (b) {
+      lcells_del(b);
+    }
+  }
+
+  nb->hi = lo + v->count;
+  v->buf = nb;
+  v->cell = nb->items + lo;
+}
+
+/* Make room for front more cells before the first of v and back more after
+ * its last, where v can write them without other views seeing */
+void lval_reserve(lval* v, int front, int back) {
+  lcells* b = v->buf;
+  if (front == 0 && back == 0) {
+    return;
+  }
+  if (b) {
+    int start = v->cell - b->items;
+    int end = start + v->count;
+    if ((front == 0 || (start == b->lo && start >= front)) &&
+        (back == 0 || (end == b->hi && end + back <= b->cap))) {
+      return;
+    }
+  }
+  lval_rebuffer(v, front, back);
+}
+
+/* Make v the only view of its buffer, which then holds just its cells */
+void lval_unshare(lval* v) {
+  lcells* b = v->buf;
+  if (b->ref > 1) {
+    lval_rebuffer(v, 0, 0);
+    return;
+  }
+  int start = v->cell - b->items;
+  for (int i = b->lo; i < start; i++) {
+    lval_del(b->items[i]);
+  }
+  for (int i = start + v->count; i < b->hi; i++) {
+    lval_del(b->items[i]);
+  }
+  b->lo = start;
+  b->hi = start + v->count;
+}
 
 void lval_del(lval* v) {
 
+  if (--v->ref > 0) {
+    return;
+  }
+
   switch (v->type) {
     case LVAL_NUM:
       break;
@@ -156,99 +523,209 @@ void lval_del(lval* v) {
       }
       break;
     case LVAL_ERR:
-      free(v->err);
-      break;
-    case LVAL_SYM:
-      free(v->sym);
+      lval_text_del(v, v->err);
       break;
     case LVAL_STR:
-      free(v->str);
+      lval_text_del(v, v->str);
       break;
     case LVAL_QEXPR:
     case LVAL_SEXPR:
-      for (int i = 0; i < v->count; i++) {
-        lval_del(v->cell[i]);
+      if (v->buf) {
+        lcells_del(v->buf);
       }
-      free(v->cell);
+      lcode_del(v->code);
       break;
   }
 
-  free(v);
+  gc_untrack(v->gc);
+  pool_free(&lval_pool, v);
 }
 
-lenv* lenv_copy(lenv* e);
+lenv* lenv_retain(lenv* e);
 
+/* Copy the top level of v, sharing its children with the original */
 lval* lval_copy(lval* v) {
-  lval* x = malloc(sizeof(lval));
-  x->type = v->type;
+  lval* x = lval_new(v->type);
   switch (v->type) {
     case LVAL_FUN:
       if (v->builtin) {
         x->builtin = v->builtin;
       } else {
         x->builtin = NULL;
-        x->env = lenv_copy(v->env);
-        x->formals = lval_copy(v->formals);
-        x->body = lval_copy(v->body);
+        x->env = lenv_retain(v->env);
+        x->formals = lval_retain(v->formals);
+        x->body = lval_retain(v->body);
       }
       break;
     case LVAL_NUM:
       x->num = v->num;
       break;
     case LVAL_ERR:
-      x->err = malloc(strlen(v->err) + 1);
-      strcpy(x->err, v->err);
+      x->err = lval_text(x, v->err);
       break;
     case LVAL_SYM:
-      x->sym = malloc(strlen(v->sym) + 1);
-      strcpy(x->sym, v->sym);
+      x->sym = v->sym;
+      x->depth = v->depth;
+      x->slot = v->slot;
       break;
     case LVAL_STR:
-      x->str = malloc(strlen(v->str) + 1);
-      strcpy(x->str, v->str);
+      x->str = lval_text(x, v->str);
       break;
     case LVAL_SEXPR:
     case LVAL_QEXPR:
+      x->code = NULL;
+      x->resolved = LVAL_UNRESOLVED;
       x->count = v->count;
-      x->cell = malloc(sizeof(lval*) * x->count);
-      for (int i = 0; i < x->count; i++) {
-        x->cell[i] = lval_copy(v->cell[i]);
+      x->cell = v->cell;
+      x->buf = v->buf;
+      if (x->buf) {
+        x->buf->ref++;
       }
       break;
   }
   return x;
 }
 
+/* Return v if we hold the only reference, otherwise a private copy */
+lval* lval_own(lval* v) {
+  if (v->ref == 1 || (v->type == LVAL_FUN && v->builtin)) {
+    return v;
+  }
+  lval* x = lval_copy(v);
+  v->ref--;
+  return x;
+}
+
+/* Drop compiled code once an expression is changed in place */
+void lval_changed(lval* v) {
+  lcode_del(v->code);
+  v->code = NULL;
+  v->resolved = LVAL_UNRESOLVED;
+}
+
 lval* lval_add(lval* v, lval* x) {
-  v->count++;
-  v->cell = realloc(v->cell, sizeof(lval*) * v->count);
-  v->cell[v->count - 1] = x;
+  v = lval_own(v);
+  lval_changed(v);
+  lval_reserve(v, 0, 1);
+  v->cell[v->count++] = x;
+  v->buf->hi++;
+  return v;
+}
+
+/* Append the n values in xs to v, taking their references */
+lval* lval_add_many(lval* v, lval** xs, int n) {
+  v = lval_own(v);
+  if (n == 0) {
+    return v;
+  }
+  lval_changed(v);
+  lval_reserve(v, 0, n);
+  memcpy(v->cell + v->count, xs, sizeof(lval*) * n);
+  v->count += n;
+  v->buf->hi += n;
   return v;
 }
 
+/* Join y onto the end of x. The longer of the two is extended, at whichever
+ * end that takes, so building a list from either end is cheap. */
 lval* lval_join(lval* x, lval* y) {
+  if (y->count > x->count) {
+    y = lval_own(y);
+    lval_changed(y);
+    lval_reserve(y, x->count, 0);
+    y->cell -= x->count;
+    y->buf->lo -= x->count;
+    for (int i = 0; i < x->count; i++) {
+      y->cell[i] = lval_retain(x->cell[i]);
+    }
+    y->count += x->count;
+    y->type = x->type;
+    lval_del(x);
+    return y;
+  }
+  x = lval_own(x);
+  lval_changed(x);
+  lval_reserve(x, 0, y->count);
   for (int i = 0; i < y->count; i++) {
-    x = lval_add(x, y->cell[i]);
+    x->cell[x->count + i] = lval_retain(y->cell[i]);
   }
-  free(y->cell);
-  free(y);
+  x->count += y->count;
+  if (x->buf) {
+    x->buf->hi += y->count;
+  }
+  lval_del(y);
   return x;
 }
 
+/* Remove cell i of v, which the caller owns. Either end is removed by
+ * narrowing the view, taking the buffer's reference if no other view can
+ * see the slot; anything else is removed from a buffer of v's own. Once
+ * three quarters of a buffer only v can see are unused it is shrunk. */
 lval* lval_pop(lval* v, int i) {
-  lval* x = v->cell[i];
-  memmove(&v->cell[i], &v->cell[i + 1], sizeof(lval*) * (v->count - i - 1));
+  lval_changed(v);
+  lcells* b = v->buf;
+  lval* x;
+
+  if (i == 0 || i == v->count - 1) {
+    if (b->ref == 1) {
+      lval_unshare(v);
+    }
+    x = v->cell[i];
+    if (b->ref > 1) {
+      lval_retain(x);
+    } else if (i == 0) {
+      b->lo++;
+    } else {
+      b->hi--;
+    }
+    if (i == 0) {
+      v->cell++;
+    }
+  } else {
+    lval_unshare(v);
+    x = v->cell[i];
+    memmove(&v->cell[i], &v->cell[i + 1], sizeof(lval*) * (v->count - i - 1));
+    v->buf->hi--;
+  }
+
   v->count--;
-  v->cell = realloc(v->cell, sizeof(lval*) * v->count);
+  if (v->count == 0) {
+    lcells_del(v->buf);
+    v->buf = NULL;
+    v->cell = NULL;
+  } else if (v->buf->ref == 1 && v->buf->cap > 64 &&
+             v->count < v->buf->cap / 4) {
+    lval_rebuffer(v, 0, 0);
+  }
   return x;
 }
 
 lval* lval_take(lval* v, int i) {
+  if (v->ref > 1) {
+    lval* x = lval_retain(v->cell[i]);
+    lval_del(v);
+    return x;
+  }
   lval* x = lval_pop(v, i);
   lval_del(v);
   return x;
 }
 
+/* A new list of the cells of v from start up to end, sharing v's buffer */
+lval* lval_slice(lval* v, int start, int end) {
+  lval* x = lval_copy(v);
+  if (start == end && x->buf) {
+    lcells_del(x->buf);
+    x->buf = NULL;
+    x->cell = NULL;
+  }
+  if (x->buf) {
+    x->cell += start;
+  }
+  x->count = end - start;
+  return x;
+}
+
 void lval_print(lval* v);
 
 void lval_print_expr(lval* v, char open, char close) {
@@ -325,7 +802,7 @@ int lval_eq(lval* x, lval* y) {
     case LVAL_ERR:
       return (strcmp(x->err, y->err) == 0);
     case LVAL_SYM:
-      return (strcmp(x->sym, y->sym) == 0);
+      return x->sym == y->sym;
     case LVAL_STR:
       return (strcmp(x->str, y->str) == 0);
     case LVAL_FUN:
@@ -373,77 +850,215 @@ char* ltype_name(int t) {
 
 /* Lisp Environment */
 
+/* par is the frame of the caller, giving dynamic scope. lex is the frame a
+ * closure was created in, searched (with its own lex) before par. */
 struct lenv {
+  int ref;
+  int gc;
   lenv* par;
+  lenv* lex;
   int count;
   char** syms;
   lval** vals;
+
+  /* Hash index into syms, only built for frames larger than
+   * LENV_LINEAR_MAX where it beats a linear scan. bench/globals.sh
+   * measures lookups either side of it. */
+  int* index;
+  int cap;
 };
 
+#ifndef LENV_LINEAR_MAX
+#define LENV_LINEAR_MAX 8
+#endif
+
+/* The outermost environment, where def puts things */
+lenv* lenv_global;
+
+pool lenv_pool = {sizeof(lenv), NULL, 0, 0};
+
 lenv* lenv_new(void) {
-  lenv* e = malloc(sizeof(lenv));
+  lenv* e = pool_alloc(&lenv_pool);
+  e->ref = 1;
+  e->gc = gc_track(e, GC_LENV);
   e->par = NULL;
+  e->lex = NULL;
   e->count = 0;
   e->syms = NULL;
   e->vals = NULL;
+  e->index = NULL;
+  e->cap = 0;
   return e;
 }
 
+lenv* lenv_retain(lenv* e) {
+  e->ref++;
+  return e;
+}
+
+/* A frame holds a reference to its parent. Chains of frames left by tail
+ * calls can be long, so parents are released in a loop. */
 void lenv_del(lenv* e) {
-  for (int i = 0; i < e->count; i++) {
-    free(e->syms[i]);
-    lval_del(e->vals[i]);
+  while (e && --e->ref == 0) {
+    lenv* par = e->par;
+    if (e->lex) {
+      lenv_del(e->lex);
+    }
+    for (int i = 0; i < e->count; i++) {
+      sym_bound(e->syms[i], -1);
+      lval_del(e->vals[i]);
+    }
+    free(e->syms);
+    free(e->vals);
+    free(e->index);
+    gc_untrack(e->gc);
+    pool_free(&lenv_pool, e);
+    e = par;
   }
-  free(e->syms);
-  free(e->vals);
-  free(e);
 }
 
+void lenv_index(lenv* e);
+
 lenv* lenv_copy(lenv* e) {
-  lenv* n = malloc(sizeof(lenv));
-  n->par = e->par;
+  lenv* n = lenv_new();
+  n->par = e->par ? lenv_retain(e->par) : NULL;
+  n->lex = e->lex ? lenv_retain(e->lex) : NULL;
+  if (!e->count) {
+    return n;
+  }
   n->count = e->count;
   n->syms = malloc(sizeof(char*) * n->count);
   n->vals = malloc(sizeof(lval*) * n->count);
   for (int i = 0; i < e->count; i++) {
-    n->syms[i] = malloc(strlen(e->syms[i]) + 1);
-    strcpy(n->syms[i], e->syms[i]);
-    n->vals[i] = lval_copy(e->vals[i]);
+    n->syms[i] = e->syms[i];
+    n->vals[i] = lval_retain(e->vals[i]);
+    sym_bound(n->syms[i], 1);
+  }
+  if (e->index) {
+    lenv_index(n);
   }
   return n;
 }
 
-lval* lenv_get(lenv* e, lval* k) {
+unsigned long lenv_hash(char* sym) {
+  return ((unsigned long)sym >> 4) * 2654435761UL;
+}
+
+void lenv_index_add(lenv* e, int i) {
+  unsigned long h = lenv_hash(e->syms[i]) & (e->cap - 1);
+  while (e->index[h] != -1) {
+    h = (h + 1) & (e->cap - 1);
+  }
+  e->index[h] = i;
+}
 
+/* Rebuild the index so it stays at most half full */
+void lenv_index(lenv* e) {
+  e->cap = 16;
+  while (e->cap < e->count * 2) {
+    e->cap *= 2;
+  }
+  e->index = realloc(e->index, sizeof(int) * e->cap);
+  for (int i = 0; i < e->cap; i++) {
+    e->index[i] = -1;
+  }
   for (int i = 0; i < e->count; i++) {
-    if (strcmp(e->syms[i], k->sym) == 0) {
-      return lval_copy(e->vals[i]);
+    lenv_index_add(e, i);
+  }
+}
+
+/* Position of an interned symbol in this frame only, or -1 */
+int lenv_find(lenv* e, char* sym) {
+  if (!e->index) {
+    for (int i = 0; i < e->count; i++) {
+      if (e->syms[i] == sym) {
+        return i;
+      }
+    }
+    return -1;
+  }
+  unsigned long h = lenv_hash(sym) & (e->cap - 1);
+  while (e->index[h] != -1) {
+    if (e->syms[e->index[h]] == sym) {
+      return e->index[h];
     }
+    h = (h + 1) & (e->cap - 1);
   }
+  return -1;
+}
 
-  if (e->par) {
-    return lenv_get(e->par, k);
-  } else {
-    return lval_err("Unbound Symbol '%s'", k->sym);
+lval* lenv_lookup(lenv* e, lval* k) {
+
+  for (; e; e = e->par) {
+    for (lenv* l = e; l; l = l->lex) {
+      int i = lenv_find(l, k->sym);
+      if (i != -1) {
+        return lval_retain(l->vals[i]);
+      }
+    }
   }
+
+  return lval_err("Unbound Symbol '%s'", k->sym);
 }
 
-void lenv_put(lenv* e, lval* k, lval* v) {
+/* Follow a symbol's address, or return NULL if it does not hold here */
+lval* lenv_addr(lenv* e, lval* k) {
+  for (int d = 0; d < k->depth; d++) {
+    if (!e->lex || lenv_find(e, k->sym) != -1) {
+      return NULL;
+    }
+    e = e->lex;
+  }
+  if (k->slot < e->count && e->syms[k->slot] == k->sym) {
+    return e->vals[k->slot];
+  }
+  return NULL;
+}
 
-  for (int i = 0; i < e->count; i++) {
-    if (strcmp(e->syms[i], k->sym) == 0) {
-      lval_del(e->vals[i]);
-      e->vals[i] = lval_copy(v);
-      return;
+lval* lenv_get(lenv* e, lval* k) {
+
+  if (k->depth != -1) {
+    lval* x = lenv_addr(e, k);
+    if (x) {
+      return lval_retain(x);
     }
   }
 
+  /* A name bound by the global frame alone needs no walk up the chain */
+  if (sym_info(k->sym)->binds == 1 && lenv_global) {
+    int i = lenv_find(lenv_global, k->sym);
+    if (i != -1) {
+      return lval_retain(lenv_global->vals[i]);
+    }
+  }
+
+  return lenv_lookup(e, k);
+}
+
+void lenv_put(lenv* e, lval* k, lval* v) {
+
+  int i = lenv_find(e, k->sym);
+  if (i != -1) {
+    lval_del(e->vals[i]);
+    e->vals[i] = lval_retain(v);
+    sym_bound(k->sym, 0);
+    return;
+  }
+
   e->count++;
   e->vals = realloc(e->vals, sizeof(lval*) * e->count);
   e->syms = realloc(e->syms, sizeof(char*) * e->count);
-  e->vals[e->count - 1] = lval_copy(v);
-  e->syms[e->count - 1] = malloc(strlen(k->sym) + 1);
-  strcpy(e->syms[e->count - 1], k->sym);
+  e->vals[e->count - 1] = lval_retain(v);
+  e->syms[e->count - 1] = k->sym;
+
+  if (e->count > LENV_LINEAR_MAX) {
+    if (e->count * 2 > e->cap) {
+      lenv_index(e);
+    } else {
+      lenv_index_add(e, e->count - 1);
+    }
+  }
+  sym_bound(k->sym, 1);
 }
 
 void lenv_def(lenv* e, lval* k, lval* v) {
@@ -453,6 +1068,202 @@ void lenv_def(lenv* e, lval* k, lval* v) {
   lenv_put(e, k, v);
 }
 
+/* Garbage Collection */
+
+/* Reference counting frees everything except cycles, which the collector
+ * finds with a mark-and-sweep over the registered heap. References held
+ * from inside the heap are subtracted from each object's count; whatever
+ * remains is held from C, which makes the object a root. That covers the
+ * global environment in main, values live on the evaluation stack and the
+ * forms builtin_load is still working through. Anything not reachable from
+ * a root is garbage. Collection only happens at the start of evaluating an
+ * S-Expression, where every reference count is exact. */
+
+/* Where each kind of object keeps its reference count and slot */
+int* gc_ref(gc_slot* s) {
+  switch (s->kind) {
+    case GC_LVAL:
+      return &((lval*)s->obj)->ref;
+    case GC_LENV:
+      return &((lenv*)s->obj)->ref;
+  }
+  return &((lcells*)s->obj)->ref;
+}
+
+int* gc_index(gc_slot* s) {
+  switch (s->kind) {
+    case GC_LVAL:
+      return &((lval*)s->obj)->gc;
+    case GC_LENV:
+      return &((lenv*)s->obj)->gc;
+  }
+  return &((lcells*)s->obj)->gc;
+}
+
+void gc_untrack(int i) {
+  gc.count--;
+  gc.slots[i] = gc.slots[gc.count];
+  if (i == gc.count) {
+    return;
+  }
+  *gc_index(&gc.slots[i]) = i;
+}
+
+int* gc_stack;
+int gc_stack_count;
+int gc_stack_cap;
+
+void gc_push(int i) {
+  if (gc_stack_count == gc_stack_cap) {
+    gc_stack_cap = gc_stack_cap ? gc_stack_cap * 2 : 1024;
+    gc_stack = realloc(gc_stack, sizeof(int) * gc_stack_cap);
+  }
+  gc_stack[gc_stack_count++] = i;
+}
+
+/* Call f on the slot of every heap object directly referenced by slot i */
+void gc_children(int i, void (*f)(int)) {
+  if (gc.slots[i].kind == GC_LENV) {
+    lenv* e = gc.slots[i].obj;
+    if (e->par) {
+      f(e->par->gc);
+    }
+    if (e->lex) {
+      f(e->lex->gc);
+    }
+    for (int j = 0; j < e->count; j++) {
+      f(e->vals[j]->gc);
+    }
+    return;
+  }
+  if (gc.slots[i].kind == GC_CELLS) {
+    lcells* b = gc.slots[i].obj;
+    for (int j = b->lo; j < b->hi; j++) {
+      f(b->items[j]->gc);
+    }
+    return;
+  }
+  lval* v = gc.slots[i].obj;
+  switch (v->type) {
+    case LVAL_FUN:
+      if (!v->builtin) {
+        f(v->env->gc);
+        f(v->formals->gc);
+        f(v->body->gc);
+      }
+      break;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      if (v->buf) {
+        f(v->buf->gc);
+      }
+      break;
+  }
+}
+
+void gc_unref(int i) { gc.slots[i].refs--; }
+
+void gc_reach(int i) {
+  if (gc.slots[i].refs <= 0) {
+    gc.slots[i].refs = 1;
+    gc_push(i);
+  }
+}
+
+void gc_release(int i) {
+  if (gc.slots[i].refs <= 0) {
+    return;
+  }
+  (*gc_ref(&gc.slots[i]))--;
+}
+
+/* Free an object's storage without touching what it references */
+void gc_free(gc_slot* s) {
+  if (s->kind == GC_LENV) {
+    lenv* e = s->obj;
+    for (int j = 0; j < e->count; j++) {
+      sym_bound(e->syms[j], -1);
+    }
+    free(e->syms);
+    free(e->vals);
+    free(e->index);
+    pool_free(&lenv_pool, e);
+    return;
+  }
+  if (s->kind == GC_CELLS) {
+    free(s->obj);
+    return;
+  }
+  lval* v = s->obj;
+  switch (v->type) {
+    case LVAL_ERR:
+    case LVAL_STR:
+      lval_text_del(v, v->str);
+      break;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      lcode_del(v->code);
+      break;
+  }
+  pool_free(&lval_pool, v);
+}
+
+void gc_collect(void) {
+  clock_t start = clock();
+
+  /* Count references from outside the heap */
+  for (int i = 0; i < gc.count; i++) {
+    gc.slots[i].refs = *gc_ref(&gc.slots[i]);
+  }
+  for (int i = 0; i < gc.count; i++) {
+    gc_children(i, gc_unref);
+  }
+
+  /* Mark everything reachable from those roots */
+  for (int i = 0; i < gc.count; i++) {
+    if (gc.slots[i].refs > 0) {
+      gc_push(i);
+    }
+  }
+  while (gc_stack_count) {
+    gc_children(gc_stack[--gc_stack_count], gc_reach);
+  }
+
+  /* Garbage gives up its references to live objects, then is swept */
+  for (int i = 0; i < gc.count; i++) {
+    if (gc.slots[i].refs <= 0) {
+      gc_children(i, gc_release);
+    }
+  }
+  int live = 0;
+  for (int i = 0; i < gc.count; i++) {
+    if (gc.slots[i].refs <= 0) {
+      gc_free(&gc.slots[i]);
+      continue;
+    }
+    gc.slots[live] = gc.slots[i];
+    *gc_index(&gc.slots[live]) = live;
+    live++;
+  }
+  gc.freed += gc.count - live;
+  gc.count = live;
+
+  gc.allocs = 0;
+  gc.threshold = gc.count > GC_MIN_THRESHOLD ? gc.count : GC_MIN_THRESHOLD;
+  gc.collections++;
+  gc.pause_last = (long)(clock() - start) * 1000000 / CLOCKS_PER_SEC;
+  gc.pause_total += gc.pause_last;
+  if (gc.pause_last > gc.pause_max) {
+    gc.pause_max = gc.pause_last;
+  }
+}
+
+void gc_maybe_collect(void) {
+  if (gc.allocs >= gc.threshold) {
+    gc_collect();
+  }
+}
+
 /* Builtins */
 
 #define LASSERT(args, cond, fmt, ...)                                          \
@@ -480,8 +1291,130 @@ void lenv_def(lenv* e, lval* k, lval* v) {
           "Function '%s' passed {} for argument %i.", func, index);
 
 lval* lval_eval(lenv* e, lval* v);
-
-lval* builtin_lambda(lenv* e, lval* a) {
+lval* lval_eval_qexpr(lenv* e, lval* x);
+
+/* Lexical Addressing */
+
+/* Before a lambda body first runs, each symbol naming a formal is given the
+ * address its value will have in the call frame: how many frames up, and
+ * which slot. Formals of lambdas written directly inside the body are
+ * addressed the same way, one frame deeper each. lenv_get checks an
+ * address before trusting it, so bodies evaluated somewhere unexpected,
+ * e.g. code built at runtime and passed to eval, fall back to lookup by
+ * name.
+ *
+ * A lambda written inside another whose body uses the outer formals is a
+ * closure: it keeps the frame it is created in as its lex frame, shared by
+ * reference, and those addresses are followed through lex frames. Its body
+ * is marked so while the outer body is resolved, which also means creating
+ * it again later needs no further work. So is one using a name the outer
+ * body binds in its own frame with =, though that name has no fixed slot
+ * and is looked up by name through the lex frame. */
+
+typedef struct lscope {
+  lval* formals;
+  lval* body;
+  struct lscope* up;
+} lscope;
+
+/* Slot a formal is bound to by lval_call, or -1 */
+int lscope_slot(lval* formals, char* sym) {
+  int slot = 0;
+  for (int i = 0; i < formals->count; i++) {
+    char* s = formals->cell[i]->sym;
+    if (strcmp(s, "&") == 0) {
+      continue;
+    }
+    if (s == sym) {
+      return slot;
+    }
+    int seen = 0;
+    for (int j = 0; j < i; j++) {
+      seen = seen || formals->cell[j]->sym == s;
+    }
+    slot += !seen;
+  }
+  return -1;
+}
+
+int lval_is_lambda(lval* v) {
+  if (v->count != 3 || v->cell[0]->type != LVAL_SYM ||
+      strcmp(v->cell[0]->sym, "\\") != 0 ||
+      v->cell[1]->type != LVAL_QEXPR || v->cell[2]->type != LVAL_QEXPR) {
+    return 0;
+  }
+  for (int i = 0; i < v->cell[1]->count; i++) {
+    if (v->cell[1]->cell[i]->type != LVAL_SYM) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* Does v bind sym with = outside any lambda written in it? */
+int lscope_local(lval* v, char* sym) {
+  if (v->type != LVAL_SEXPR && v->type != LVAL_QEXPR) {
+    return 0;
+  }
+  if (lval_is_lambda(v)) {
+    return 0;
+  }
+  if (v->count > 1 && v->cell[0]->type == LVAL_SYM &&
+      strcmp(v->cell[0]->sym, "=") == 0 && v->cell[1]->type == LVAL_QEXPR) {
+    for (int i = 0; i < v->cell[1]->count; i++) {
+      lval* s = v->cell[1]->cell[i];
+      if (s->type == LVAL_SYM && s->sym == sym) {
+        return 1;
+      }
+    }
+  }
+  for (int i = 0; i < v->count; i++) {
+    if (lscope_local(v->cell[i], sym)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Resolve the symbols in v against sc, returning the greatest depth any of
+ * them resolved to, or -1 */
+int lval_resolve(lval* v, lscope* sc) {
+  int reach = -1;
+  switch (v->type) {
+    case LVAL_SYM: {
+      int depth = 0;
+      for (; sc; sc = sc->up, depth++) {
+        int slot = lscope_slot(sc->formals, v->sym);
+        if (slot != -1) {
+          v->depth = depth;
+          v->slot = slot;
+          return depth;
+        }
+        if (depth > 0 && lscope_local(sc->body, v->sym)) {
+          return depth;
+        }
+      }
+      break;
+    }
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      if (lval_is_lambda(v)) {
+        lval* body = v->cell[2];
+        lscope inner = {v->cell[1], body, sc};
+        int depth = lval_resolve(body, &inner);
+        body->resolved = depth > 0 ? LVAL_CLOSURE : LVAL_RESOLVED;
+        return depth - 1;
+      }
+      for (int i = 0; i < v->count; i++) {
+        int depth = lval_resolve(v->cell[i], sc);
+        reach = depth > reach ? depth : reach;
+      }
+      break;
+  }
+  return reach;
+}
+
+lval* builtin_lambda(lenv* e, lval* a) {
   LASSERT_NUM("\\", a, 2);
   LASSERT_TYPE("\\", a, 0, LVAL_QEXPR);
   LASSERT_TYPE("\\", a, 1, LVAL_QEXPR);
@@ -496,7 +1429,17 @@ lval* builtin_lambda(lenv* e, lval* a) {
   lval* body = lval_pop(a, 0);
   lval_del(a);
 
-  return lval_lambda(formals, body);
+  if (body->resolved == LVAL_UNRESOLVED) {
+    lscope sc = {formals, body, NULL};
+    lval_resolve(body, &sc);
+    body->resolved = LVAL_RESOLVED;
+  }
+
+  lval* f = lval_lambda(formals, body);
+  if (body->resolved == LVAL_CLOSURE && e != lenv_global) {
+    f->env->lex = lenv_retain(e);
+  }
+  return f;
 }
 
 lval* builtin_list(lenv* e, lval* a) {
@@ -510,10 +1453,9 @@ lval* builtin_head(lenv* e, lval* a) {
   LASSERT_NOT_EMPTY("head", a, 0);
 
   lval* v = lval_take(a, 0);
-  while (v->count > 1) {
-    lval_del(lval_pop(v, 1));
-  }
-  return v;
+  lval* x = lval_add(lval_qexpr(), lval_retain(v->cell[0]));
+  lval_del(v);
+  return x;
 }
 
 lval* builtin_tail(lenv* e, lval* a) {
@@ -521,18 +1463,22 @@ lval* builtin_tail(lenv* e, lval* a) {
   LASSERT_TYPE("tail", a, 0, LVAL_QEXPR);
   LASSERT_NOT_EMPTY("tail", a, 0);
 
-  lval* v = lval_take(a, 0);
+  lval* v = lval_own(lval_take(a, 0));
   lval_del(lval_pop(v, 0));
   return v;
 }
 
-lval* builtin_eval(lenv* e, lval* a) {
+/* The expression eval evaluates, or an error */
+lval* builtin_eval_expr(lval* a) {
   LASSERT_NUM("eval", a, 1);
   LASSERT_TYPE("eval", a, 0, LVAL_QEXPR);
 
-  lval* x = lval_take(a, 0);
-  x->type = LVAL_SEXPR;
-  return lval_eval(e, x);
+  return lval_take(a, 0);
+}
+
+lval* builtin_eval(lenv* e, lval* a) {
+  lval* x = builtin_eval_expr(a);
+  return x->type == LVAL_ERR ? x : lval_eval_qexpr(e, x);
 }
 
 lval* builtin_join(lenv* e, lval* a) {
@@ -558,7 +1504,7 @@ lval* builtin_op(lenv* e, lval* a, char* op) {
     LASSERT_TYPE(op, a, i, LVAL_NUM);
   }
 
-  lval* x = lval_pop(a, 0);
+  lval* x = lval_own(lval_pop(a, 0));
 
   if ((strcmp(op, "-") == 0) && a->count == 0) {
     x->num = -x->num;
@@ -673,70 +1619,73 @@ lval* builtin_cmp(lenv* e, lval* a, char* op) {
 lval* builtin_eq(lenv* e, lval* a) { return builtin_cmp(e, a, "=="); }
 lval* builtin_ne(lenv* e, lval* a) { return builtin_cmp(e, a, "!="); }
 
-lval* builtin_if(lenv* e, lval* a) {
+/* The branch if evaluates, or an error */
+lval* builtin_if_expr(lval* a) {
   LASSERT_NUM("if", a, 3);
   LASSERT_TYPE("if", a, 0, LVAL_NUM);
   LASSERT_TYPE("if", a, 1, LVAL_QEXPR);
   LASSERT_TYPE("if", a, 2, LVAL_QEXPR);
 
-  lval* x;
-  a->cell[1]->type = LVAL_SEXPR;
-  a->cell[2]->type = LVAL_SEXPR;
-
-  if (a->cell[0]->num) {
-    x = lval_eval(e, lval_pop(a, 1));
-  } else {
-    x = lval_eval(e, lval_pop(a, 2));
-  }
-
+  lval* x = lval_pop(a, a->cell[0]->num ? 1 : 2);
   lval_del(a);
   return x;
 }
 
-lval* lval_read(mpc_ast_t* t);
+lval* builtin_if(lenv* e, lval* a) {
+  lval* x = builtin_if_expr(a);
+  return x->type == LVAL_ERR ? x : lval_eval_qexpr(e, x);
+}
+
+/* The evaluator treats do specially so that its last argument is evaluated
+ * in tail position; this is only reached when it is applied some other way */
+lval* builtin_do(lenv* e, lval* a) {
+  if (a->count == 0) {
+    lval_del(a);
+    return lval_qexpr();
+  }
+  return lval_take(a, a->count - 1);
+}
+
+typedef struct lsource lsource;
+lsource* lsource_open(char* filename, char** err);
+lval* lsource_next(lsource* src, char** err);
+void lsource_close(lsource* src);
 
 lval* builtin_load(lenv* e, lval* a) {
   LASSERT_NUM("load", a, 1);
   LASSERT_TYPE("load", a, 0, LVAL_STR);
 
-  /* Parse File given by string name */
-  mpc_result_t r;
-  if (mpc_parse_contents(a->cell[0]->str, Lispy, &r)) {
-
-    /* Read contents */
-    lval* expr = lval_read(r.output);
-    mpc_ast_delete(r.output);
-
-    /* Evaluate each Expression */
-    while (expr->count) {
-      lval* x = lval_eval(e, lval_pop(expr, 0));
-      /* If Evaluation leads to error print it */
-      if (x->type == LVAL_ERR) {
-        lval_println(x);
-      }
-      lval_del(x);
+  /* Open File given by string name */
+  char* err_msg = NULL;
+  lsource* src = lsource_open(a->cell[0]->str, &err_msg);
+
+  /* Evaluate each Expression as soon as it is read, so that only one is
+   * held at a time */
+  lval* expr;
+  while (src && (expr = lsource_next(src, &err_msg))) {
+    lval* x = lval_eval(e, expr);
+    /* If Evaluation leads to error print it */
+    if (x->type == LVAL_ERR) {
+      lval_println(x);
     }
+    lval_del(x);
+  }
 
-    /* Delete expressions and arguments */
-    lval_del(expr);
-    lval_del(a);
-
-    /* Return empty list */
-    return lval_sexpr();
-
-  } else {
-    /* Get Parse Error as String */
-    char* err_msg = mpc_err_string(r.error);
-    mpc_err_delete(r.error);
+  /* Close the file and delete arguments */
+  if (src) {
+    lsource_close(src);
+  }
+  lval_del(a);
 
-    /* Create new error message using it */
+  /* A syntax error anywhere stops the load before any of it has run */
+  if (err_msg) {
     lval* err = lval_err("Could not load Library %s", err_msg);
     free(err_msg);
-    lval_del(a);
-
-    /* Cleanup and return error */
     return err;
   }
+
+  /* Return empty list */
+  return lval_sexpr();
 }
 
 lval* builtin_print(lenv* e, lval* a) {
@@ -766,7 +1715,86 @@ lval* builtin_error(lenv* e, lval* a) {
   return err;
 }
 
+lval* lval_stat(char* name, long x) {
+  return lval_add(lval_add(lval_qexpr(), lval_str(name)), lval_num(x));
+}
+
+lval* builtin_gc_stats(lenv* e, lval* a) {
+
+  /* A call needs an argument, so this takes () and nothing else */
+  LASSERT_NUM("gc-stats", a, 1);
+  LASSERT_TYPE("gc-stats", a, 0, LVAL_SEXPR);
+  LASSERT(a, a->cell[0]->count == 0,
+          "Function 'gc-stats' passed incorrect argument. Expected ().");
+  lval_del(a);
+
+  long bytes = 0;
+  for (int i = 0; i < gc.count; i++) {
+    if (gc.slots[i].kind == GC_LENV) {
+      lenv* x = gc.slots[i].obj;
+      bytes += sizeof(lenv) + x->count * (sizeof(char*) + sizeof(lval*));
+      bytes += x->cap * sizeof(int);
+      continue;
+    }
+    if (gc.slots[i].kind == GC_CELLS) {
+      lcells* b = gc.slots[i].obj;
+      bytes += sizeof(lcells) + b->cap * sizeof(lval*);
+      continue;
+    }
+    lval* v = gc.slots[i].obj;
+    bytes += sizeof(lval);
+    if ((v->type == LVAL_ERR || v->type == LVAL_STR) && v->str != v->small) {
+      bytes += strlen(v->str) + 1;
+    }
+  }
+
+  lval* x = lval_qexpr();
+  x = lval_add(x, lval_stat("heap-objects", gc.count));
+  x = lval_add(x, lval_stat("heap-bytes", bytes));
+  x = lval_add(x, lval_stat("collections", gc.collections));
+  x = lval_add(x, lval_stat("freed", gc.freed));
+  x = lval_add(x, lval_stat("pause-last-us", gc.pause_last));
+  x = lval_add(x, lval_stat("pause-max-us", gc.pause_max));
+  x = lval_add(x, lval_stat("pause-total-us", gc.pause_total));
+  x = lval_add(x, lval_stat("pool-allocs",
+                            lval_pool.pooled + lenv_pool.pooled));
+  x = lval_add(x, lval_stat("slab-allocs", lval_pool.slabs + lenv_pool.slabs));
+  return x;
+}
+
+/* Every builtin by the name it was first added under, for images */
+struct {
+  char** names;
+  lbuiltin* funcs;
+  int count;
+} builtins;
+
+char* builtin_name(lbuiltin func) {
+  for (int i = 0; i < builtins.count; i++) {
+    if (builtins.funcs[i] == func) {
+      return builtins.names[i];
+    }
+  }
+  return NULL;
+}
+
+lbuiltin builtin_named(char* name) {
+  for (int i = 0; i < builtins.count; i++) {
+    if (strcmp(builtins.names[i], name) == 0) {
+      return builtins.funcs[i];
+    }
+  }
+  return NULL;
+}
+
 void lenv_add_builtin(lenv* e, char* name, lbuiltin func) {
+  if (!builtin_name(func)) {
+    builtins.count++;
+    builtins.names = realloc(builtins.names, sizeof(char*) * builtins.count);
+    builtins.funcs = realloc(builtins.funcs, sizeof(lbuiltin) * builtins.count);
+    builtins.names[builtins.count - 1] = name;
+    builtins.funcs[builtins.count - 1] = func;
+  }
   lval* k = lval_sym(name);
   lval* v = lval_builtin(func);
   lenv_put(e, k, v);
@@ -774,11 +1802,28 @@ void lenv_add_builtin(lenv* e, char* name, lbuiltin func) {
   lval_del(v);
 }
 
+/* Native list functions, with the evaluator they call back into */
+int lval_native = 1;
+lval* builtin_len(lenv* e, lval* a);
+lval* builtin_nth(lenv* e, lval* a);
+lval* builtin_map(lenv* e, lval* a);
+lval* builtin_filter(lenv* e, lval* a);
+lval* builtin_foldl(lenv* e, lval* a);
+lval* builtin_reverse(lenv* e, lval* a);
+lval* builtin_take(lenv* e, lval* a);
+lval* builtin_drop(lenv* e, lval* a);
+lval* builtin_elem(lenv* e, lval* a);
+lval* builtin_lookup(lenv* e, lval* a);
+lval* builtin_zip(lenv* e, lval* a);
+lval* builtin_unzip(lenv* e, lval* a);
+lval* builtin_fallback(lenv* e, lval* a);
+
 void lenv_add_builtins(lenv* e) {
   /* Variable Functions */
   lenv_add_builtin(e, "\\", builtin_lambda);
   lenv_add_builtin(e, "def", builtin_def);
   lenv_add_builtin(e, "=", builtin_put);
+  lenv_add_builtin(e, "fallback", builtin_fallback);
 
   /* List Functions */
   lenv_add_builtin(e, "list", builtin_list);
@@ -786,6 +1831,20 @@ void lenv_add_builtins(lenv* e) {
   lenv_add_builtin(e, "tail", builtin_tail);
   lenv_add_builtin(e, "eval", builtin_eval);
   lenv_add_builtin(e, "join", builtin_join);
+  if (lval_native) {
+    lenv_add_builtin(e, "len", builtin_len);
+    lenv_add_builtin(e, "nth", builtin_nth);
+    lenv_add_builtin(e, "map", builtin_map);
+    lenv_add_builtin(e, "filter", builtin_filter);
+    lenv_add_builtin(e, "foldl", builtin_foldl);
+    lenv_add_builtin(e, "reverse", builtin_reverse);
+    lenv_add_builtin(e, "take", builtin_take);
+    lenv_add_builtin(e, "drop", builtin_drop);
+    lenv_add_builtin(e, "elem", builtin_elem);
+    lenv_add_builtin(e, "lookup", builtin_lookup);
+    lenv_add_builtin(e, "zip", builtin_zip);
+    lenv_add_builtin(e, "unzip", builtin_unzip);
+  }
 
   /* Mathematical Functions */
   lenv_add_builtin(e, "+", builtin_add);
@@ -795,6 +1854,7 @@ void lenv_add_builtins(lenv* e) {
 
   /* Comparison Functions */
   lenv_add_builtin(e, "if", builtin_if);
+  lenv_add_builtin(e, "do", builtin_do);
   lenv_add_builtin(e, "==", builtin_eq);
   lenv_add_builtin(e, "!=", builtin_ne);
   lenv_add_builtin(e, ">", builtin_gt);
@@ -806,82 +1866,117 @@ void lenv_add_builtins(lenv* e) {
   lenv_add_builtin(e, "load", builtin_load);
   lenv_add_builtin(e, "error", builtin_error);
   lenv_add_builtin(e, "print", builtin_print);
+
+  /* Memory Functions */
+  lenv_add_builtin(e, "gc-stats", builtin_gc_stats);
 }
 
 /* Evaluation */
 
-lval* lval_call(lenv* e, lval* f, lval* a) {
-
-  if (f->builtin) {
-    return f->builtin(e, a);
-  }
+/* Bind the arguments a to the formals of f in a new frame, which starts
+ * with the bindings of any arguments f was already partially applied to.
+ * Returns NULL with the frame in *frame once every formal is bound.
+ * Otherwise returns an error, or a new function holding the frame and the
+ * formals still unbound. f itself is never changed. */
+lval* lval_bind(lenv* e, lval* f, lval* a, lenv** frame) {
 
-  int given = a->count;
+  lenv* env = lenv_copy(f->env);
+  lval** formals = f->formals->cell;
   int total = f->formals->count;
+  int given = a->count;
+  int i = 0;
 
   while (a->count) {
 
-    if (f->formals->count == 0) {
+    if (i == total) {
       lval_del(a);
+      lenv_del(env);
       return lval_err("Function passed too many arguments. "
                       "Got %i, Expected %i.",
                       given, total);
     }
 
-    lval* sym = lval_pop(f->formals, 0);
+    lval* sym = formals[i++];
 
     if (strcmp(sym->sym, "&") == 0) {
 
-      if (f->formals->count != 1) {
+      if (i != total - 1) {
         lval_del(a);
+        lenv_del(env);
         return lval_err("Function format invalid. "
                         "Symbol '&' not followed by single symbol.");
       }
 
-      lval* nsym = lval_pop(f->formals, 0);
-      lenv_put(f->env, nsym, builtin_list(e, a));
-      lval_del(sym);
-      lval_del(nsym);
+      lenv_put(env, formals[i++], builtin_list(e, a));
       break;
     }
 
     lval* val = lval_pop(a, 0);
-    lenv_put(f->env, sym, val);
-    lval_del(sym);
+    lenv_put(env, sym, val);
     lval_del(val);
   }
 
   lval_del(a);
 
-  if (f->formals->count > 0 && strcmp(f->formals->cell[0]->sym, "&") == 0) {
+  if (i < total && strcmp(formals[i]->sym, "&") == 0) {
 
-    if (f->formals->count != 2) {
+    if (i != total - 2) {
+      lenv_del(env);
       return lval_err("Function format invalid. "
                       "Symbol '&' not followed by single symbol.");
     }
 
-    lval_del(lval_pop(f->formals, 0));
-
-    lval* sym = lval_pop(f->formals, 0);
     lval* val = lval_qexpr();
-    lenv_put(f->env, sym, val);
-    lval_del(sym);
+    lenv_put(env, formals[i + 1], val);
     lval_del(val);
+    i += 2;
   }
 
-  if (f->formals->count == 0) {
-    f->env->par = e;
-    return builtin_eval(f->env, lval_add(lval_sexpr(), lval_copy(f->body)));
-  } else {
-    return lval_copy(f);
+  if (i == total) {
+    *frame = env;
+    return NULL;
+  }
+
+  lval* p = lval_new(LVAL_FUN);
+  p->builtin = NULL;
+  p->env = env;
+  p->formals = lval_qexpr();
+  for (; i < total; i++) {
+    lval_add(p->formals, lval_retain(formals[i]));
   }
+  p->body = lval_retain(f->body);
+  return p;
 }
 
-lval* lval_eval_sexpr(lenv* e, lval* v) {
+lval* lval_continue(lenv* e, lval* x, lenv* frame);
 
-  for (int i = 0; i < v->count; i++) {
-    v->cell[i] = lval_eval(e, v->cell[i]);
+lval* lval_call(lenv* e, lval* f, lval* a) {
+
+  if (f->builtin) {
+    return f->builtin(e, a);
   }
+
+  lenv* frame;
+  lval* r = lval_bind(e, f, a, &frame);
+  if (r) {
+    return r;
+  }
+
+  return lval_continue(e, lval_retain(f->body), frame);
+}
+
+/* Apply an S-Expression whose children have already been evaluated.
+ *
+ * When its value is that of another expression (a function body, the
+ * branch chosen by if, or the argument to eval) that expression is not
+ * evaluated here. It is put in *x and NULL returned, so the caller can
+ * evaluate it in place and calls in tail position use no C stack. For a
+ * function body *frame is set to the new frame to evaluate it in;
+ * otherwise *frame is NULL and the environment is e. */
+lval* lval_apply(lenv* e, lval* v, lval** x, lenv** frame) {
+
+  *frame = NULL;
+
   for (int i = 0; i < v->count; i++) {
     if (v->cell[i]->type == LVAL_ERR) {
       return lval_take(v, i);
@@ -905,149 +2000,2257 @@ lval* lval_eval_sexpr(lenv* e, lval* v) {
     return err;
   }
 
-  lval* result = lval_call(e, f, v);
-  lval_del(f);
-  return result;
-}
+  lval* r;
+  if (f->builtin == builtin_if || f->builtin == builtin_eval) {
+    r = f->builtin == builtin_if ? builtin_if_expr(v) : builtin_eval_expr(v);
+    lval_del(f);
+    if (r->type == LVAL_ERR) {
+      return r;
+    }
+    *x = r;
+    return NULL;
+  }
 
-lval* lval_eval(lenv* e, lval* v) {
-  if (v->type == LVAL_SYM) {
-    lval* x = lenv_get(e, v);
-    lval_del(v);
-    return x;
+  if (f->builtin) {
+    r = lval_call(e, f, v);
+    lval_del(f);
+    return r;
   }
-  if (v->type == LVAL_SEXPR) {
-    return lval_eval_sexpr(e, v);
+
+  r = lval_bind(e, f, v, frame);
+  if (!r) {
+    *x = lval_retain(f->body);
   }
-  return v;
+  lval_del(f);
+  return r;
 }
 
-/* Reading */
+/* Evaluate what lval_apply left to its caller, outside tail position */
+lval* lval_continue(lenv* e, lval* x, lenv* frame) {
+  if (!frame) {
+    return lval_eval_qexpr(e, x);
+  }
+  frame->par = lenv_retain(e);
+  lval* r = lval_eval_qexpr(frame, x);
+  lenv_del(frame);
+  return r;
+}
 
-lval* lval_read_num(mpc_ast_t* t) {
-  errno = 0;
-  long x = strtol(t->contents, NULL, 10);
-  return errno != ERANGE ? lval_num(x) : lval_err("Invalid Number.");
+/* Is every name visible through e bound again in f, or through the same
+ * lex frames, so that no lookup from f can reach e? */
+int lenv_shadows(lenv* f, lenv* e) {
+  if (e->lex && e->lex != f->lex) {
+    return 0;
+  }
+  for (int i = 0; i < e->count; i++) {
+    if (lenv_find(f, e->syms[i]) == -1) {
+      return 0;
+    }
+  }
+  return 1;
 }
 
-lval* lval_read_str(mpc_ast_t* t) {
-  /* Cut off the final quote character */
-  t->contents[strlen(t->contents) - 1] = '\0';
-  /* Copy the string missing out the first quote character */
-  char* unescaped = malloc(strlen(t->contents + 1) + 1);
-  strcpy(unescaped, t->contents + 1);
-  /* Pass through the unescape function */
-  unescaped = mpcf_unescape(unescaped);
-  /* Construct a new lval using the string */
-  lval* str = lval_str(unescaped);
-  /* Free the string and return */
-  free(unescaped);
-  return str;
+/* Make frame, the frame of a call in tail position from frame e, current.
+ * Scope is dynamic, so e stays visible from the callee as its parent,
+ * unless every name e binds is bound again. Then no lookup can reach e and
+ * it is skipped, which lets the caller's reference be its last. A function
+ * calling itself always runs in constant space this way. */
+void lenv_enter(lenv* e, lenv* frame) {
+  frame->par = lenv_retain(e->par && lenv_shadows(frame, e) ? e->par : e);
 }
 
-lval* lval_read(mpc_ast_t* t) {
+int lval_is_do(lval* x) {
+  return x->type == LVAL_FUN && x->builtin == builtin_do;
+}
 
-  if (strstr(t->tag, "number")) {
-    return lval_read_num(t);
-  }
-  if (strstr(t->tag, "string")) {
-    return lval_read_str(t);
-  }
-  if (strstr(t->tag, "symbol")) {
-    return lval_sym(t->contents);
+/* Evaluate the children of v into a new list, consuming v. When the list
+ * is a do form its last child is left unevaluated in *last, so it can be
+ * evaluated in tail position; otherwise *last is NULL. */
+lval* lval_eval_children(lenv* e, lval* v, lval** last) {
+  lval* a = lval_sexpr();
+  lval_reserve(a, 0, v->count);
+  *last = NULL;
+  for (int i = 0; i < v->count; i++) {
+    if (i > 0 && i == v->count - 1 && lval_is_do(a->cell[0])) {
+      *last = lval_retain(v->cell[i]);
+      break;
+    }
+    a = lval_add(a, lval_eval(e, lval_retain(v->cell[i])));
   }
+  lval_del(v);
+  return a;
+}
 
-  lval* x = NULL;
-  if (strcmp(t->tag, ">") == 0) {
-    x = lval_sexpr();
-  }
-  if (strstr(t->tag, "sexpr")) {
-    x = lval_sexpr();
-  }
-  if (strstr(t->tag, "qexpr")) {
-    x = lval_qexpr();
+int lval_has_err(lval* a) {
+  for (int i = 0; i < a->count; i++) {
+    if (a->cell[i]->type == LVAL_ERR) {
+      return 1;
+    }
   }
+  return 0;
+}
 
-  for (int i = 0; i < t->children_num; i++) {
-    if (strcmp(t->children[i]->contents, "(") == 0) {
-      continue;
+/* Set by --vm to run S-Expressions on the bytecode VM */
+int lval_vm = 0;
+
+lval* vm_run(lenv* e, lval* x);
+
+lval* lval_eval(lenv* e, lval* v) {
+
+  /* Calls in tail position are evaluated by this loop, not by recursion.
+   * frame is the frame the last of them entered, if any. */
+  lenv* frame = NULL;
+  lval* r = NULL;
+
+  while (!r) {
+
+    if (v->type == LVAL_SYM) {
+      r = lenv_get(e, v);
+      lval_del(v);
+      break;
     }
-    if (strcmp(t->children[i]->contents, ")") == 0) {
-      continue;
+    if (v->type != LVAL_SEXPR) {
+      r = v;
+      break;
     }
-    if (strcmp(t->children[i]->contents, "}") == 0) {
-      continue;
+    if (lval_vm) {
+      r = vm_run(e, v);
+      lval_del(v);
+      break;
     }
-    if (strcmp(t->children[i]->contents, "{") == 0) {
+
+    gc_maybe_collect();
+
+    lval* last;
+    lval* a = lval_eval_children(e, v, &last);
+
+    /* The last argument to do is still evaluated when an earlier one is an
+     * error, but the first error is the result */
+    if (last && !lval_has_err(a)) {
+      lval_del(a);
+      v = last;
       continue;
     }
-    if (strcmp(t->children[i]->tag, "regex") == 0) {
-      continue;
+    if (last) {
+      lval_del(lval_eval(e, last));
     }
-    if (strstr(t->children[i]->tag, "comment")) {
-      continue;
+
+    lval* x;
+    lenv* env;
+    r = lval_apply(e, a, &x, &env);
+    if (!r) {
+      if (env) {
+        lenv_enter(e, env);
+        lenv_del(frame);
+        frame = e = env;
+      }
+      v = lval_own(x);
+      v->type = LVAL_SEXPR;
     }
-    x = lval_add(x, lval_read(t->children[i]));
   }
 
-  return x;
+  lenv_del(frame);
+  return r;
 }
 
-/* Main */
+/* Evaluate the contents of a Q-Expression as an S-Expression */
+lval* lval_eval_qexpr(lenv* e, lval* x) {
+  if (lval_vm) {
+    lval* r = vm_run(e, x);
+    lval_del(x);
+    return r;
+  }
+  x = lval_own(x);
+  x->type = LVAL_SEXPR;
+  return lval_eval(e, x);
+}
 
-int main(int argc, char** argv) {
+/* Native List Library */
 
-  Number = mpc_new("number");
-  Symbol = mpc_new("symbol");
-  String = mpc_new("string");
-  Comment = mpc_new("comment");
-  Sexpr = mpc_new("sexpr");
-  Qexpr = mpc_new("qexpr");
-  Expr = mpc_new("expr");
-  Lispy = mpc_new("lispy");
+/* The list functions programs use most are builtins that do the same work
+ * as std.lspy without interpreting a call per element. Each only takes
+ * arguments it can treat exactly as the Lisp does. Where the Lisp
+ * evaluates an element with fst, that element must already be a value, so
+ * nothing is evaluated twice or in another scope. Everything else,
+ * including every case that is an error, is passed to the Lisp definition,
+ * which std.lspy gives with fallback. A function given to map, filter or
+ * foldl is called from the caller's environment rather than from inside
+ * the Lisp definition, so it no longer sees that definition's own
+ * parameters through dynamic scope. Run with --no-native to add none of
+ * them, so that fallback defines the Lisp functions in their place. */
 
-  mpca_lang(MPCA_LANG_DEFAULT, "                                              \
-      number  : /-?[0-9]+/ ;                       \
-      symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ; \
-      string  : /\"(\\\\.|[^\"])*\"/ ;             \
-      comment : /;[^\\r\\n]*/ ;                    \
-      sexpr   : '(' <expr>* ')' ;                  \
-      qexpr   : '{' <expr>* '}' ;                  \
-      expr    : <number>  | <symbol> | <string>    \
-              | <comment> | <sexpr>  | <qexpr>;    \
-      lispy   : /^/ <expr>* /$/ ;                  \
-    ",
-            Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+enum {
+  NATIVE_LEN,
+  NATIVE_NTH,
+  NATIVE_MAP,
+  NATIVE_FILTER,
+  NATIVE_FOLDL,
+  NATIVE_REVERSE,
+  NATIVE_TAKE,
+  NATIVE_DROP,
+  NATIVE_ELEM,
+  NATIVE_LOOKUP,
+  NATIVE_ZIP,
+  NATIVE_UNZIP,
+  NATIVE_COUNT
+};
 
-  lenv* e = lenv_new();
-  lenv_add_builtins(e);
-  lval* args = lval_add(lval_sexpr(), lval_str("std.lspy"));
-  lval* x = builtin_load(e, args);
-  if (x->type == LVAL_ERR) {
-    lval_println(x);
-  }
-  /* Interactive Prompt */
-  if (argc == 1) {
+char* native_names[NATIVE_COUNT] = {
+    "len",  "nth",  "map",  "filter", "foldl", "reverse",
+    "take", "drop", "elem", "lookup", "zip",   "unzip"};
 
-    puts("Lispy Version 0.0.0.1.0");
-    puts("Press Ctrl+c to Exit\n");
+/* The Lisp definition each native function falls back to */
+lval* native_lisp[NATIVE_COUNT];
+
+/* Apply an S-Expression of values, as evaluating it would once its
+ * children had been evaluated */
+lval* native_apply(lenv* e, lval* a) {
+  lval* x;
+  lenv* frame;
+  lval* r = lval_apply(e, a, &x, &frame);
+  return r ? r : lval_continue(e, x, frame);
+}
+
+lval* native_call(lenv* e, lval* f, lval* x) {
+  return native_apply(e, lval_add(lval_add(lval_sexpr(), lval_retain(f)), x));
+}
+
+lval* native_call2(lenv* e, lval* f, lval* x, lval* y) {
+  lval* a = lval_add(lval_add(lval_sexpr(), lval_retain(f)), x);
+  return native_apply(e, lval_add(a, y));
+}
+
+lval* native_fallback(lenv* e, int n, lval* a) {
+  if (!native_lisp[n]) {
+    lval_del(a);
+    return lval_err("Function '%s' has no fallback for these arguments.",
+                    native_names[n]);
+  }
+  lval* f = lval_add(lval_sexpr(), lval_retain(native_lisp[n]));
+  return native_apply(e, lval_join(f, a));
+}
+
+#define NATIVE_ASSERT(n, args, cond)                                           \
+  if (!(cond)) {                                                               \
+    return native_fallback(e, n, args);                                        \
+  }
+
+/* Would evaluating x give x itself? */
+int lval_is_value(lval* x) {
+  return x->type != LVAL_SYM && x->type != LVAL_SEXPR;
+}
+
+int lval_all_values(lval* l) {
+  for (int i = 0; i < l->count; i++) {
+    if (!lval_is_value(l->cell[i])) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+lval* builtin_len(lenv* e, lval* a) {
+  NATIVE_ASSERT(NATIVE_LEN, a,
+                a->count == 1 && a->cell[0]->type == LVAL_QEXPR);
+
+  lval* x = lval_num(a->cell[0]->count);
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_nth(lenv* e, lval* a) {
+  NATIVE_ASSERT(NATIVE_NTH, a,
+                a->count == 2 && a->cell[0]->type == LVAL_NUM &&
+                    a->cell[1]->type == LVAL_QEXPR);
+
+  long n = a->cell[0]->num;
+  lval* l = a->cell[1];
+  NATIVE_ASSERT(NATIVE_NTH, a,
+                n >= 0 && n < l->count && lval_is_value(l->cell[n]));
+
+  lval* x = lval_retain(l->cell[n]);
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_map(lenv* e, lval* a) {
+  NATIVE_ASSERT(NATIVE_MAP, a,
+                a->count == 2 && a->cell[0]->type == LVAL_FUN &&
+                    a->cell[1]->type == LVAL_QEXPR &&
+                    lval_all_values(a->cell[1]));
+
+  /* Like the Lisp, call f on every element even after an error, but
+   * return the first error */
+  lval* l = a->cell[1];
+  lval* x = lval_qexpr();
+  lval_reserve(x, 0, l->count);
+  lval* err = NULL;
+  for (int i = 0; i < l->count; i++) {
+    lval* y = native_call(e, a->cell[0], lval_retain(l->cell[i]));
+    if (err) {
+      lval_del(y);
+    } else if (y->type == LVAL_ERR) {
+      err = y;
+    } else {
+      x = lval_add(x, y);
+    }
+  }
+
+  lval_del(a);
+  if (err) {
+    lval_del(x);
+    return err;
+  }
+  return x;
+}
+
+lval* builtin_filter(lenv* e, lval* a) {
+  NATIVE_ASSERT(NATIVE_FILTER, a,
+                a->count == 2 && a->cell[0]->type == LVAL_FUN &&
+                    a->cell[1]->type == LVAL_QEXPR &&
+                    lval_all_values(a->cell[1]));
+
+  lval* l = a->cell[1];
+  lval* x = lval_qexpr();
+  lval* err = NULL;
+  for (int i = 0; i < l->count; i++) {
+    lval* y = native_call(e, a->cell[0], lval_retain(l->cell[i]));
+    if (err) {
+      lval_del(y);
+      continue;
+    }
+    if (y->type == LVAL_ERR) {
+      err = y;
+      continue;
+    }
+    /* The fallback tests the result with if, so report it as if does */
+    if (y->type != LVAL_NUM) {
+      err = lval_err("Function '%s' passed incorrect type for argument %i. "
+                     "Got %s, Expected %s.",
+                     "if", 0, ltype_name(y->type), ltype_name(LVAL_NUM));
+    } else if (y->num) {
+      x = lval_add(x, lval_retain(l->cell[i]));
+    }
+    lval_del(y);
+  }
+
+  lval_del(a);
+  if (err) {
+    lval_del(x);
+    return err;
+  }
+  return x;
+}
+
+lval* builtin_foldl(lenv* e, lval* a) {
+  NATIVE_ASSERT(NATIVE_FOLDL, a,
+                a->count == 3 && a->cell[0]->type == LVAL_FUN &&
+                    a->cell[2]->type == LVAL_QEXPR &&
+                    lval_all_values(a->cell[2]));
+
+  /* Once z is an error f is no longer called, and z is the result */
+  lval* l = a->cell[2];
+  lval* z = lval_retain(a->cell[1]);
+  for (int i = 0; i < l->count && z->type != LVAL_ERR; i++) {
+    z = native_call2(e, a->cell[0], z, lval_retain(l->cell[i]));
+  }
+
+  lval_del(a);
+  return z;
+}
+
+lval* builtin_reverse(lenv* e, lval* a) {
+  NATIVE_ASSERT(NATIVE_REVERSE, a,
+                a->count == 1 && a->cell[0]->type == LVAL_QEXPR);
+
+  lval* l = a->cell[0];
+  lval* x = lval_qexpr();
+  lval_reserve(x, 0, l->count);
+  for (int i = l->count - 1; i >= 0; i--) {
+    x = lval_add(x, lval_retain(l->cell[i]));
+  }
+
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_take(lenv* e, lval* a) {
+  NATIVE_ASSERT(NATIVE_TAKE, a,
+                a->count == 2 && a->cell[0]->type == LVAL_NUM &&
+                    a->cell[1]->type == LVAL_QEXPR &&
+                    a->cell[0]->num >= 0 &&
+                    a->cell[0]->num <= a->cell[1]->count);
+
+  lval* x = lval_slice(a->cell[1], 0, a->cell[0]->num);
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_drop(lenv* e, lval* a) {
+  NATIVE_ASSERT(NATIVE_DROP, a,
+                a->count == 2 && a->cell[0]->type == LVAL_NUM &&
+                    a->cell[1]->type == LVAL_QEXPR &&
+                    a->cell[0]->num >= 0 &&
+                    a->cell[0]->num <= a->cell[1]->count);
+
+  lval* l = a->cell[1];
+  lval* x = lval_slice(l, a->cell[0]->num, l->count);
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_elem(lenv* e, lval* a) {
+  NATIVE_ASSERT(NATIVE_ELEM, a,
+                a->count == 2 && a->cell[1]->type == LVAL_QEXPR &&
+                    lval_all_values(a->cell[1]));
+
+  lval* l = a->cell[1];
+  int found = 0;
+  for (int i = 0; i < l->count && !found; i++) {
+    found = lval_eq(a->cell[0], l->cell[i]);
+  }
+
+  lval_del(a);
+  return lval_num(found);
+}
+
+lval* builtin_lookup(lenv* e, lval* a) {
+  NATIVE_ASSERT(NATIVE_LOOKUP, a,
+                a->count == 2 && a->cell[1]->type == LVAL_QEXPR);
+
+  lval* l = a->cell[1];
+  for (int i = 0; i < l->count; i++) {
+    lval* p = l->cell[i];
+    NATIVE_ASSERT(NATIVE_LOOKUP, a,
+                  p->type == LVAL_QEXPR && p->count >= 2 &&
+                      lval_is_value(p->cell[0]) && lval_is_value(p->cell[1]));
+    if (lval_eq(p->cell[0], a->cell[0])) {
+      lval* x = lval_retain(p->cell[1]);
+      lval_del(a);
+      return x;
+    }
+  }
+
+  lval_del(a);
+  return lval_err("No element found");
+}
+
+lval* builtin_zip(lenv* e, lval* a) {
+  NATIVE_ASSERT(NATIVE_ZIP, a,
+                a->count == 2 && a->cell[0]->type == LVAL_QEXPR &&
+                    a->cell[1]->type == LVAL_QEXPR);
+
+  lval* l = a->cell[0];
+  lval* r = a->cell[1];
+  int n = l->count < r->count ? l->count : r->count;
+  lval* x = lval_qexpr();
+  lval_reserve(x, 0, n);
+  for (int i = 0; i < n; i++) {
+    lval* p = lval_add(lval_qexpr(), lval_retain(l->cell[i]));
+    x = lval_add(x, lval_add(p, lval_retain(r->cell[i])));
+  }
+
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_unzip(lenv* e, lval* a) {
+  NATIVE_ASSERT(NATIVE_UNZIP, a,
+                a->count == 1 && a->cell[0]->type == LVAL_QEXPR);
+
+  lval* l = a->cell[0];
+  for (int i = 0; i < l->count; i++) {
+    NATIVE_ASSERT(NATIVE_UNZIP, a,
+                  l->cell[i]->type == LVAL_QEXPR && l->cell[i]->count > 0);
+  }
+
+  /* The Lisp ends with the literal {nil nil}, whose symbols fst and snd
+   * evaluate, so that is what an empty list unzips to */
+  lval* x = lval_qexpr();
+  if (l->count == 0) {
+    x = lval_add(x, lval_sym("nil"));
+    x = lval_add(x, lval_sym("nil"));
+    lval_del(a);
+    return x;
+  }
+
+  /* The first of each pair, then the rest of every pair joined together */
+  lval* fst = lval_qexpr();
+  lval* rest = lval_qexpr();
+  lval_reserve(fst, 0, l->count);
+  for (int i = 0; i < l->count; i++) {
+    fst = lval_add(fst, lval_retain(l->cell[i]->cell[0]));
+    rest = lval_join(rest, lval_slice(l->cell[i], 1, l->cell[i]->count));
+  }
+
+  lval_del(a);
+  return lval_add(lval_add(x, fst), rest);
+}
+
+lbuiltin native_funcs[NATIVE_COUNT] = {
+    builtin_len,  builtin_nth,  builtin_map,    builtin_filter,
+    builtin_foldl, builtin_reverse, builtin_take, builtin_drop,
+    builtin_elem, builtin_lookup, builtin_zip,  builtin_unzip};
+
+/* Which native function v is, or -1 */
+int native_index(lval* v) {
+  for (int i = 0; v->type == LVAL_FUN && v->builtin && i < NATIVE_COUNT; i++) {
+    if (native_funcs[i] == v->builtin) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int native_named(char* name) {
+  for (int i = 0; i < NATIVE_COUNT; i++) {
+    if (strcmp(native_names[i], name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/* Define a function as fun does, unless its name is bound to a native
+ * function, which then falls back to it instead */
+lval* builtin_fallback(lenv* e, lval* a) {
+  LASSERT_NUM("fallback", a, 2);
+  LASSERT_TYPE("fallback", a, 0, LVAL_QEXPR);
+  LASSERT_TYPE("fallback", a, 1, LVAL_QEXPR);
+  LASSERT_NOT_EMPTY("fallback", a, 0);
+  LASSERT(a, a->cell[0]->cell[0]->type == LVAL_SYM,
+          "Function 'fallback' cannot define non-symbol. "
+          "Got %s, Expected %s.",
+          ltype_name(a->cell[0]->cell[0]->type), ltype_name(LVAL_SYM));
+
+  lval* names = lval_pop(a, 0);
+  lval* k = lval_retain(names->cell[0]);
+  lval* formals = lval_slice(names, 1, names->count);
+  lval_del(names);
+  lval* f = builtin_lambda(e, lval_add(lval_add(lval_sexpr(), formals),
+                                       lval_pop(a, 0)));
+  lval_del(a);
+  if (f->type == LVAL_ERR) {
+    lval_del(k);
+    return f;
+  }
+
+  lval* g = lenv_get(e, k);
+  int n = native_index(g);
+  lval_del(g);
+  if (n >= 0) {
+    if (native_lisp[n]) {
+      lval_del(native_lisp[n]);
+    }
+    native_lisp[n] = f;
+  } else {
+    lenv_def(e, k, f);
+    lval_del(f);
+  }
+  lval_del(k);
+  return lval_sexpr();
+}
+
+void native_del(void) {
+  for (int i = 0; i < NATIVE_COUNT; i++) {
+    if (native_lisp[i]) {
+      lval_del(native_lisp[i]);
+      native_lisp[i] = NULL;
+    }
+  }
+}
+
+/* Bytecode */
+
+/* With --vm an expression is compiled the first time it is evaluated and the
+ * code is cached on it, so a function body or if branch is compiled once and
+ * then reused by every call. Constants are borrowed from the expression,
+ * which always outlives its code. A call of if with literal branches becomes
+ * a conditional jump, guarded by whether if still names the builtin; when it
+ * does not the ordinary call sequence after the guard runs instead. A call
+ * of do is compiled the same way. What if and do name is worked out when
+ * such code is first compiled and again only when a frame binds them, so
+ * the guard looks them up only while a frame other than the global one
+ * binds them.
+ *
+ * A call that evaluates another expression, such as a function body or the
+ * branch chosen by if, is run in the same run of the VM. A call in tail
+ * position replaces the code being run; any other saves it, to be picked
+ * up again when the callee returns. A function whose formals are distinct
+ * names, perhaps ending in & and a name, gets a frame built straight from
+ * the stack, holding each argument in the slot its body's symbols were
+ * resolved to. Builtins other than if and eval are called directly. */
+
+enum {
+  OP_CONST,  /* k          push constant k */
+  OP_EMPTY,  /*            push () */
+  OP_LOAD,   /* k          push value of symbol constant k */
+  OP_LOCAL,  /* k slot     as OP_LOAD, trying slot of this frame first */
+  OP_CALL,   /* n          pop n values and apply them as an S-Expression,
+                           calling the code of what that evaluates */
+  OP_TAIL,   /* n          as OP_CALL, in tail position */
+  OP_GUARD,  /* k b L      jump to L unless symbol k names vm_special[b] */
+  OP_BRANCH, /* L M        pop a condition, jump to L if it is 0; if it is
+                           not a number push an error and jump to M */
+  OP_DO,     /* n L        pop n values; if one is an error push the first
+                           and jump to L */
+  OP_DROP,   /*            pop a value */
+  OP_JUMP,   /* L          continue at L */
+  OP_RET     /*            return top of stack to the caller */
+};
+
+enum { VM_IF, VM_DO };
+
+lbuiltin vm_special[] = {builtin_if, builtin_do};
+
+/* Whether the name of vm_special[b] names it from every frame (1), from
+ * none (0), or only from some, so OP_GUARD must look it up (-1) */
+int vm_linked[2];
+
+/* Work out vm_linked for a name compiled code depends on. A name bound by
+ * the global frame alone means the same from every frame. */
+void vm_link(char* sym) {
+  lsym* info = sym_info(sym);
+  int b = info->linked - 1;
+  int i = info->binds == 1 ? lenv_find(lenv_global, sym) : -1;
+  if (info->binds == 0) {
+    vm_linked[b] = 0;
+  } else if (i == -1) {
+    vm_linked[b] = -1;
+  } else {
+    lval* f = lenv_global->vals[i];
+    vm_linked[b] = f->type == LVAL_FUN && f->builtin == vm_special[b];
+  }
+}
+
+/* Make code guarded by the name of vm_special[b] follow its bindings */
+void vm_depend(char* sym, int b) {
+  if (!sym_info(sym)->linked) {
+    sym_info(sym)->linked = b + 1;
+    vm_link(sym);
+  }
+}
+
+struct lcode {
+  int* ops;
+  int count;
+  int cap;
+  lval** consts;
+  int nconsts;
+  int depth;
+  int max_depth;
+};
+
+void lcode_del(lcode* c) {
+  if (!c) {
+    return;
+  }
+  free(c->ops);
+  free(c->consts);
+  free(c);
+}
+
+int lcode_emit(lcode* c, int op) {
+  if (c->count == c->cap) {
+    c->cap = c->cap ? c->cap * 2 : 16;
+    c->ops = realloc(c->ops, sizeof(int) * c->cap);
+  }
+  c->ops[c->count] = op;
+  return c->count++;
+}
+
+int lcode_const(lcode* c, lval* x) {
+  c->consts = realloc(c->consts, sizeof(lval*) * (c->nconsts + 1));
+  c->consts[c->nconsts] = x;
+  return c->nconsts++;
+}
+
+void lcode_push(lcode* c, int n) {
+  c->depth += n;
+  if (c->depth > c->max_depth) {
+    c->max_depth = c->depth;
+  }
+}
+
+void lcode_sexpr(lcode* c, lval* x, int tail);
+
+/* Compile code leaving the value of x on the stack. When tail is set the
+ * code is in tail position: nothing follows it but returning its value. */
+void lcode_expr(lcode* c, lval* x, int tail) {
+  switch (x->type) {
+    case LVAL_SYM:
+      if (x->depth == 0) {
+        lcode_emit(c, OP_LOCAL);
+        lcode_emit(c, lcode_const(c, x));
+        lcode_emit(c, x->slot);
+      } else {
+        lcode_emit(c, OP_LOAD);
+        lcode_emit(c, lcode_const(c, x));
+      }
+      lcode_push(c, 1);
+      break;
+    case LVAL_SEXPR:
+      lcode_sexpr(c, x, tail);
+      break;
+    default:
+      lcode_emit(c, OP_CONST);
+      lcode_emit(c, lcode_const(c, x));
+      lcode_push(c, 1);
+      break;
+  }
+}
+
+int lcode_is_if(lval* x) {
+  return x->count == 4 && x->cell[0]->type == LVAL_SYM &&
+         strcmp(x->cell[0]->sym, "if") == 0 &&
+         x->cell[2]->type == LVAL_QEXPR && x->cell[3]->type == LVAL_QEXPR;
+}
+
+int lcode_is_do(lval* x) {
+  return x->count >= 2 && x->cell[0]->type == LVAL_SYM &&
+         strcmp(x->cell[0]->sym, "do") == 0;
+}
+
+/* Compile code leaving the value of the children of x, evaluated as an
+ * S-Expression, on the stack */
+void lcode_sexpr(lcode* c, lval* x, int tail) {
+  if (x->count == 0) {
+    lcode_emit(c, OP_EMPTY);
+    lcode_push(c, 1);
+    return;
+  }
+
+  int depth = c->depth;
+  int ends[3];
+  int nends = 0;
+  int generic = -1;
+
+  if (lcode_is_if(x)) {
+    vm_depend(x->cell[0]->sym, VM_IF);
+    lcode_emit(c, OP_GUARD);
+    lcode_emit(c, lcode_const(c, x->cell[0]));
+    lcode_emit(c, VM_IF);
+    generic = lcode_emit(c, 0);
+
+    lcode_expr(c, x->cell[1], 0);
+    lcode_emit(c, OP_BRANCH);
+    int other = lcode_emit(c, 0);
+    ends[nends++] = lcode_emit(c, 0);
+    c->depth = depth;
+
+    lcode_sexpr(c, x->cell[2], tail);
+    lcode_emit(c, OP_JUMP);
+    ends[nends++] = lcode_emit(c, 0);
+    c->depth = depth;
+
+    c->ops[other] = c->count;
+    lcode_sexpr(c, x->cell[3], tail);
+    lcode_emit(c, OP_JUMP);
+    ends[nends++] = lcode_emit(c, 0);
+    c->depth = depth;
+  }
+
+  if (lcode_is_do(x)) {
+    lval* last = x->cell[x->count - 1];
+
+    vm_depend(x->cell[0]->sym, VM_DO);
+    lcode_emit(c, OP_GUARD);
+    lcode_emit(c, lcode_const(c, x->cell[0]));
+    lcode_emit(c, VM_DO);
+    generic = lcode_emit(c, 0);
+
+    for (int i = 1; i < x->count - 1; i++) {
+      lcode_expr(c, x->cell[i], 0);
+    }
+    lcode_emit(c, OP_DO);
+    lcode_emit(c, x->count - 2);
+    int err = lcode_emit(c, 0);
+    c->depth = depth;
+
+    lcode_expr(c, last, tail);
+    lcode_emit(c, OP_JUMP);
+    ends[nends++] = lcode_emit(c, 0);
+    c->depth = depth;
+
+    /* Still evaluate the last argument, but keep the error */
+    c->ops[err] = c->count;
+    lcode_push(c, 1);
+    lcode_expr(c, last, 0);
+    lcode_emit(c, OP_DROP);
+    lcode_emit(c, OP_JUMP);
+    ends[nends++] = lcode_emit(c, 0);
+    c->depth = depth;
+  }
+
+  if (generic != -1) {
+    c->ops[generic] = c->count;
+  }
+
+  for (int i = 0; i < x->count; i++) {
+    lcode_expr(c, x->cell[i], 0);
+  }
+  lcode_emit(c, tail ? OP_TAIL : OP_CALL);
+  lcode_emit(c, x->count);
+  c->depth -= x->count - 1;
+
+  for (int i = 0; i < nends; i++) {
+    c->ops[ends[i]] = c->count;
+  }
+}
+
+lcode* lcode_compile(lval* x) {
+  lcode* c = calloc(1, sizeof(lcode));
+  lcode_sexpr(c, x, 1);
+  lcode_emit(c, OP_RET);
+  return c;
+}
+
+/* One stack is shared by nested runs, each reserving what its code needs */
+struct {
+  lval** vals;
+  int top;
+  int cap;
+} vm_stack;
+
+void vm_reserve(int top) {
+  while (top > vm_stack.cap) {
+    vm_stack.cap = vm_stack.cap ? vm_stack.cap * 2 : 1024;
+    vm_stack.vals = realloc(vm_stack.vals, sizeof(lval*) * vm_stack.cap);
+  }
+  vm_stack.top = top;
+}
+
+lval* vm_args(int sp, int n) {
+  return lval_add_many(lval_sexpr(), &vm_stack.vals[sp], n);
+}
+
+/* What a call saves of its caller, on a stack shared like vm_stack */
+typedef struct {
+  lcode* c;
+  int pc;
+  int base;
+  lenv* e;
+  lenv* frame;
+  lval* cur;
+} vm_call;
+
+struct {
+  vm_call* calls;
+  int count;
+  int cap;
+} vm_calls;
+
+vm_call* vm_push_call(void) {
+  if (vm_calls.count == vm_calls.cap) {
+    vm_calls.cap = vm_calls.cap ? vm_calls.cap * 2 : 256;
+    vm_calls.calls = realloc(vm_calls.calls, sizeof(vm_call) * vm_calls.cap);
+  }
+  return &vm_calls.calls[vm_calls.count++];
+}
+
+/* The value of calling the n values at sp when they are a builtin and its
+ * arguments, taking them, or NULL if the call needs lval_apply: it is not
+ * of a builtin, is of one that evaluates another expression, or an
+ * argument is an error */
+lval* vm_builtin(lenv* e, int sp, int n) {
+  lval* f = vm_stack.vals[sp];
+  if (n < 2 || f->type != LVAL_FUN || !f->builtin ||
+      f->builtin == builtin_if || f->builtin == builtin_eval) {
+    return NULL;
+  }
+  for (int i = 1; i < n; i++) {
+    if (vm_stack.vals[sp + i]->type == LVAL_ERR) {
+      return NULL;
+    }
+  }
+  lval* r = f->builtin(e, vm_args(sp + 1, n - 1));
+  lval_del(f);
+  return r;
+}
+
+/* A frame for the call of the n values at sp, binding each argument to the
+ * slot lval_resolve gave its formal, taking the arguments. Formals ending
+ * in & and a name bind that name to a list of the arguments left over.
+ * NULL if the call needs lval_apply: it is not of a function whose other
+ * formals are distinct names, given enough arguments and no more, or an
+ * argument is an error. */
+lenv* vm_frame(int sp, int n) {
+  lval* f = vm_stack.vals[sp];
+  if (n < 2 || f->type != LVAL_FUN || f->builtin || f->env->count) {
+    return NULL;
+  }
+
+  lval** args = &vm_stack.vals[sp + 1];
+  lval** formals = f->formals->cell;
+  int count = f->formals->count;
+  int fixed = count;
+  if (count >= 2 && strcmp(formals[count - 2]->sym, "&") == 0) {
+    fixed = count - 2;
+  }
+  if (n - 1 < fixed || (fixed == count && n - 1 > fixed)) {
+    return NULL;
+  }
+  for (int i = 0; i < n - 1; i++) {
+    if (args[i]->type == LVAL_ERR) {
+      return NULL;
+    }
+  }
+  for (int i = 0; i < count; i++) {
+    if (i != fixed && strcmp(formals[i]->sym, "&") == 0) {
+      return NULL;
+    }
+    for (int j = 0; j < i; j++) {
+      if (j != fixed && formals[j]->sym == formals[i]->sym) {
+        return NULL;
+      }
+    }
+  }
+
+  lenv* env = lenv_new();
+  env->lex = f->env->lex ? lenv_retain(f->env->lex) : NULL;
+  env->count = fixed < count ? fixed + 1 : count;
+  env->syms = malloc(sizeof(char*) * env->count);
+  env->vals = malloc(sizeof(lval*) * env->count);
+  for (int i = 0; i < fixed; i++) {
+    env->syms[i] = formals[i]->sym;
+    env->vals[i] = args[i];
+  }
+  if (fixed < count) {
+    env->syms[fixed] = formals[fixed + 1]->sym;
+    env->vals[fixed] =
+        lval_add_many(lval_qexpr(), &args[fixed], n - 1 - fixed);
+  }
+  for (int i = 0; i < env->count; i++) {
+    sym_bound(env->syms[i], 1);
+  }
+  if (env->count > LENV_LINEAR_MAX) {
+    lenv_index(env);
+  }
+  return env;
+}
+
+#if defined(__GNUC__) && !defined(LISPY_NO_THREADED)
+#define VM_THREADED
+#endif
+
+#ifdef VM_THREADED
+#define VM_OP(op) L_##op:
+#define VM_NEXT goto* vm_labels[ops[pc++]]
+#else
+#define VM_OP(op) case op:
+#define VM_NEXT goto dispatch
+#endif
+
+#define VM_PUSH(v) (vm_stack.vals[sp++] = (v))
+#define VM_POP() (vm_stack.vals[--sp])
+
+/* Code that returns what a call it makes leaves */
+int vm_ret_ops[] = {OP_RET};
+lcode vm_ret = {vm_ret_ops, 1, 1, NULL, 0, 0, 1};
+
+lval* vm_run(lenv* e, lval* x) {
+
+  /* Inside a call cur owns the expression being run and frame the frame
+   * it runs in, if it has its own */
+  lval* cur = NULL;
+  lenv* frame = NULL;
+  int calls = vm_calls.count;
+  int tail;
+  int n;
+
+  if (!x->code) {
+    x->code = lcode_compile(x);
+  }
+  lcode* c = x->code;
+  int* ops = c->ops;
+  int pc = 0;
+
+  int base = vm_stack.top;
+  int sp = base;
+  vm_reserve(base + c->max_depth);
+
+#ifdef VM_THREADED
+  static void* vm_labels[] = {
+      &&L_OP_CONST, &&L_OP_EMPTY, &&L_OP_LOAD,   &&L_OP_LOCAL,
+      &&L_OP_CALL,  &&L_OP_TAIL,  &&L_OP_GUARD,  &&L_OP_BRANCH,
+      &&L_OP_DO,    &&L_OP_DROP,  &&L_OP_JUMP,   &&L_OP_RET};
+  VM_NEXT;
+#else
+dispatch:
+  switch (ops[pc++]) {
+#endif
+
+  VM_OP(OP_CONST) {
+    VM_PUSH(lval_retain(c->consts[ops[pc++]]));
+    VM_NEXT;
+  }
+
+  VM_OP(OP_EMPTY) {
+    VM_PUSH(lval_sexpr());
+    VM_NEXT;
+  }
+
+  VM_OP(OP_LOAD) {
+    VM_PUSH(lenv_get(e, c->consts[ops[pc++]]));
+    VM_NEXT;
+  }
+
+  VM_OP(OP_LOCAL) {
+    lval* k = c->consts[ops[pc]];
+    int slot = ops[pc + 1];
+    pc += 2;
+    if (slot < e->count && e->syms[slot] == k->sym) {
+      VM_PUSH(lval_retain(e->vals[slot]));
+    } else {
+      VM_PUSH(lenv_get(e, k));
+    }
+    VM_NEXT;
+  }
+
+  VM_OP(OP_CALL) {
+    tail = 0;
+    n = ops[pc++];
+    goto call;
+  }
+
+  VM_OP(OP_TAIL) {
+    tail = 1;
+    n = ops[pc++];
+  call:
+    sp -= n;
+    gc_maybe_collect();
+    lval* y = vm_builtin(e, sp, n);
+    if (y) {
+      VM_PUSH(y);
+      VM_NEXT;
+    }
+    lenv* env = vm_frame(sp, n);
+    if (env) {
+      y = lval_retain(vm_stack.vals[sp]->body);
+      lval_del(vm_stack.vals[sp]);
+    } else {
+      lval* r = lval_apply(e, vm_args(sp, n), &y, &env);
+      if (r) {
+        VM_PUSH(r);
+        VM_NEXT;
+      }
+    }
+
+    /* Carry on with the code of y, in place of the code being run in tail
+     * position, and otherwise returning here after it */
+    if (tail) {
+      if (env) {
+        lenv_enter(e, env);
+        lenv_del(frame);
+        frame = e = env;
+      }
+      if (cur) {
+        lval_del(cur);
+      }
+    } else {
+      vm_call* k = vm_push_call();
+      *k = (vm_call){c, pc, base, e, frame, cur};
+      if (env) {
+        env->par = lenv_retain(e);
+        e = env;
+      }
+      frame = env;
+      base = sp;
+    }
+    cur = y;
+
+    /* An expression nothing else holds, such as one built for eval, is
+     * run only this once, so rather than compiled its children are
+     * evaluated in turn and then called in tail position */
+    if (!cur->code && cur->ref == 1) {
+      vm_reserve(base + cur->count + 1);
+      for (int i = 0; i < cur->count; i++) {
+        VM_PUSH(lval_eval(e, lval_retain(cur->cell[i])));
+      }
+      c = &vm_ret;
+      ops = c->ops;
+      pc = 0;
+      tail = 1;
+      n = cur->count;
+      goto call;
+    }
+
+    if (!cur->code) {
+      cur->code = lcode_compile(cur);
+    }
+    c = cur->code;
+    ops = c->ops;
+    pc = 0;
+    vm_reserve(base + c->max_depth);
+    VM_NEXT;
+  }
+
+  VM_OP(OP_GUARD) {
+    int special = vm_linked[ops[pc + 1]];
+    if (special == -1) {
+      lval* f = lenv_get(e, c->consts[ops[pc]]);
+      special = f->type == LVAL_FUN && f->builtin == vm_special[ops[pc + 1]];
+      lval_del(f);
+    }
+    pc = special ? pc + 3 : ops[pc + 2];
+    VM_NEXT;
+  }
+
+  VM_OP(OP_BRANCH) {
+    lval* cond = VM_POP();
+    if (cond->type == LVAL_NUM) {
+      pc = cond->num ? pc + 2 : ops[pc];
+      lval_del(cond);
+      VM_NEXT;
+    }
+    if (cond->type == LVAL_ERR) {
+      VM_PUSH(cond);
+    } else {
+      VM_PUSH(lval_err("Function '%s' passed incorrect type for argument %i. "
+                       "Got %s, Expected %s.",
+                       "if", 0, ltype_name(cond->type), ltype_name(LVAL_NUM)));
+      lval_del(cond);
+    }
+    pc = ops[pc + 1];
+    VM_NEXT;
+  }
+
+  VM_OP(OP_DO) {
+    int n = ops[pc];
+    sp -= n;
+    lval* err = NULL;
+    for (int i = 0; i < n; i++) {
+      lval* v = vm_stack.vals[sp + i];
+      if (!err && v->type == LVAL_ERR) {
+        err = v;
+      } else {
+        lval_del(v);
+      }
+    }
+    if (err) {
+      VM_PUSH(err);
+      pc = ops[pc + 1];
+    } else {
+      pc += 2;
+    }
+    VM_NEXT;
+  }
+
+  VM_OP(OP_DROP) {
+    lval_del(VM_POP());
+    VM_NEXT;
+  }
+
+  VM_OP(OP_JUMP) {
+    pc = ops[pc];
+    VM_NEXT;
+  }
+
+  VM_OP(OP_RET) {
+    lval* r = VM_POP();
+    if (cur) {
+      lval_del(cur);
+    }
+    lenv_del(frame);
+    if (vm_calls.count == calls) {
+      vm_stack.top = base;
+      return r;
+    }
+
+    vm_call* k = &vm_calls.calls[--vm_calls.count];
+    sp = base;
+    c = k->c;
+    ops = c->ops;
+    pc = k->pc;
+    base = k->base;
+    e = k->e;
+    frame = k->frame;
+    cur = k->cur;
+    vm_reserve(base + c->max_depth);
+    VM_PUSH(r);
+    VM_NEXT;
+  }
+
+#ifndef VM_THREADED
+  }
+  return NULL;
+#endif
+}
+
+/* Reading */
+
+lval* lval_read_num(mpc_ast_t* t) {
+  errno = 0;
+  long x = strtol(t->contents, NULL, 10);
+  return errno != ERANGE ? lval_num(x) : lval_err("Invalid Number.");
+}
+
+lval* lval_read_str(mpc_ast_t* t) {
+  /* Cut off the final quote character */
+  t->contents[strlen(t->contents) - 1] = '\0';
+  /* Copy the string missing out the first quote character */
+  char* unescaped = malloc(strlen(t->contents + 1) + 1);
+  strcpy(unescaped, t->contents + 1);
+  /* Pass through the unescape function */
+  unescaped = mpcf_unescape(unescaped);
+  /* Construct a new lval using the string */
+  lval* str = lval_str(unescaped);
+  /* Free the string and return */
+  free(unescaped);
+  return str;
+}
+
+lval* lval_read(mpc_ast_t* t) {
+
+  lval* x;
+  switch (t->id) {
+    case LRULE_NUMBER:
+      return lval_read_num(t);
+    case LRULE_STRING:
+      return lval_read_str(t);
+    case LRULE_SYMBOL:
+      return lval_sym(t->contents);
+    case LRULE_QEXPR:
+      x = lval_qexpr();
+      break;
+    default:
+      /* An S-Expression, or the root */
+      x = lval_sexpr();
+      break;
+  }
+
+  /* Brackets and comments are skipped, so this is at most a few too many */
+  lval_reserve(x, 0, t->children_num);
+
+  /* Brackets and the anchors around the root come from no rule */
+  for (int i = 0; i < t->children_num; i++) {
+    int id = t->children[i]->id;
+    if (id == 0 || id == LRULE_COMMENT) {
+      continue;
+    }
+    x = lval_add(x, lval_read(t->children[i]));
+  }
+
+  return x;
+}
+
+/* Reading without mpc */
+
+/* Source is normally turned straight into values by this reader, which
+ * accepts exactly the language of the grammar given to mpca_lang in main
+ * and builds the same values lval_read builds from mpc's tree. An error
+ * is reported at the same position, expecting the same items, as mpc
+ * would report it. Text for symbols and strings is put together in one
+ * scratch buffer kept between reads, so reading allocates nothing but the
+ * values themselves. Run with --mpc-reader to go through mpc instead. */
+
+int lval_mpc_reader = 0;
+
+enum { LREAD_OTHER, LREAD_NUM, LREAD_SYM, LREAD_MINUS, LREAD_COMMENT };
+
+typedef struct {
+  const char* filename;
+  const char* start;
+  const char* s;
+  const char* end;
+
+  /* Where the last token ended and what it was, since mpc also expects
+   * anything that could have continued it */
+  const char* tok;
+  int kind;
+
+  char* err;
+} lreader;
+
+struct {
+  char* buf;
+  size_t cap;
+} lread_scratch;
+
+char* lread_text(size_t n) {
+  if (n + 1 > lread_scratch.cap) {
+    lread_scratch.cap = n + 1 > 256 ? n + 1 : 256;
+    lread_scratch.buf = realloc(lread_scratch.buf, lread_scratch.cap);
+  }
+  return lread_scratch.buf;
+}
+
+int lread_space(char c) { return c && strchr(" \f\n\r\t\v", c); }
+
+int lread_digit(char c) { return c >= '0' && c <= '9'; }
+
+int lread_symbol_char(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || lread_digit(c) ||
+         (c && strchr("_+-*/\\=<>!&", c));
+}
+
+#define LREAD_SYMBOLS                                                          \
+  "'abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_+-*/\\=<>!&'"
+
+/* Describe the character at the error as mpc does */
+const char* lread_char_name(char c, char* buf) {
+  switch (c) {
+    case '\a': return "bell";
+    case '\b': return "backspace";
+    case '\f': return "formfeed";
+    case '\r': return "carriage return";
+    case '\v': return "vertical tab";
+    case '\0': return "end of input";
+    case '\n': return "newline";
+    case '\t': return "tab";
+    case ' ': return "space";
+  }
+  buf[0] = '\'';
+  buf[1] = c;
+  buf[2] = '\'';
+  buf[3] = '\0';
+  return buf;
+}
+
+/* Set the error at the current position, expecting the n items given */
+void lread_fail(lreader* r, const char** items, int n) {
+  int row = 0, col = 0;
+  for (const char* p = r->start; p < r->s; p++) {
+    if (*p == '\n') {
+      row++;
+      col = 0;
+    } else {
+      col++;
+    }
+  }
+
+  char name[4];
+  char* buf = malloc(1024);
+  int len = snprintf(buf, 1024, "%s:%i:%i: error: expected ", r->filename,
+                     row + 1, col + 1);
+  for (int i = 0; i < n && len < 1024; i++) {
+    char* sep = i == 0 ? "" : i == n - 1 ? " or " : ", ";
+    len += snprintf(buf + len, 1024 - len, "%s%s", sep, items[i]);
+  }
+  if (len < 1024) {
+    char c = r->s < r->end ? *r->s : '\0';
+    snprintf(buf + len, 1024 - len, " at %s\n", lread_char_name(c, name));
+  }
+  r->err = buf;
+}
+
+/* Fail where no value can start, inside a list closed by close or at the
+ * top level when close is 0. Anything that could have continued a token
+ * ending here comes first, then each kind of value and the way out. */
+void lread_fail_value(lreader* r, char close) {
+  const char* items[16];
+  int n = 0;
+
+  if (r->tok == r->s) {
+    switch (r->kind) {
+      case LREAD_NUM:
+        items[n++] = "one of '0123456789'";
+        break;
+      case LREAD_SYM:
+        items[n++] = "one of " LREAD_SYMBOLS;
+        break;
+      case LREAD_MINUS:
+        items[n++] = "one or more of one of '0123456789'";
+        items[n++] = "one of " LREAD_SYMBOLS;
+        break;
+      case LREAD_COMMENT:
+        items[n++] = "none of '\r\n'";
+        break;
+    }
+  }
+
+  const char* next[] = {"'-'",
+                        "one or more of one of '0123456789'",
+                        "one or more of one of " LREAD_SYMBOLS,
+                        "'\"'",
+                        "';'",
+                        "'('",
+                        "'{'",
+                        close == ')' ? "')'" : close ? "'}'" : "newline",
+                        close ? NULL : "end of input"};
+  for (int i = 0; i < 9 && next[i]; i++) {
+    int seen = 0;
+    for (int j = 0; j < n; j++) {
+      seen |= strcmp(items[j], next[i]) == 0;
+    }
+    if (!seen) {
+      items[n++] = next[i];
+    }
+  }
+
+  lread_fail(r, items, n);
+}
+
+lval* lread_number(lreader* r) {
+  const char* p = r->s;
+  int neg = *p == '-';
+  p += neg;
+
+  /* Overflow is checked as strtol would, allowing LONG_MIN */
+  unsigned long limit = neg ? (unsigned long)LONG_MAX + 1 : LONG_MAX;
+  unsigned long v = 0;
+  int range = 1;
+  for (; p < r->end && lread_digit(*p); p++) {
+    unsigned long d = *p - '0';
+    if (v > (limit - d) / 10) {
+      range = 0;
+    }
+    v = v * 10 + d;
+  }
+
+  r->s = p;
+  r->tok = p;
+  r->kind = LREAD_NUM;
+  if (!range) {
+    return lval_err("Invalid Number.");
+  }
+  return lval_num(neg ? (long)(0 - v) : (long)v);
+}
+
+lval* lread_symbol(lreader* r) {
+  const char* p = r->s;
+  while (p < r->end && lread_symbol_char(*p)) {
+    p++;
+  }
+
+  size_t n = p - r->s;
+  char* text = lread_text(n);
+  memcpy(text, r->s, n);
+  text[n] = '\0';
+
+  r->tok = p;
+  r->kind = n == 1 && *r->s == '-' ? LREAD_MINUS : LREAD_SYM;
+  r->s = p;
+  return lval_sym(text);
+}
+
+/* The escapes mpcf_unescape turns back into characters. \0 becomes
+ * nothing, as it does there. Anything else gives -1, which is kept out
+ * of char since char may be unsigned. */
+int lread_escape(char c) {
+  switch (c) {
+    case 'a': return '\a';
+    case 'b': return '\b';
+    case 'f': return '\f';
+    case 'n': return '\n';
+    case 'r': return '\r';
+    case 't': return '\t';
+    case 'v': return '\v';
+    case '\\': return '\\';
+    case '\'': return '\'';
+    case '"': return '"';
+    case '0': return '\0';
+  }
+  return -1;
+}
+
+lval* lread_string(lreader* r) {
+
+  /* A backslash takes the next character with it unless that is a newline */
+  const char* p = r->s + 1;
+  int dangling = 0;
+  while (p < r->end && *p != '"') {
+    if (*p == '\\' && p + 1 < r->end && p[1] != '\n') {
+      p += 2;
+    } else {
+      dangling = *p == '\\' && p + 1 == r->end;
+      p++;
+    }
+  }
+
+  if (p == r->end) {
+    const char* items[] = {"any character except a newline", "'\\'",
+                           "none of '\"'", "'\"'"};
+    r->s = p;
+    lread_fail(r, items + !dangling, 4 - !dangling);
+    return NULL;
+  }
+
+  char* text = lread_text(p - r->s);
+  size_t n = 0;
+  for (const char* q = r->s + 1; q < p; q++) {
+    int c = q + 1 < p && *q == '\\' ? lread_escape(q[1]) : -1;
+    if (c < 0) {
+      text[n++] = *q;
+      continue;
+    }
+    if (c != '\0') {
+      text[n++] = c;
+    }
+    q++;
+  }
+  text[n] = '\0';
+
+  r->s = p + 1;
+  r->tok = r->s;
+  r->kind = LREAD_OTHER;
+  return lval_str(text);
+}
+
+/* Skip space and comments, up to the next value or the end of a list */
+void lread_skip(lreader* r) {
+  while (r->s < r->end) {
+    if (lread_space(*r->s)) {
+      r->s++;
+      continue;
+    }
+    if (*r->s != ';') {
+      return;
+    }
+    while (r->s < r->end && *r->s != '\r' && *r->s != '\n') {
+      r->s++;
+    }
+    r->tok = r->s;
+    r->kind = LREAD_COMMENT;
+  }
+}
+
+lval* lread_list(lreader* r, lval* x, char close);
+
+/* Read the value at r->s, in a list closed by the bracket close or at the
+ * top level if close is 0. Returns NULL on an error. */
+lval* lread_value(lreader* r, char close) {
+  char c = r->s < r->end ? *r->s : '\0';
+  if (c == '(' || c == '{') {
+    r->s++;
+    return lread_list(r, c == '(' ? lval_sexpr() : lval_qexpr(),
+                      c == '(' ? ')' : '}');
+  }
+  if (c == '"') {
+    return lread_string(r);
+  }
+  if (lread_digit(c) ||
+      (c == '-' && r->s + 1 < r->end && lread_digit(r->s[1]))) {
+    return lread_number(r);
+  }
+  if (lread_symbol_char(c)) {
+    return lread_symbol(r);
+  }
+  lread_fail_value(r, close);
+  return NULL;
+}
+
+/* Read values into x up to the bracket close. Returns NULL, deleting x,
+ * on an error. */
+lval* lread_list(lreader* r, lval* x, char close) {
+  while (1) {
+    lread_skip(r);
+    if (r->s < r->end && *r->s == close) {
+      r->s++;
+      r->tok = r->s;
+      r->kind = LREAD_OTHER;
+      return x;
+    }
+
+    lval* y = lread_value(r, close);
+    if (!y) {
+      lval_del(x);
+      return NULL;
+    }
+    x = lval_add(x, y);
+  }
+}
+
+/* The next top-level value, or NULL at the end of the input or, with
+ * r->err set, on an error */
+lval* lread_next(lreader* r) {
+  lread_skip(r);
+  return r->s < r->end ? lread_value(r, 0) : NULL;
+}
+
+void lread_init(lreader* r, const char* filename, const char* s, size_t n) {
+
+  /* Like mpc, the input is taken to end at a null character */
+  const char* end = memchr(s, '\0', n);
+  *r = (lreader){filename, s, s, end ? end : s + n, NULL, LREAD_OTHER, NULL};
+}
+
+/* Read the n characters at s as an S-Expression of every value in them.
+ * On an error returns NULL with a message for the caller to free in *err. */
+lval* lval_read_source(const char* filename, const char* s, size_t n,
+                       char** err) {
+  lreader r;
+  lread_init(&r, filename, s, n);
+  lval* x = lval_sexpr();
+  lval* y;
+  while ((y = lread_next(&r))) {
+    x = lval_add(x, y);
+  }
+  if (r.err) {
+    lval_del(x);
+    x = NULL;
+  }
+  *err = r.err;
+  return x;
+}
+
+/* Map a whole file into memory, or read it where there is no mmap */
+void* file_map(char* path, size_t* size) {
+#ifdef _WIN32
+  FILE* f = fopen(path, "rb");
+  if (!f) {
+    return NULL;
+  }
+  fseek(f, 0, SEEK_END);
+  *size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  void* p = malloc(*size ? *size : 1);
+  if (fread(p, 1, *size, f) != *size) {
+    free(p);
+    p = NULL;
+  }
+  fclose(f);
+  return p;
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    return NULL;
+  }
+  struct stat st;
+  void* p = NULL;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    *size = st.st_size;
+    p = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    p = p == MAP_FAILED ? NULL : p;
+  }
+  close(fd);
+  return p;
+#endif
+}
+
+void file_unmap(void* p, size_t size) {
+#ifdef _WIN32
+  free(p);
+#else
+  munmap(p, size);
+#endif
+}
+
+/* A file being loaded, read one top-level value at a time so each can be
+ * evaluated and freed before the next is read. Its text is mapped into
+ * memory where it can be, and otherwise read in. Through mpc the whole
+ * file has to be read first, into forms. */
+struct lsource {
+  lreader r;
+  char* text;
+  size_t mapped;
+  lval* forms;
+};
+
+/* Open a file for loading, or return NULL with a message in *err.
+ *
+ * A syntax error anywhere stops the load before any of it runs, so read
+ * errors are found here rather than when lsource_next reaches them. The
+ * reader goes through the whole file once, freeing each value as it goes,
+ * and then starts again from the top. Every file is so read twice, though
+ * only one value is held at a time. Through mpc the whole file is parsed
+ * and read into forms here, and is held at once until the load ends. */
+lsource* lsource_open(char* filename, char** err) {
+  lsource* src = calloc(1, sizeof(lsource));
+
+  if (lval_mpc_reader) {
+    mpc_result_t r;
+    if (!mpc_parse_contents(filename, Lispy, &r)) {
+      *err = mpc_err_string(r.error);
+      mpc_err_delete(r.error);
+      free(src);
+      return NULL;
+    }
+    src->forms = lval_read(r.output);
+    mpc_ast_delete(r.output);
+    return src;
+  }
+
+  size_t n = 0;
+  src->text = file_map(filename, &src->mapped);
+  if (src->text) {
+    n = src->mapped;
+  } else {
+    FILE* f = fopen(filename, "rb");
+    if (!f) {
+      *err = malloc(strlen(filename) + 32);
+      sprintf(*err, "%s: error: Unable to open file!\n", filename);
+      free(src);
+      return NULL;
+    }
+    size_t cap = 4096, got;
+    src->text = malloc(cap);
+    while ((got = fread(src->text + n, 1, cap - n, f)) > 0) {
+      n += got;
+      if (n == cap) {
+        cap *= 2;
+        src->text = realloc(src->text, cap);
+      }
+    }
+    fclose(f);
+  }
+
+  lread_init(&src->r, filename, src->text, n);
+  lval* x;
+  while ((x = lread_next(&src->r))) {
+    lval_del(x);
+  }
+  if (src->r.err) {
+    *err = src->r.err;
+    lsource_close(src);
+    return NULL;
+  }
+  lread_init(&src->r, filename, src->text, n);
+  return src;
+}
+
+/* The next top-level value in src, or NULL at the end of the file or, with
+ * a message in *err, on an error */
+lval* lsource_next(lsource* src, char** err) {
+  if (src->forms) {
+    return src->forms->count ? lval_pop(src->forms, 0) : NULL;
+  }
+  lval* x = lread_next(&src->r);
+  *err = src->r.err;
+  src->r.err = NULL;
+  return x;
+}
+
+void lsource_close(lsource* src) {
+  if (src->forms) {
+    lval_del(src->forms);
+  }
+  if (src->mapped) {
+    file_unmap(src->text, src->mapped);
+  } else {
+    free(src->text);
+  }
+  free(src);
+}
+
+/* Read a line typed at the prompt */
+lval* lval_read_line(char* input, char** err) {
+  if (lval_mpc_reader) {
+    mpc_result_t r;
+    if (!mpc_parse("<stdin>", input, Lispy, &r)) {
+      *err = mpc_err_string(r.error);
+      mpc_err_delete(r.error);
+      return NULL;
+    }
+    lval* x = lval_read(r.output);
+    mpc_ast_delete(r.output);
+    return x;
+  }
+  return lval_read_source("<stdin>", input, strlen(input), err);
+}
+
+/* Image */
+
+/* An image holds the global environment as it stands after loading
+ * std.lspy and any preludes, so startup need not parse and evaluate them
+ * again. It is written with --make-image and read with --image, on the
+ * same kind of machine. After a header it has one record per object
+ * reachable from the global environment, in 64-bit words:
+ *
+ *   kind, length in words, then
+ *   Number             value
+ *   Error, String      text
+ *   Symbol             depth, slot, text
+ *   Function           1, name of the builtin
+ *                      2, fallback, name of the native function
+ *                      0, environment, formals, body
+ *   Expression         resolved, count, each cell
+ *   Environment        parent, lex, count, each name and value
+ *
+ * Objects refer to each other by record number, -1 for none. Text is a
+ * length and the bytes, padded with at least one zero to a whole word.
+ * The file is mapped into memory and read in place: one pass makes every
+ * object and a second relocates the references between them, so cycles
+ * need no special care. The global environment's record is applied to
+ * the environment the builtins were just added to. A native function
+ * keeps its fallback, so an image made with natives also loads with
+ * --no-native, where the fallback takes its place. One made with
+ * --no-native holds only the Lisp definitions. */
+
+static const char image_magic[8] = "LSPYIMG2";
+
+enum { IMAGE_ENV = LVAL_QEXPR + 1 };
+
+typedef struct {
+  FILE* f;
+  int* ids;
+  void** objs;
+  int* kinds;
+  int count;
+  int cap;
+} image_out;
+
+/* With no file nothing is written, but every object is still numbered */
+void image_word(image_out* im, int64_t w) {
+  if (im->f) {
+    fwrite(&w, sizeof(w), 1, im->f);
+  }
+}
+
+int64_t image_text_words(char* s) { return strlen(s) / 8 + 2; }
+
+void image_text(image_out* im, char* s) {
+  int64_t len = strlen(s);
+  char pad[8] = {0};
+  image_word(im, len);
+  if (im->f) {
+    fwrite(s, 1, len, im->f);
+    fwrite(pad, 1, 8 - len % 8, im->f);
+  }
+}
+
+/* Record number of an object, numbering it if it is new */
+int64_t image_ref(image_out* im, void* obj, int kind) {
+  if (!obj) {
+    return -1;
+  }
+  int slot = kind == IMAGE_ENV ? ((lenv*)obj)->gc : ((lval*)obj)->gc;
+  if (im->ids[slot] == -1) {
+    if (im->count == im->cap) {
+      im->cap = im->cap ? im->cap * 2 : 256;
+      im->objs = realloc(im->objs, sizeof(void*) * im->cap);
+      im->kinds = realloc(im->kinds, sizeof(int) * im->cap);
+    }
+    im->objs[im->count] = obj;
+    im->kinds[im->count] = kind;
+    im->ids[slot] = im->count++;
+  }
+  return im->ids[slot];
+}
+
+void image_write(image_out* im, int i) {
+  if (im->kinds[i] == IMAGE_ENV) {
+    lenv* e = im->objs[i];
+    int64_t len = 3;
+    for (int j = 0; j < e->count; j++) {
+      len += image_text_words(e->syms[j]) + 1;
+    }
+    image_word(im, IMAGE_ENV);
+    image_word(im, len);
+    image_word(im, image_ref(im, e->par, IMAGE_ENV));
+    image_word(im, image_ref(im, e->lex, IMAGE_ENV));
+    image_word(im, e->count);
+    for (int j = 0; j < e->count; j++) {
+      image_text(im, e->syms[j]);
+      image_word(im, image_ref(im, e->vals[j], e->vals[j]->type));
+    }
+    return;
+  }
+
+  lval* v = im->objs[i];
+  int n;
+  image_word(im, v->type);
+  switch (v->type) {
+    case LVAL_NUM:
+      image_word(im, 1);
+      image_word(im, v->num);
+      break;
+    case LVAL_ERR:
+    case LVAL_STR:
+      image_word(im, image_text_words(v->str));
+      image_text(im, v->str);
+      break;
+    case LVAL_SYM:
+      image_word(im, image_text_words(v->sym) + 2);
+      image_word(im, v->depth);
+      image_word(im, v->slot);
+      image_text(im, v->sym);
+      break;
+    case LVAL_FUN:
+      n = native_index(v);
+      if (n >= 0 && native_lisp[n]) {
+        image_word(im, image_text_words(native_names[n]) + 2);
+        image_word(im, 2);
+        image_word(im, image_ref(im, native_lisp[n], LVAL_FUN));
+        image_text(im, native_names[n]);
+      } else if (v->builtin) {
+        char* name = builtin_name(v->builtin);
+        image_word(im, image_text_words(name) + 1);
+        image_word(im, 1);
+        image_text(im, name);
+      } else {
+        image_word(im, 4);
+        image_word(im, 0);
+        image_word(im, image_ref(im, v->env, IMAGE_ENV));
+        image_word(im, image_ref(im, v->formals, LVAL_QEXPR));
+        image_word(im, image_ref(im, v->body, LVAL_QEXPR));
+      }
+      break;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      image_word(im, v->count + 2);
+      image_word(im, v->resolved);
+      image_word(im, v->count);
+      for (int j = 0; j < v->count; j++) {
+        image_word(im, image_ref(im, v->cell[j], v->cell[j]->type));
+      }
+      break;
+  }
+}
+
+lval* image_save(lenv* e, char* path) {
+  image_out im = {NULL, NULL, NULL, NULL, 0, 0};
+
+  /* Number every object first, so the header can give the count */
+  im.ids = malloc(sizeof(int) * gc.count);
+  for (int i = 0; i < gc.count; i++) {
+    im.ids[i] = -1;
+  }
+  image_ref(&im, e, IMAGE_ENV);
+  for (int i = 0; i < im.count; i++) {
+    image_write(&im, i);
+  }
+
+  im.f = fopen(path, "wb");
+  if (!im.f) {
+    free(im.ids);
+    free(im.objs);
+    free(im.kinds);
+    return lval_err("Could not write image %s", path);
+  }
+  fwrite(image_magic, 1, sizeof(image_magic), im.f);
+  image_word(&im, im.count);
+  for (int i = 0; i < im.count; i++) {
+    image_write(&im, i);
+  }
+  int failed = ferror(im.f);
+  failed |= fclose(im.f);
+
+  free(im.ids);
+  free(im.objs);
+  free(im.kinds);
+  if (failed) {
+    return lval_err("Could not write image %s", path);
+  }
+  return lval_sexpr();
+}
+
+typedef struct {
+  int64_t* words;
+  int64_t** recs;
+  void** objs;
+  int64_t count;
+} image_in;
+
+/* Is r a record of kind, allowing -1 for none where empty is set? */
+int image_is(image_in* im, int64_t r, int kind, int empty) {
+  if (r == -1) {
+    return empty;
+  }
+  if (r < 0 || r >= im->count) {
+    return 0;
+  }
+  int k = im->recs[r][0];
+  return k == kind || (kind == LVAL_QEXPR && k == LVAL_SEXPR);
+}
+
+int image_is_val(image_in* im, int64_t r) {
+  return r >= 0 && r < im->count && im->recs[r][0] != IMAGE_ENV;
+}
+
+/* Check the text at w, of at most n words, and return the words it uses */
+int64_t image_text_ok(int64_t* w, int64_t n) {
+  if (n < 1 || w[0] < 0 || w[0] / 8 + 2 > n) {
+    return 0;
+  }
+  return ((char*)(w + 1))[w[0]] == '\0' ? w[0] / 8 + 2 : 0;
+}
+
+char* image_text_at(int64_t* w) { return (char*)(w + 1); }
+
+/* Check every record refers only to records that can stand there */
+int image_check(image_in* im, int64_t* r) {
+  int64_t len = r[1];
+  int64_t* w = r + 2;
+  int64_t n;
+  switch (r[0]) {
+    case LVAL_NUM:
+      return len == 1;
+    case LVAL_ERR:
+    case LVAL_STR:
+      return image_text_ok(w, len) == len;
+    case LVAL_SYM:
+      return len > 2 && (w[0] == -1 || (w[0] >= 0 && w[1] >= 0)) &&
+             image_text_ok(w + 2, len - 2) == len - 2;
+    case LVAL_FUN:
+      if (len >= 1 && w[0] == 1) {
+        n = image_text_ok(w + 1, len - 1);
+        return n == len - 1 && builtin_named(image_text_at(w + 1));
+      }
+      if (len >= 2 && w[0] == 2) {
+        n = image_text_ok(w + 2, len - 2);
+        return n == len - 2 && native_named(image_text_at(w + 2)) >= 0 &&
+               image_is(im, w[1], LVAL_FUN, 0) && im->recs[w[1]][2] == 0;
+      }
+      return len == 4 && w[0] == 0 && image_is(im, w[1], IMAGE_ENV, 0) &&
+             image_is(im, w[2], LVAL_QEXPR, 0) &&
+             image_is(im, w[3], LVAL_QEXPR, 0);
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      if (len < 2 || w[0] < LVAL_UNRESOLVED || w[0] > LVAL_CLOSURE ||
+          w[1] < 0 || w[1] != len - 2) {
+        return 0;
+      }
+      for (int64_t i = 0; i < w[1]; i++) {
+        if (!image_is_val(im, w[2 + i])) {
+          return 0;
+        }
+      }
+      return 1;
+    case IMAGE_ENV:
+      if (len < 3 || !image_is(im, w[0], IMAGE_ENV, 1) ||
+          !image_is(im, w[1], IMAGE_ENV, 1) || w[2] < 0) {
+        return 0;
+      }
+      n = 3;
+      for (int64_t i = 0; i < w[2]; i++) {
+        int64_t t = n < len ? image_text_ok(w + n, len - n) : 0;
+        if (!t || n + t >= len || !image_is_val(im, w[n + t])) {
+          return 0;
+        }
+        n += t + 1;
+      }
+      return n == len;
+  }
+  return 0;
+}
+
+/* Make the object for a record, leaving its references for image_link */
+void* image_make(image_in* im, int64_t* r, lenv* e) {
+  int64_t* w = r + 2;
+  lval* v;
+  switch (r[0]) {
+    case IMAGE_ENV:
+      return r == im->recs[0] ? lenv_retain(e) : lenv_new();
+    case LVAL_NUM:
+      return lval_num(w[0]);
+    case LVAL_ERR:
+      return lval_err("%s", image_text_at(w));
+    case LVAL_STR:
+      return lval_str(image_text_at(w));
+    case LVAL_SYM:
+      v = lval_sym(image_text_at(w + 2));
+      v->depth = w[0];
+      v->slot = w[1];
+      return v;
+    case LVAL_FUN:
+      if (w[0] == 1) {
+        return lval_builtin(builtin_named(image_text_at(w + 1)));
+      }
+      if (w[0] == 2) {
+        int n = native_named(image_text_at(w + 2));
+        return lval_native ? lval_builtin(native_funcs[n]) : lval_sexpr();
+      }
+      v = lval_new(LVAL_FUN);
+      v->builtin = NULL;
+      return v;
+    case LVAL_SEXPR:
+      return lval_sexpr();
+  }
+  return lval_qexpr();
+}
+
+/* The object record r stands for. Without natives a native function
+ * stands for its fallback. */
+void* image_obj(image_in* im, int64_t r) {
+  int64_t* w = im->recs[r] + 2;
+  if (im->recs[r][0] == LVAL_FUN && w[0] == 2 && !lval_native) {
+    return im->objs[w[1]];
+  }
+  return im->objs[r];
+}
+
+void image_link(image_in* im, int64_t* r, void* obj) {
+  int64_t* w = r + 2;
+  if (r[0] == IMAGE_ENV) {
+    lenv* x = obj;
+    if (w[0] != -1) {
+      x->par = lenv_retain(im->objs[w[0]]);
+    }
+    if (w[1] != -1) {
+      x->lex = lenv_retain(im->objs[w[1]]);
+    }
+    int64_t n = 3;
+    for (int64_t i = 0; i < w[2]; i++) {
+      lval* k = lval_sym(image_text_at(w + n));
+      n += image_text_ok(w + n, r[1] - n);
+      lenv_put(x, k, image_obj(im, w[n++]));
+      lval_del(k);
+    }
+    return;
+  }
+
+  lval* v = obj;
+  if (r[0] == LVAL_FUN && w[0] == 2) {
+    int n = native_named(image_text_at(w + 2));
+    if (lval_native) {
+      if (native_lisp[n]) {
+        lval_del(native_lisp[n]);
+      }
+      native_lisp[n] = lval_retain(im->objs[w[1]]);
+    }
+    return;
+  }
+  if (v->type == LVAL_FUN && !v->builtin) {
+    v->env = lenv_retain(im->objs[w[1]]);
+    v->formals = lval_retain(im->objs[w[2]]);
+    v->body = lval_retain(im->objs[w[3]]);
+  }
+
+  /* Others may already share v, so fill its cells in place */
+  if ((v->type == LVAL_SEXPR || v->type == LVAL_QEXPR) && w[1] > 0) {
+    lval_reserve(v, 0, w[1]);
+    for (int64_t i = 0; i < w[1]; i++) {
+      v->cell[i] = lval_retain(image_obj(im, w[2 + i]));
+    }
+    v->count = w[1];
+    v->buf->hi += w[1];
+  }
+  if (v->type == LVAL_SEXPR || v->type == LVAL_QEXPR) {
+    v->resolved = w[0];
+  }
+}
+
+/* Load the image at path into e, the global environment */
+lval* image_load(lenv* e, char* path) {
+  size_t size;
+  int64_t* words = file_map(path, &size);
+  if (!words) {
+    return lval_err("Could not load image %s", path);
+  }
+
+  image_in im = {words, NULL, NULL, 0};
+  int64_t total = size / sizeof(int64_t);
+  int ok = size % sizeof(int64_t) == 0 && total >= 2 &&
+           memcmp(words, image_magic, sizeof(image_magic)) == 0 &&
+           words[1] > 0 && words[1] <= total;
+
+  /* Find every record, then check them all before making anything */
+  if (ok) {
+    im.count = words[1];
+    im.recs = malloc(sizeof(int64_t*) * im.count);
+    int64_t at = 2;
+    for (int64_t i = 0; i < im.count && ok; i++) {
+      ok = at + 2 <= total && words[at] >= LVAL_ERR &&
+           words[at] <= IMAGE_ENV && words[at + 1] >= 0 &&
+           words[at + 1] <= total - at - 2;
+      im.recs[i] = words + at;
+      at += ok ? words[at + 1] + 2 : 0;
+    }
+    ok = ok && at == total && im.recs[0][0] == IMAGE_ENV;
+    for (int64_t i = 0; i < im.count && ok; i++) {
+      ok = image_check(&im, im.recs[i]);
+    }
+  }
+
+  if (ok) {
+    im.objs = malloc(sizeof(void*) * im.count);
+    for (int64_t i = 0; i < im.count; i++) {
+      im.objs[i] = image_make(&im, im.recs[i], e);
+    }
+    for (int64_t i = 0; i < im.count; i++) {
+      image_link(&im, im.recs[i], im.objs[i]);
+    }
+    for (int64_t i = 0; i < im.count; i++) {
+      if (im.recs[i][0] == IMAGE_ENV) {
+        lenv_del(im.objs[i]);
+      } else {
+        lval_del(im.objs[i]);
+      }
+    }
+    free(im.objs);
+  }
+
+  free(im.recs);
+  file_unmap(words, size);
+  return ok ? lval_sexpr() : lval_err("Could not load image %s", path);
+}
+
+/* Main */
+
+int main(int argc, char** argv) {
+
+  Number = mpc_new("number");
+  Symbol = mpc_new("symbol");
+  String = mpc_new("string");
+  Comment = mpc_new("comment");
+  Sexpr = mpc_new("sexpr");
+  Qexpr = mpc_new("qexpr");
+  Expr = mpc_new("expr");
+  Lispy = mpc_new("lispy");
+
+  mpca_lang(MPCA_LANG_ARENA, "                                                \
+      number  : /-?[0-9]+/ ;                       \
+      symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ; \
+      string  : /\"(\\\\.|[^\"])*\"/ ;             \
+      comment : /;[^\\r\\n]*/ ;                    \
+      sexpr   : '(' <expr>* ')' ;                  \
+      qexpr   : '{' <expr>* '}' ;                  \
+      expr    : <number>  | <symbol> | <string>    \
+              | <comment> | <sexpr>  | <qexpr>;    \
+      lispy   : /^/ <expr>* /$/ ;                  \
+    ",
+            Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+
+  /* Options come before any filenames */
+  char* image = NULL;
+  char* make_image = NULL;
+  int first = 1;
+  for (; first < argc && strncmp(argv[first], "--", 2) == 0; first++) {
+    if (strcmp(argv[first], "--vm") == 0) {
+      lval_vm = 1;
+    } else if (strcmp(argv[first], "--mpc-reader") == 0) {
+      lval_mpc_reader = 1;
+    } else if (strcmp(argv[first], "--no-native") == 0) {
+      lval_native = 0;
+    } else if (strcmp(argv[first], "--image") == 0 && first + 1 < argc) {
+      image = argv[++first];
+    } else if (strcmp(argv[first], "--make-image") == 0 && first + 1 < argc) {
+      make_image = argv[++first];
+    } else {
+      fprintf(stderr, "Unknown option '%s'.\n", argv[first]);
+      return 1;
+    }
+  }
+
+  lenv* e = lenv_new();
+  lenv_global = e;
+  lenv_add_builtins(e);
+  lval* x;
+  if (image) {
+    x = image_load(e, image);
+  } else {
+    lval* args = lval_add(lval_sexpr(), lval_str("std.lspy"));
+    x = builtin_load(e, args);
+  }
+  if (x->type == LVAL_ERR) {
+    lval_println(x);
+  }
+
+  /* Without its image nothing of std would be defined, so stop */
+  int status = image && x->type == LVAL_ERR;
+  lval_del(x);
+
+  /* Interactive Prompt */
+  if (!status && first == argc && !make_image) {
+
+    puts("Lispy Version 0.0.0.1.0");
+    puts("Press Ctrl+c to Exit\n");
 
     while (1) {
 
       char* input = readline("lispy> ");
       add_history(input);
 
-      mpc_result_t r;
-      if (mpc_parse("<stdin>", input, Lispy, &r)) {
-
-        lval* x = lval_eval(e, lval_read(r.output));
+      char* err;
+      lval* x = lval_read_line(input, &err);
+      if (x) {
+        x = lval_eval(e, x);
         lval_println(x);
         lval_del(x);
-
-        mpc_ast_delete(r.output);
       } else {
-        mpc_err_print(r.error);
-        mpc_err_delete(r.error);
+        printf("%s", err);
+        free(err);
       }
 
       free(input);
@@ -1055,10 +4258,10 @@ int main(int argc, char** argv) {
   }
 
   /* Supplied with list of files */
-  if (argc >= 2) {
+  if (!status && first < argc) {
 
-    /* loop over each supplied filename (starting from 1) */
-    for (int i = 1; i < argc; i++) {
+    /* loop over each supplied filename */
+    for (int i = first; i < argc; i++) {
 
       /* Argument list with a single argument, the filename */
       lval* args = lval_add(lval_sexpr(), lval_str(argv[i]));
@@ -1074,9 +4277,20 @@ int main(int argc, char** argv) {
     }
   }
 
+  if (!status && make_image) {
+    lval* x = image_save(e, make_image);
+    if (x->type == LVAL_ERR) {
+      lval_println(x);
+      status = 1;
+    }
+    lval_del(x);
+  }
+
+  native_del();
   lenv_del(e);
 
+  free(lread_scratch.buf);
   mpc_cleanup(8, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
 
-  return 0;
+  return status;
 }
\ No newline at end of file
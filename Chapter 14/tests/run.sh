@@ -0,0 +1,40 @@
+#!/bin/sh
+# Runs each tests/*.lspy and compares what it prints with its .out file.
+#
+# Usage: tests/run.sh [files...]   (from Chapter 14)
+#
+# Every test runs walking the tree and on the VM, each with the native list
+# builtins and with --no-native, and once more reading through mpc with
+# --mpc-reader. It must print the same in all five. The C stack is limited
+# to 1MB so that unbounded recursion fails loudly. Set CC, CFLAGS or LIBS to
+# change how the interpreter is built.
+
+cd "$(dirname "$0")/.." || exit 1
+
+FILES=${*:-tests/*.lspy}
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:-"-std=c11 -O2"}
+LIBS=${LIBS:-"-ledit -lm"}
+BIN=${TMPDIR:-/tmp}/lispy-test.$$
+OUT=${TMPDIR:-/tmp}/lispy-test.$$.out
+
+$CC $CFLAGS lisp.c ../mpc.c $LIBS -o "$BIN" || exit 1
+trap 'rm -f "$BIN" "$OUT"' EXIT
+
+failed=0
+for f in $FILES; do
+  for mode in "" "--vm" "--no-native" "--vm --no-native" "--mpc-reader"; do
+    (ulimit -s 1024 && "$BIN" $mode "$f") > "$OUT" 2>&1
+    status=$?
+    if [ $status -eq 0 ] && cmp -s "$OUT" "${f%.lspy}.out"; then
+      echo "PASS $f $mode"
+    else
+      echo "FAIL $f $mode (exit $status)"
+      diff "${f%.lspy}.out" "$OUT" | head -20
+      failed=1
+    fi
+  done
+done
+
+exit $failed
@@ -1,5 +1,13 @@
 #include "mpc.h"
 
+#if defined(__unix__) || defined(__APPLE__)
+#define MPC_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 /*
 ** State Type
 */
@@ -55,18 +63,77 @@ static mpc_state_t mpc_state_new(void) {
 ** backtracking and make LL(1) grammars easy
 ** to parse for all input methods.
 **
+** Regular files are mapped into memory where
+** possible and then read like strings. Other files
+** and pipes are read in chunks into a buffer which
+** keeps everything from the oldest mark onwards, so
+** backtracking never has to seek or unget.
 */
 
-enum { MPC_INPUT_STRING = 0, MPC_INPUT_FILE = 1, MPC_INPUT_PIPE = 2 };
+enum {
+  MPC_INPUT_STRING = 0,
+  MPC_INPUT_FILE = 1,
+  MPC_INPUT_PIPE = 2,
+  MPC_INPUT_MMAP = 3
+};
 
 enum { MPC_INPUT_MARKS_MIN = 32 };
 
 enum { MPC_INPUT_MEM_NUM = 512 };
 
+enum { MPC_INPUT_CHUNK = 65536 };
+
+enum { MPC_INPUT_MEMO_MIN = 1024, MPC_INPUT_MEMO_MAX = 262144 };
+
+enum { MPC_AST_ARENA_BLOCK = 4096, MPC_AST_ARENA_TAGS_MIN = 64 };
+
+/*
+** A memo holds the result of a parser at a position:
+** where it stopped, the error it gave on failure or a
+** copy of its output on success, and what it merged
+** into the errors of the parsers around it.
+*/
+
+typedef struct {
+  mpc_parser_t* p;
+  long pos;
+  char suppress;
+  char ok;
+  char last;
+  mpc_state_t state;
+  mpc_val_t* output;
+  mpc_err_t* error;
+  mpc_err_t* merged;
+} mpc_memo_t;
+
 typedef struct {
   char mem[64];
 } mpc_mem_t;
 
+/*
+** An arena holds the nodes and strings of the trees
+** built while a parser wrapped by mpca_arena runs. It
+** hands them out of a few large blocks, all freed at
+** once, and keeps one copy of each tag for the nodes
+** to share.
+*/
+
+typedef union {
+  long l;
+  void* p;
+} mpc_ast_arena_align_t;
+
+typedef struct mpc_ast_arena_t {
+  char** blocks;
+  int blocks_num;
+  size_t used;
+  size_t size;
+  char** tags;
+  int tags_num;
+  int tags_slots;
+  mpc_ast_t* root;
+} mpc_ast_arena_t;
+
 typedef struct {
 
   int type;
@@ -74,8 +141,13 @@ typedef struct {
   mpc_state_t state;
 
   char* string;
+  size_t length;
   char* buffer;
+  long buffer_pos;
+  size_t buffer_num;
+  size_t buffer_slots;
   FILE* file;
+  long file_start;
 
   int suppress;
   int backtrack;
@@ -87,9 +159,20 @@ typedef struct {
   char last;
 
   size_t mem_index;
+  size_t mem_used;
   char mem_full[MPC_INPUT_MEM_NUM];
   mpc_mem_t mem[MPC_INPUT_MEM_NUM];
 
+  mpc_memo_t* memo;
+  int memo_num;
+  int memo_slots;
+
+  mpc_ast_arena_t* arena;
+  int in_arena;
+
+  char** labels;
+  int labels_num;
+
 } mpc_input_t;
 
 static mpc_input_t* mpc_input_new_string(const char* filename,
@@ -105,8 +188,13 @@ static mpc_input_t* mpc_input_new_string(const char* filename,
 
   i->string = malloc(strlen(string) + 1);
   strcpy(i->string, string);
+  i->length = 0;
   i->buffer = NULL;
+  i->buffer_pos = 0;
+  i->buffer_num = 0;
+  i->buffer_slots = 0;
   i->file = NULL;
+  i->file_start = 0;
 
   i->suppress = 0;
   i->backtrack = 1;
@@ -117,8 +205,19 @@ static mpc_input_t* mpc_input_new_string(const char* filename,
   i->last = '\0';
 
   i->mem_index = 0;
+  i->mem_used = 0;
   memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
 
+  i->memo = NULL;
+  i->memo_num = 0;
+  i->memo_slots = 0;
+
+  i->arena = NULL;
+  i->in_arena = 0;
+
+  i->labels = NULL;
+  i->labels_num = 0;
+
   return i;
 }
 
@@ -136,8 +235,13 @@ static mpc_input_t* mpc_input_new_nstring(const char* filename,
   i->string = malloc(length + 1);
   strncpy(i->string, string, length);
   i->string[length] = '\0';
+  i->length = 0;
   i->buffer = NULL;
+  i->buffer_pos = 0;
+  i->buffer_num = 0;
+  i->buffer_slots = 0;
   i->file = NULL;
+  i->file_start = 0;
 
   i->suppress = 0;
   i->backtrack = 1;
@@ -148,8 +252,19 @@ static mpc_input_t* mpc_input_new_nstring(const char* filename,
   i->last = '\0';
 
   i->mem_index = 0;
+  i->mem_used = 0;
   memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
 
+  i->memo = NULL;
+  i->memo_num = 0;
+  i->memo_slots = 0;
+
+  i->arena = NULL;
+  i->in_arena = 0;
+
+  i->labels = NULL;
+  i->labels_num = 0;
+
   return i;
 }
 
@@ -164,8 +279,13 @@ static mpc_input_t* mpc_input_new_pipe(const char* filename, FILE* pipe) {
   i->state = mpc_state_new();
 
   i->string = NULL;
+  i->length = 0;
   i->buffer = NULL;
+  i->buffer_pos = 0;
+  i->buffer_num = 0;
+  i->buffer_slots = 0;
   i->file = pipe;
+  i->file_start = 0;
 
   i->suppress = 0;
   i->backtrack = 1;
@@ -176,8 +296,19 @@ static mpc_input_t* mpc_input_new_pipe(const char* filename, FILE* pipe) {
   i->last = '\0';
 
   i->mem_index = 0;
+  i->mem_used = 0;
   memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
 
+  i->memo = NULL;
+  i->memo_num = 0;
+  i->memo_slots = 0;
+
+  i->arena = NULL;
+  i->in_arena = 0;
+
+  i->labels = NULL;
+  i->labels_num = 0;
+
   return i;
 }
 
@@ -191,8 +322,85 @@ static mpc_input_t* mpc_input_new_file(const char* filename, FILE* file) {
   i->state = mpc_state_new();
 
   i->string = NULL;
+  i->length = 0;
   i->buffer = NULL;
+  i->buffer_pos = 0;
+  i->buffer_num = 0;
+  i->buffer_slots = 0;
   i->file = file;
+  i->file_start = ftell(file);
+
+  i->suppress = 0;
+  i->backtrack = 1;
+  i->marks_num = 0;
+  i->marks_slots = MPC_INPUT_MARKS_MIN;
+  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
+  i->lasts = malloc(sizeof(char) * i->marks_slots);
+  i->last = '\0';
+
+  i->mem_index = 0;
+  i->mem_used = 0;
+  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+
+  i->memo = NULL;
+  i->memo_num = 0;
+  i->memo_slots = 0;
+
+  i->arena = NULL;
+  i->in_arena = 0;
+
+  i->labels = NULL;
+  i->labels_num = 0;
+
+  return i;
+}
+
+/*
+** Map a regular file into memory. Returns NULL when
+** that is not possible so the caller can fall back to
+** reading it as a file.
+*/
+
+static mpc_input_t* mpc_input_new_mmap(const char* filename) {
+
+#ifdef MPC_MMAP
+
+  mpc_input_t* i;
+  struct stat st;
+  void* string;
+  int fd = open(filename, O_RDONLY);
+
+  if (fd == -1) {
+    return NULL;
+  }
+
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    close(fd);
+    return NULL;
+  }
+
+  string = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (string == MAP_FAILED) {
+    return NULL;
+  }
+
+  i = malloc(sizeof(mpc_input_t));
+
+  i->filename = malloc(strlen(filename) + 1);
+  strcpy(i->filename, filename);
+  i->type = MPC_INPUT_MMAP;
+  i->state = mpc_state_new();
+
+  i->string = string;
+  i->length = st.st_size;
+  i->buffer = NULL;
+  i->buffer_pos = 0;
+  i->buffer_num = 0;
+  i->buffer_slots = 0;
+  i->file = NULL;
+  i->file_start = 0;
 
   i->suppress = 0;
   i->backtrack = 1;
@@ -203,19 +411,92 @@ static mpc_input_t* mpc_input_new_file(const char* filename, FILE* file) {
   i->last = '\0';
 
   i->mem_index = 0;
+  i->mem_used = 0;
   memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
 
+  i->memo = NULL;
+  i->memo_num = 0;
+  i->memo_slots = 0;
+
+  i->arena = NULL;
+  i->in_arena = 0;
+
+  i->labels = NULL;
+  i->labels_num = 0;
+
   return i;
+
+#else
+
+  (void)filename;
+  return NULL;
+
+#endif
+}
+
+static void mpc_input_memo_clear(mpc_input_t* i, long pos);
+static void mpc_ast_arena_delete(mpc_ast_arena_t* m);
+
+/*
+** Give back to a pipe what was read from it past the
+** end of the parse. A stream that can seek is moved
+** back. Otherwise the characters are pushed back last
+** first; C only promises to take one, so on a stream
+** that refuses more the rest is lost to the caller.
+*/
+
+static void mpc_input_unread(mpc_input_t* i) {
+
+  long from = i->state.pos - i->buffer_pos;
+  long n = (long)i->buffer_num - from;
+
+  if (from < 0 || n <= 0) {
+    return;
+  }
+  if (fseek(i->file, -n, SEEK_CUR) == 0) {
+    return;
+  }
+  for (; n > 0; n--) {
+    if (ungetc((unsigned char)i->buffer[from + n - 1], i->file) == EOF) {
+      return;
+    }
+  }
 }
 
 static void mpc_input_delete(mpc_input_t* i) {
 
+  int j;
+
+  mpc_input_memo_clear(i, -1);
+  free(i->memo);
+
+  if (i->arena) {
+    mpc_ast_arena_delete(i->arena);
+  }
+
+  for (j = 0; j < i->labels_num; j++) {
+    free(i->labels[j]);
+  }
+  free(i->labels);
+
   free(i->filename);
 
   if (i->type == MPC_INPUT_STRING) {
     free(i->string);
   }
+#ifdef MPC_MMAP
+  if (i->type == MPC_INPUT_MMAP) {
+    munmap(i->string, i->length);
+  }
+#endif
+  /* Leave the stream just past what was parsed */
+  if (i->type == MPC_INPUT_FILE && i->file_start != -1) {
+    fseek(i->file, i->file_start + i->state.pos, SEEK_SET);
+  }
   if (i->type == MPC_INPUT_PIPE) {
+    mpc_input_unread(i);
+  }
+  if (i->type == MPC_INPUT_FILE || i->type == MPC_INPUT_PIPE) {
     free(i->buffer);
   }
 
@@ -233,7 +514,8 @@ static void* mpc_malloc(mpc_input_t* i, size_t n) {
   size_t j;
   char* p;
 
-  if (n > sizeof(mpc_mem_t)) {
+  /* Deep nesting can hold every block, and then there is no use looking */
+  if (n > sizeof(mpc_mem_t) || i->mem_used == MPC_INPUT_MEM_NUM) {
     return malloc(n);
   }
 
@@ -242,6 +524,7 @@ static void* mpc_malloc(mpc_input_t* i, size_t n) {
     if (!i->mem_full[i->mem_index]) {
       p = (void*)(i->mem + i->mem_index);
       i->mem_full[i->mem_index] = 1;
+      i->mem_used++;
       i->mem_index = (i->mem_index + 1) % MPC_INPUT_MEM_NUM;
       return p;
     }
@@ -265,6 +548,7 @@ static void mpc_free(mpc_input_t* i, void* p) {
   }
   j = ((size_t)(((char*)p) - ((char*)i->mem))) / sizeof(mpc_mem_t);
   i->mem_full[j] = 0;
+  i->mem_used--;
 }
 
 static void* mpc_realloc(mpc_input_t* i, void* p, size_t n) {
@@ -318,10 +602,6 @@ static void mpc_input_mark(mpc_input_t* i) {
 
   i->marks[i->marks_num - 1] = i->state;
   i->lasts[i->marks_num - 1] = i->last;
-
-  if (i->type == MPC_INPUT_PIPE && i->marks_num == 1) {
-    i->buffer = calloc(1, 1);
-  }
 }
 
 static void mpc_input_unmark(mpc_input_t* i) {
@@ -340,9 +620,8 @@ static void mpc_input_unmark(mpc_input_t* i) {
     i->lasts = realloc(i->lasts, sizeof(char) * i->marks_slots);
   }
 
-  if (i->type == MPC_INPUT_PIPE && i->marks_num == 0) {
-    free(i->buffer);
-    i->buffer = NULL;
+  if (i->marks_num == 0 && i->memo_num > 0) {
+    mpc_input_memo_clear(i, i->state.pos);
   }
 }
 
@@ -355,137 +634,83 @@ static void mpc_input_rewind(mpc_input_t* i) {
   i->state = i->marks[i->marks_num - 1];
   i->last = i->lasts[i->marks_num - 1];
 
-  if (i->type == MPC_INPUT_FILE) {
-    fseek(i->file, i->state.pos, SEEK_SET);
-  }
-
   mpc_input_unmark(i);
 }
 
-static int mpc_input_buffer_in_range(mpc_input_t* i) {
-  return i->state.pos < (long)(strlen(i->buffer) + i->marks[0].pos);
-}
+/*
+** Read another chunk into the buffer, first dropping
+** what no mark can return to once that is at least
+** half of it. Pipes are read in chunks like files, so
+** a parse waits for a whole chunk or the end of the
+** input; what it reads past the end of the parse is
+** given back by mpc_input_unread.
+*/
 
-static char mpc_input_buffer_get(mpc_input_t* i) {
-  return i->buffer[i->state.pos - i->marks[0].pos];
-}
+static int mpc_input_buffer_fill(mpc_input_t* i) {
 
-static char mpc_input_getc(mpc_input_t* i) {
+  long keep = i->marks_num > 0 ? i->marks[0].pos : i->state.pos;
+  size_t drop = (size_t)(keep - i->buffer_pos);
+  size_t n;
 
-  char c = '\0';
+  if (feof(i->file)) {
+    return 0;
+  }
 
-  switch (i->type) {
+  if (drop > 0 && drop >= i->buffer_num / 2) {
+    memmove(i->buffer, i->buffer + drop, i->buffer_num - drop);
+    i->buffer_num -= drop;
+    i->buffer_pos = keep;
+  }
 
-    case MPC_INPUT_STRING:
-      return i->string[i->state.pos];
-    case MPC_INPUT_FILE:
-      c = fgetc(i->file);
-      return c;
-    case MPC_INPUT_PIPE:
+  if (i->buffer_slots - i->buffer_num < MPC_INPUT_CHUNK) {
+    i->buffer_slots = i->buffer_num + i->buffer_num / 2 + MPC_INPUT_CHUNK;
+    i->buffer = realloc(i->buffer, i->buffer_slots);
+  }
 
-      if (!i->buffer) {
-        c = getc(i->file);
-        return c;
-      }
+  n = fread(i->buffer + i->buffer_num, 1, MPC_INPUT_CHUNK, i->file);
 
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        c = mpc_input_buffer_get(i);
-        return c;
-      } else {
-        c = getc(i->file);
-        return c;
-      }
+  i->buffer_num += n;
+  return n > 0;
+}
 
-    default:
-      return c;
+static char mpc_input_buffer_get(mpc_input_t* i) {
+  while (i->state.pos >= i->buffer_pos + (long)i->buffer_num) {
+    if (!mpc_input_buffer_fill(i)) {
+      return '\0';
+    }
   }
+  return i->buffer[i->state.pos - i->buffer_pos];
 }
 
-static char mpc_input_peekc(mpc_input_t* i) {
-
-  char c = '\0';
+static char mpc_input_getc(mpc_input_t* i) {
 
   switch (i->type) {
     case MPC_INPUT_STRING:
       return i->string[i->state.pos];
+    case MPC_INPUT_MMAP:
+      return (size_t)i->state.pos < i->length ? i->string[i->state.pos] : '\0';
     case MPC_INPUT_FILE:
-
-      c = fgetc(i->file);
-      if (feof(i->file)) {
-        return '\0';
-      }
-
-      fseek(i->file, -1, SEEK_CUR);
-      return c;
-
     case MPC_INPUT_PIPE:
-
-      if (!i->buffer) {
-        c = getc(i->file);
-        if (feof(i->file)) {
-          return '\0';
-        }
-        ungetc(c, i->file);
-        return c;
-      }
-
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        return mpc_input_buffer_get(i);
-      } else {
-        c = getc(i->file);
-        if (feof(i->file)) {
-          return '\0';
-        }
-        ungetc(c, i->file);
-        return c;
-      }
-
+      return mpc_input_buffer_get(i);
     default:
-      return c;
+      return '\0';
   }
 }
 
+static char mpc_input_peekc(mpc_input_t* i) { return mpc_input_getc(i); }
+
 static int mpc_input_terminated(mpc_input_t* i) {
   return mpc_input_peekc(i) == '\0';
 }
 
 static int mpc_input_failure(mpc_input_t* i, char c) {
-
-  switch (i->type) {
-    case MPC_INPUT_STRING: {
-      break;
-    }
-    case MPC_INPUT_FILE:
-      fseek(i->file, -1, SEEK_CUR);
-      { break; }
-    case MPC_INPUT_PIPE: {
-
-      if (!i->buffer) {
-        ungetc(c, i->file);
-        break;
-      }
-
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        break;
-      } else {
-        ungetc(c, i->file);
-      }
-    }
-    default: {
-      break;
-    }
-  }
+  (void)i;
+  (void)c;
   return 0;
 }
 
 static int mpc_input_success(mpc_input_t* i, char c, char** o) {
 
-  if (i->type == MPC_INPUT_PIPE && i->buffer && !mpc_input_buffer_in_range(i)) {
-    i->buffer = realloc(i->buffer, strlen(i->buffer) + 2);
-    i->buffer[strlen(i->buffer) + 1] = '\0';
-    i->buffer[strlen(i->buffer) + 0] = c;
-  }
-
   i->last = c;
   i->state.pos++;
   i->state.col++;
@@ -718,37 +943,57 @@ char* mpc_err_string(mpc_err_t* x) {
   return realloc(buffer, strlen(buffer) + 1);
 }
 
-static mpc_err_t* mpc_err_new(mpc_input_t* i, const char* expected) {
+/*
+** Errors made while parsing do not own their text.
+** Labels and failures are borrowed from the parsers,
+** a DFA, or the input, and errors are merged into
+** one another in place. Since a merge only keeps what
+** is furthest into the input most are dropped without
+** ever being copied, and the error handed back, which
+** owns its text, is only made once the parse fails.
+*/
+
+static char* mpc_input_label(mpc_input_t* i, const char* label) {
+  int j;
+  for (j = 0; j < i->labels_num; j++) {
+    if (strcmp(i->labels[j], label) == 0) {
+      return i->labels[j];
+    }
+  }
+  i->labels_num++;
+  i->labels = realloc(i->labels, sizeof(char*) * i->labels_num);
+  i->labels[i->labels_num - 1] = malloc(strlen(label) + 1);
+  strcpy(i->labels[i->labels_num - 1], label);
+  return i->labels[i->labels_num - 1];
+}
+
+static mpc_err_t* mpc_err_new(mpc_input_t* i, char* expected) {
   mpc_err_t* x;
   if (i->suppress) {
     return NULL;
   }
   x = mpc_malloc(i, sizeof(mpc_err_t));
-  x->filename = mpc_malloc(i, strlen(i->filename) + 1);
-  strcpy(x->filename, i->filename);
+  x->filename = NULL;
   x->state = i->state;
   x->expected_num = 1;
   x->expected = mpc_malloc(i, sizeof(char*));
-  x->expected[0] = mpc_malloc(i, strlen(expected) + 1);
-  strcpy(x->expected[0], expected);
+  x->expected[0] = expected;
   x->failure = NULL;
   x->recieved = mpc_input_peekc(i);
   return x;
 }
 
-static mpc_err_t* mpc_err_fail(mpc_input_t* i, const char* failure) {
+static mpc_err_t* mpc_err_fail(mpc_input_t* i, char* failure) {
   mpc_err_t* x;
   if (i->suppress) {
     return NULL;
   }
   x = mpc_malloc(i, sizeof(mpc_err_t));
-  x->filename = mpc_malloc(i, strlen(i->filename) + 1);
-  strcpy(x->filename, i->filename);
+  x->filename = NULL;
   x->state = i->state;
   x->expected_num = 0;
   x->expected = NULL;
-  x->failure = mpc_malloc(i, strlen(failure) + 1);
-  strcpy(x->failure, failure);
+  x->failure = failure;
   x->recieved = ' ';
   return x;
 }
@@ -768,28 +1013,48 @@ static mpc_err_t* mpc_err_file(const char* filename, const char* failure) {
 }
 
 static void mpc_err_delete_internal(mpc_input_t* i, mpc_err_t* x) {
-  int j;
   if (x == NULL) {
     return;
   }
-  for (j = 0; j < x->expected_num; j++) {
-    mpc_free(i, x->expected[j]);
-  }
   mpc_free(i, x->expected);
-  mpc_free(i, x->filename);
-  mpc_free(i, x->failure);
   mpc_free(i, x);
 }
 
 static mpc_err_t* mpc_err_export(mpc_input_t* i, mpc_err_t* x) {
   int j;
+  mpc_err_t* y = malloc(sizeof(mpc_err_t));
+  *y = *x;
+  y->filename = malloc(strlen(i->filename) + 1);
+  strcpy(y->filename, i->filename);
+  if (x->failure) {
+    y->failure = malloc(strlen(x->failure) + 1);
+    strcpy(y->failure, x->failure);
+  }
+  y->expected = x->expected_num ? malloc(sizeof(char*) * x->expected_num) : NULL;
   for (j = 0; j < x->expected_num; j++) {
-    x->expected[j] = mpc_export(i, x->expected[j]);
+    y->expected[j] = malloc(strlen(x->expected[j]) + 1);
+    strcpy(y->expected[j], x->expected[j]);
+  }
+  mpc_err_delete_internal(i, x);
+  return y;
+}
+
+static mpc_err_t* mpc_err_dup(mpc_err_t* x) {
+  int slots = 1;
+  mpc_err_t* y;
+  if (x == NULL) {
+    return NULL;
+  }
+  y = malloc(sizeof(mpc_err_t));
+  *y = *x;
+  if (x->expected) {
+    while (slots < x->expected_num) {
+      slots *= 2;
+    }
+    y->expected = malloc(sizeof(char*) * slots);
+    memcpy(y->expected, x->expected, sizeof(char*) * x->expected_num);
   }
-  x->expected = mpc_export(i, x->expected);
-  x->filename = mpc_export(i, x->filename);
-  x->failure = mpc_export(i, x->failure);
-  return mpc_export(i, x);
+  return y;
 }
 
 static int mpc_err_contains_expected(mpc_input_t* i, mpc_err_t* x,
@@ -797,7 +1062,7 @@ static int mpc_err_contains_expected(mpc_input_t* i, mpc_err_t* x,
   int j;
   (void)i;
   for (j = 0; j < x->expected_num; j++) {
-    if (strcmp(x->expected[j], expected) == 0) {
+    if (x->expected[j] == expected || strcmp(x->expected[j], expected) == 0) {
       return 1;
     }
   }
@@ -805,77 +1070,51 @@ static int mpc_err_contains_expected(mpc_input_t* i, mpc_err_t* x,
 }
 
 static void mpc_err_add_expected(mpc_input_t* i, mpc_err_t* x, char* expected) {
-  (void)i;
-  x->expected_num++;
-  x->expected = mpc_realloc(i, x->expected, sizeof(char*) * x->expected_num);
-  x->expected[x->expected_num - 1] = mpc_malloc(i, strlen(expected) + 1);
-  strcpy(x->expected[x->expected_num - 1], expected);
+  /* The list is full whenever its length is a power of two */
+  if ((x->expected_num & (x->expected_num - 1)) == 0) {
+    x->expected =
+        mpc_realloc(i, x->expected,
+                    sizeof(char*) * (x->expected_num ? x->expected_num * 2 : 1));
+  }
+  x->expected[x->expected_num++] = expected;
 }
 
-static mpc_err_t* mpc_err_or(mpc_input_t* i, mpc_err_t** x, int n) {
+static mpc_err_t* mpc_err_merge(mpc_input_t* i, mpc_err_t* x, mpc_err_t* y) {
 
-  int j, k, fst;
-  mpc_err_t* e;
+  int k;
 
-  fst = -1;
-  for (j = 0; j < n; j++) {
-    if (x[j] != NULL) {
-      fst = j;
-    }
+  /* Only what is furthest into the input is kept */
+  if (x == NULL || (y != NULL && y->state.pos > x->state.pos)) {
+    mpc_err_delete_internal(i, x);
+    x = y;
+    y = NULL;
   }
 
-  if (fst == -1) {
+  if (x == NULL) {
     return NULL;
   }
 
-  e = mpc_malloc(i, sizeof(mpc_err_t));
-  e->state = mpc_state_invalid();
-  e->expected_num = 0;
-  e->expected = NULL;
-  e->failure = NULL;
-  e->filename = mpc_malloc(i, strlen(x[fst]->filename) + 1);
-  strcpy(e->filename, x[fst]->filename);
-
-  for (j = 0; j < n; j++) {
-    if (x[j] == NULL) {
-      continue;
-    }
-    if (x[j]->state.pos > e->state.pos) {
-      e->state = x[j]->state;
-    }
+  if (y != NULL && y->state.pos < x->state.pos) {
+    mpc_err_delete_internal(i, y);
+    y = NULL;
   }
 
-  for (j = 0; j < n; j++) {
-    if (x[j] == NULL) {
-      continue;
-    }
-    if (x[j]->state.pos < e->state.pos) {
-      continue;
-    }
-
-    if (x[j]->failure) {
-      e->failure = mpc_malloc(i, strlen(x[j]->failure) + 1);
-      strcpy(e->failure, x[j]->failure);
-      break;
-    }
-
-    e->recieved = x[j]->recieved;
-
-    for (k = 0; k < x[j]->expected_num; k++) {
-      if (!mpc_err_contains_expected(i, e, x[j]->expected[k])) {
-        mpc_err_add_expected(i, e, x[j]->expected[k]);
+  /* Nothing merged after a failure is kept */
+  if (x->failure) {
+    x->expected_num = 0;
+  } else if (y != NULL && y->failure) {
+    x->failure = y->failure;
+  } else if (y != NULL) {
+    x->recieved = y->recieved;
+    for (k = 0; k < y->expected_num; k++) {
+      if (!mpc_err_contains_expected(i, x, y->expected[k])) {
+        mpc_err_add_expected(i, x, y->expected[k]);
       }
     }
   }
 
-  for (j = 0; j < n; j++) {
-    if (x[j] == NULL) {
-      continue;
-    }
-    mpc_err_delete_internal(i, x[j]);
-  }
-
-  return e;
+  mpc_err_delete_internal(i, y);
+  return x;
 }
 
 static mpc_err_t* mpc_err_repeat(mpc_input_t* i, mpc_err_t* x,
@@ -890,54 +1129,32 @@ static mpc_err_t* mpc_err_repeat(mpc_input_t* i, mpc_err_t* x,
   }
 
   if (x->expected_num == 0) {
-    expect = mpc_calloc(i, 1, 1);
-    x->expected_num = 1;
-    x->expected = mpc_realloc(i, x->expected, sizeof(char*) * x->expected_num);
-    x->expected[0] = expect;
+    mpc_err_add_expected(i, x, mpc_input_label(i, ""));
     return x;
   }
 
-  else if (x->expected_num == 1) {
-    expect = mpc_malloc(i, strlen(prefix) + strlen(x->expected[0]) + 1);
-    strcpy(expect, prefix);
-    strcat(expect, x->expected[0]);
-    mpc_free(i, x->expected[0]);
-    x->expected[0] = expect;
-    return x;
+  l += strlen(prefix);
+  for (j = 0; j < x->expected_num; j++) {
+    l += strlen(x->expected[j]) + strlen(" or ");
   }
 
-  else if (x->expected_num > 1) {
-
-    l += strlen(prefix);
-    for (j = 0; j < x->expected_num - 2; j++) {
-      l += strlen(x->expected[j]) + strlen(", ");
-    }
-    l += strlen(x->expected[x->expected_num - 2]);
-    l += strlen(" or ");
-    l += strlen(x->expected[x->expected_num - 1]);
-
-    expect = mpc_malloc(i, l + 1);
+  expect = mpc_malloc(i, l + 1);
 
-    strcpy(expect, prefix);
-    for (j = 0; j < x->expected_num - 2; j++) {
-      strcat(expect, x->expected[j]);
+  strcpy(expect, prefix);
+  for (j = 0; j < x->expected_num; j++) {
+    strcat(expect, x->expected[j]);
+    if (j < x->expected_num - 2) {
       strcat(expect, ", ");
     }
-    strcat(expect, x->expected[x->expected_num - 2]);
-    strcat(expect, " or ");
-    strcat(expect, x->expected[x->expected_num - 1]);
-
-    for (j = 0; j < x->expected_num; j++) {
-      mpc_free(i, x->expected[j]);
+    if (j == x->expected_num - 2) {
+      strcat(expect, " or ");
     }
-
-    x->expected_num = 1;
-    x->expected = mpc_realloc(i, x->expected, sizeof(char*) * x->expected_num);
-    x->expected[0] = expect;
-    return x;
   }
 
-  return NULL;
+  x->expected_num = 1;
+  x->expected[0] = mpc_input_label(i, expect);
+  mpc_free(i, expect);
+  return x;
 }
 
 static mpc_err_t* mpc_err_many1(mpc_input_t* i, mpc_err_t* x) {
@@ -955,13 +1172,6 @@ static mpc_err_t* mpc_err_count(mpc_input_t* i, mpc_err_t* x, int n) {
   return y;
 }
 
-static mpc_err_t* mpc_err_merge(mpc_input_t* i, mpc_err_t* x, mpc_err_t* y) {
-  mpc_err_t* errs[2];
-  errs[0] = x;
-  errs[1] = y;
-  return mpc_err_or(i, errs, 2);
-}
-
 /*
 ** Parser Type
 */
@@ -1000,7 +1210,11 @@ enum {
   MPC_TYPE_CHECK_WITH = 26,
 
   MPC_TYPE_SOI = 27,
-  MPC_TYPE_EOI = 28
+  MPC_TYPE_EOI = 28,
+
+  MPC_TYPE_MEMO = 29,
+  MPC_TYPE_DFA = 30,
+  MPC_TYPE_ARENA = 31
 };
 
 typedef struct {
@@ -1064,9 +1278,39 @@ typedef struct {
   mpc_parser_t* x;
   mpc_dtor_t dx;
 } mpc_pdata_repeat_t;
+
+/*
+** An optimised `or` can have a table saying, for each
+** class of next characters, which alternatives could
+** do anything but fail where they start. The others
+** are skipped, and the error they would have given is
+** merged from the parser in fails that gives it: an
+** expect, a DFA, or an `or` whose alternatives are all
+** known, so that it fails at once on any character not
+** in first. NULL means there is no error.
+**
+** The table also lists the rules it looked into and
+** the version of each then. Defining a rule again gives
+** it a new version, and a table any of whose rules has
+** changed is not used until mpc_optimise rebuilds it.
+*/
+
+typedef struct {
+  unsigned char classes[256];
+  int classes_num;
+  char* tries;
+  mpc_parser_t** fails;
+  int known;
+  unsigned char first[32];
+  mpc_parser_t** rules;
+  int* versions;
+  int rules_num;
+} mpc_or_table_t;
+
 typedef struct {
   int n;
   mpc_parser_t** xs;
+  mpc_or_table_t* table;
 } mpc_pdata_or_t;
 typedef struct {
   int n;
@@ -1075,33 +1319,90 @@ typedef struct {
   mpc_dtor_t* dxs;
 } mpc_pdata_and_t;
 
-typedef union {
-  mpc_pdata_fail_t fail;
-  mpc_pdata_lift_t lift;
-  mpc_pdata_expect_t expect;
-  mpc_pdata_anchor_t anchor;
-  mpc_pdata_single_t single;
-  mpc_pdata_range_t range;
-  mpc_pdata_satisfy_t satisfy;
-  mpc_pdata_string_t string;
-  mpc_pdata_apply_t apply;
-  mpc_pdata_apply_to_t apply_to;
-  mpc_pdata_check_t check;
+typedef struct {
+  mpc_parser_t* x;
+  mpc_dup_t c;
+  mpc_dtor_t dx;
+} mpc_pdata_memo_t;
+
+/*
+** A regex compiled to a DFA has a row for each state
+** and a column for each class of characters, where a
+** NUL is the end of the input. Each edge says where
+** to go next, or whether to stop, and which errors
+** the combinators it stands in for would have given:
+** lists of labels merged along the way, and for a
+** failure the one returned.
+*/
+
+enum { MPC_DFA_ACCEPT = -1, MPC_DFA_FAIL = -2 };
+
+typedef struct {
+  int next;
+  int merged;
+  int error;
+} mpc_dfa_edge_t;
+
+typedef struct {
+  int start;
+  int states_num;
+  int classes_num;
+  unsigned char classes[256];
+  mpc_dfa_edge_t* edges;
+  char** labels;
+  int labels_num;
+  int** lists;
+  int lists_num;
+} mpc_dfa_t;
+
+typedef struct {
+  mpc_dfa_t* d;
+  mpc_parser_t* x;
+} mpc_pdata_dfa_t;
+
+typedef struct {
+  mpc_parser_t* x;
+} mpc_pdata_arena_t;
+
+typedef union {
+  mpc_pdata_fail_t fail;
+  mpc_pdata_lift_t lift;
+  mpc_pdata_expect_t expect;
+  mpc_pdata_anchor_t anchor;
+  mpc_pdata_single_t single;
+  mpc_pdata_range_t range;
+  mpc_pdata_satisfy_t satisfy;
+  mpc_pdata_string_t string;
+  mpc_pdata_apply_t apply;
+  mpc_pdata_apply_to_t apply_to;
+  mpc_pdata_check_t check;
   mpc_pdata_check_with_t check_with;
   mpc_pdata_predict_t predict;
   mpc_pdata_not_t not;
   mpc_pdata_repeat_t repeat;
   mpc_pdata_and_t and;
   mpc_pdata_or_t or ;
+  mpc_pdata_memo_t memo;
+  mpc_pdata_dfa_t dfa;
+  mpc_pdata_arena_t arena;
 } mpc_pdata_t;
 
 struct mpc_parser_t {
   char* name;
   mpc_pdata_t data;
+  int id;
+  int version;
   char type;
   char retained;
 };
 
+static mpc_ast_t* mpc_ast_new_in(mpc_ast_arena_t* m, const char* tag,
+                                 const char* contents);
+static mpc_ast_t* mpc_ast_copy_in(mpc_ast_arena_t* m, mpc_ast_t* a);
+static mpc_val_t* mpcf_fold_ast_in(mpc_ast_arena_t* m, int n,
+                                   mpc_val_t** xs);
+static mpc_val_t* mpca_ast_dup(mpc_val_t* x);
+
 static mpc_val_t* mpcf_input_nth_free(mpc_input_t* i, int n, mpc_val_t** xs,
                                       int x) {
   int j;
@@ -1149,6 +1450,11 @@ static mpc_val_t* mpcf_input_state_ast(mpc_input_t* i, int n, mpc_val_t** xs) {
   return a;
 }
 
+/* The arena an mpca parser builds nodes in, if it is in one */
+static mpc_ast_arena_t* mpc_input_arena(mpc_input_t* i) {
+  return i->in_arena ? i->arena : NULL;
+}
+
 static mpc_val_t* mpc_parse_fold(mpc_input_t* i, mpc_fold_t f, int n,
                                  mpc_val_t** xs) {
   int j;
@@ -1179,6 +1485,9 @@ static mpc_val_t* mpc_parse_fold(mpc_input_t* i, mpc_fold_t f, int n,
   if (f == mpcf_state_ast) {
     return mpcf_input_state_ast(i, n, xs);
   }
+  if (f == mpcf_fold_ast) {
+    return mpcf_fold_ast_in(mpc_input_arena(i), n, xs);
+  }
   for (j = 0; j < n; j++) {
     xs[j] = mpc_export(i, xs[j]);
   }
@@ -1191,7 +1500,7 @@ static mpc_val_t* mpcf_input_free(mpc_input_t* i, mpc_val_t* x) {
 }
 
 static mpc_val_t* mpcf_input_str_ast(mpc_input_t* i, mpc_val_t* c) {
-  mpc_ast_t* a = mpc_ast_new("", c);
+  mpc_ast_t* a = mpc_ast_new_in(mpc_input_arena(i), "", c);
   mpc_free(i, c);
   return a;
 }
@@ -1219,6 +1528,13 @@ static void mpc_parse_dtor(mpc_input_t* i, mpc_dtor_t d, mpc_val_t* x) {
   d(mpc_export(i, x));
 }
 
+static mpc_val_t* mpc_parse_dup(mpc_input_t* i, mpc_dup_t c, mpc_val_t* x) {
+  if (c == mpca_ast_dup) {
+    return mpc_ast_copy_in(mpc_input_arena(i), x);
+  }
+  return c(x);
+}
+
 enum { MPC_PARSE_STACK_MIN = 4 };
 
 #define MPC_SUCCESS(x)                                                         \
@@ -1234,6 +1550,24 @@ enum { MPC_PARSE_STACK_MIN = 4 };
     MPC_FAILURE(NULL);                                                         \
   }
 
+static int mpc_memo_find(mpc_input_t* i, mpc_parser_t* p, mpc_result_t* r,
+                         mpc_err_t** e, int* again);
+static int mpc_memo_keep(mpc_input_t* i, mpc_parser_t* p, long pos, int again,
+                         int x, mpc_result_t* r, mpc_err_t** e,
+                         mpc_err_t* merged);
+static int mpc_parse_dfa(mpc_input_t* i, mpc_parser_t* p, mpc_result_t* r,
+                         mpc_err_t** e);
+static int mpc_or_next(mpc_input_t* i, mpc_parser_t* p, int j, mpc_err_t** e);
+static void mpc_arena_enter(mpc_input_t* i);
+static void mpc_arena_leave(mpc_input_t* i, int x, mpc_result_t* r);
+
+#ifdef MPC_PARSE_RECURSIVE
+
+static int mpc_parse_memo(mpc_input_t* i, mpc_parser_t* p, mpc_result_t* r,
+                          mpc_err_t** e);
+static int mpc_parse_arena(mpc_input_t* i, mpc_parser_t* p, mpc_result_t* r,
+                           mpc_err_t** e);
+
 static int mpc_parse_run(mpc_input_t* i, mpc_parser_t* p, mpc_result_t* r,
                          mpc_err_t** e) {
 
@@ -1465,7 +1799,8 @@ static int mpc_parse_run(mpc_input_t* i, mpc_parser_t* p, mpc_result_t* r,
                     ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
                     : results_stk;
 
-      for (j = 0; j < p->data.or.n; j++) {
+      for (j = mpc_or_next(i, p, 0, e); j < p->data.or.n;
+           j = mpc_or_next(i, p, j + 1, e)) {
         if (mpc_parse_run(i, p->data.or.xs[j], &results[j], e)) {
           MPC_SUCCESS(results[j].output;
                       if (p->data.or.n > MPC_PARSE_STACK_MIN) {
@@ -1508,6 +1843,16 @@ static int mpc_parse_run(mpc_input_t* i, mpc_parser_t* p, mpc_result_t* r,
           mpc_parse_fold(i, p->data.and.f, j, (mpc_val_t**)results);
           if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
 
+    case MPC_TYPE_MEMO:
+      return mpc_parse_memo(i, p, r, e);
+    case MPC_TYPE_DFA:
+      if (i->backtrack < 1) {
+        return mpc_parse_run(i, p->data.dfa.x, r, e);
+      }
+      return mpc_parse_dfa(i, p, r, e);
+    case MPC_TYPE_ARENA:
+      return mpc_parse_arena(i, p, r, e);
+
       /* End */
 
     default:
@@ -1518,798 +1863,1650 @@ static int mpc_parse_run(mpc_input_t* i, mpc_parser_t* p, mpc_result_t* r,
   return 0;
 }
 
-#undef MPC_SUCCESS
-#undef MPC_FAILURE
-#undef MPC_PRIMITIVE
+static int mpc_parse_memo(mpc_input_t* i, mpc_parser_t* p, mpc_result_t* r,
+                          mpc_err_t** e) {
 
-int mpc_parse_input(mpc_input_t* i, mpc_parser_t* p, mpc_result_t* r) {
-  int x;
-  mpc_err_t* e = mpc_err_fail(i, "Unknown Error");
-  e->state = mpc_state_invalid();
-  x = mpc_parse_run(i, p, r, &e);
-  if (x) {
-    mpc_err_delete_internal(i, e);
-    r->output = mpc_export(i, r->output);
-  } else {
-    r->error = mpc_err_export(i, mpc_err_merge(i, e, r->error));
+  mpc_err_t* merged = NULL;
+  long pos = i->state.pos;
+  int x, again;
+
+  /* Without backtracking a failure may not leave the input where it was */
+  if (i->backtrack < 1) {
+    return mpc_parse_run(i, p->data.memo.x, r, e);
   }
-  return x;
+
+  x = mpc_memo_find(i, p, r, e, &again);
+  if (x != -1) {
+    return x;
+  }
+
+  /* Errors merged while parsing are collected apart so they can be kept */
+  x = mpc_parse_run(i, p->data.memo.x, r, &merged);
+  return mpc_memo_keep(i, p, pos, again, x, r, e, merged);
 }
 
-int mpc_parse(const char* filename, const char* string, mpc_parser_t* p,
-              mpc_result_t* r) {
+static int mpc_parse_arena(mpc_input_t* i, mpc_parser_t* p, mpc_result_t* r,
+                           mpc_err_t** e) {
+
   int x;
-  mpc_input_t* i = mpc_input_new_string(filename, string);
-  x = mpc_parse_input(i, p, r);
-  mpc_input_delete(i);
+
+  if (i->in_arena) {
+    return mpc_parse_run(i, p->data.arena.x, r, e);
+  }
+
+  mpc_arena_enter(i);
+  x = mpc_parse_run(i, p->data.arena.x, r, e);
+  mpc_arena_leave(i, x, r);
   return x;
 }
 
-int mpc_nparse(const char* filename, const char* string, size_t length,
-               mpc_parser_t* p, mpc_result_t* r) {
-  int x;
-  mpc_input_t* i = mpc_input_new_nstring(filename, string, length);
-  x = mpc_parse_input(i, p, r);
-  mpc_input_delete(i);
-  return x;
+#endif
+
+/*
+** Packrat Parsing
+**
+** A parser wrapped by mpc_memo keeps its result at
+** each position in a table in the input, so when
+** backtracking tries it there again the result can
+** be given back instead of parsed again. A failure
+** is kept the first time. A success is kept, copied
+** with the dup function, only once the parser runs
+** at a position a second time, so grammars that do
+** not backtrack over it never pay for the copies.
+**
+** Each parser and position has one slot in a table
+** which grows as it fills, up to a limit. Past that a
+** new result evicts the one in its slot, and results
+** nothing can backtrack to are dropped once every mark
+** has been released.
+*/
+
+static void mpc_memo_delete(mpc_input_t* i, mpc_memo_t* m) {
+  if (m->ok == 1 && m->output && m->p->data.memo.dx) {
+    m->p->data.memo.dx(m->output);
+  }
+  mpc_err_delete_internal(i, m->error);
+  mpc_err_delete_internal(i, m->merged);
+  m->p = NULL;
+  i->memo_num--;
 }
 
-int mpc_parse_file(const char* filename, FILE* file, mpc_parser_t* p,
-                   mpc_result_t* r) {
-  int x;
-  mpc_input_t* i = mpc_input_new_file(filename, file);
-  x = mpc_parse_input(i, p, r);
-  mpc_input_delete(i);
-  return x;
+static void mpc_input_memo_clear(mpc_input_t* i, long pos) {
+  int j;
+  for (j = 0; j < i->memo_slots; j++) {
+    if (i->memo[j].p && (pos < 0 || i->memo[j].pos < pos)) {
+      mpc_memo_delete(i, &i->memo[j]);
+    }
+  }
 }
 
-int mpc_parse_pipe(const char* filename, FILE* pipe, mpc_parser_t* p,
-                   mpc_result_t* r) {
-  int x;
-  mpc_input_t* i = mpc_input_new_pipe(filename, pipe);
-  x = mpc_parse_input(i, p, r);
-  mpc_input_delete(i);
-  return x;
+static mpc_memo_t* mpc_input_memo_slot(mpc_input_t* i, mpc_parser_t* p,
+                                       long pos) {
+  unsigned long h = (unsigned long)((size_t)p >> 4) * 2654435761UL +
+                    (unsigned long)pos * 40503UL;
+  return &i->memo[h & (unsigned long)(i->memo_slots - 1)];
 }
 
-int mpc_parse_contents(const char* filename, mpc_parser_t* p, mpc_result_t* r) {
+/* Double the table once it is half full, up to its limit */
+static void mpc_input_memo_grow(mpc_input_t* i) {
 
-  FILE* f = fopen(filename, "rb");
-  int res;
+  int j;
+  mpc_memo_t* m;
+  mpc_memo_t* old = i->memo;
+  int old_slots = i->memo_slots;
 
-  if (f == NULL) {
-    r->output = NULL;
-    r->error = mpc_err_file(filename, "Unable to open file!");
-    return 0;
+  if (old && (i->memo_num * 2 < old_slots || old_slots >= MPC_INPUT_MEMO_MAX)) {
+    return;
   }
 
-  res = mpc_parse_file(filename, f, p, r);
-  fclose(f);
-  return res;
+  i->memo_slots = old ? old_slots * 2 : MPC_INPUT_MEMO_MIN;
+  i->memo = calloc(i->memo_slots, sizeof(mpc_memo_t));
+
+  for (j = 0; j < old_slots; j++) {
+    if (old[j].p == NULL) {
+      continue;
+    }
+    m = mpc_input_memo_slot(i, old[j].p, old[j].pos);
+    if (m->p) {
+      mpc_memo_delete(i, m);
+    }
+    *m = old[j];
+  }
+
+  free(old);
 }
 
-/*
-** Building a Parser
-*/
+/* The result kept for p at this position, or -1 if it has to be parsed */
+static int mpc_memo_find(mpc_input_t* i, mpc_parser_t* p, mpc_result_t* r,
+                         mpc_err_t** e, int* again) {
 
-static void mpc_undefine_unretained(mpc_parser_t* p, int force);
+  mpc_memo_t* m;
+  char suppress = i->suppress > 0;
 
-static void mpc_undefine_or(mpc_parser_t* p) {
+  *again = 0;
+  mpc_input_memo_grow(i);
+  m = mpc_input_memo_slot(i, p, i->state.pos);
 
-  int i;
-  for (i = 0; i < p->data.or.n; i++) {
-    mpc_undefine_unretained(p->data.or.xs[i], 0);
+  if (m->p == p && m->pos == i->state.pos && m->suppress == suppress) {
+    if (m->ok != -1) {
+      i->state = m->state;
+      i->last = m->last;
+      if (m->merged) {
+        *e = mpc_err_merge(i, *e, mpc_err_dup(m->merged));
+      }
+      if (m->ok) {
+        MPC_SUCCESS(mpc_parse_dup(i, p->data.memo.c, m->output));
+      } else {
+        MPC_FAILURE(mpc_err_dup(m->error));
+      }
+    }
+    *again = 1;
   }
-  free(p->data.or.xs);
+
+  return -1;
 }
 
-static void mpc_undefine_and(mpc_parser_t* p) {
+/* Keep the result of parsing p from pos, then merge what it merged into e */
+static int mpc_memo_keep(mpc_input_t* i, mpc_parser_t* p, long pos, int again,
+                         int x, mpc_result_t* r, mpc_err_t** e,
+                         mpc_err_t* merged) {
 
-  int i;
-  for (i = 0; i < p->data.and.n; i++) {
-    mpc_undefine_unretained(p->data.and.xs[i], 0);
+  mpc_memo_t* m;
+
+  mpc_input_memo_grow(i);
+  m = mpc_input_memo_slot(i, p, pos);
+  if (m->p) {
+    mpc_memo_delete(i, m);
   }
-  free(p->data.and.xs);
-  free(p->data.and.dxs);
+
+  m->p = p;
+  m->pos = pos;
+  m->suppress = i->suppress > 0;
+  m->ok = x;
+  m->last = i->last;
+  m->state = i->state;
+  m->output = NULL;
+  m->error = x ? NULL : mpc_err_dup(r->error);
+  m->merged = mpc_err_dup(merged);
+  i->memo_num++;
+
+  if (x && again && p->data.memo.c) {
+    m->output = p->data.memo.c(r->output);
+  } else if (x) {
+    m->ok = -1;
+  }
+
+  if (merged) {
+    *e = mpc_err_merge(i, *e, merged);
+  }
+
+  return x;
 }
 
-static void mpc_undefine_unretained(mpc_parser_t* p, int force) {
+/*
+** Regex DFA Parsing
+**
+** The DFA steps through the input without a mark
+** for every combinator, only rewinding once if it
+** fails. Labels merged at one position hide those
+** merged before it, so only the last are kept.
+*/
 
-  if (p->retained && !force) {
-    return;
+static mpc_err_t* mpc_err_dfa(mpc_input_t* i, mpc_dfa_t* d, int list,
+                              mpc_state_t s, char recieved) {
+  int j;
+  int* l = d->lists[list];
+  mpc_err_t* x = mpc_malloc(i, sizeof(mpc_err_t));
+  x->filename = NULL;
+  x->state = s;
+  x->expected_num = 0;
+  x->expected = NULL;
+  x->failure = NULL;
+  x->recieved = recieved;
+  for (j = 1; j <= l[0]; j++) {
+    if (!mpc_err_contains_expected(i, x, d->labels[l[j]])) {
+      mpc_err_add_expected(i, x, d->labels[l[j]]);
+    }
   }
+  return x;
+}
 
-  switch (p->type) {
+static int mpc_parse_dfa(mpc_input_t* i, mpc_parser_t* p, mpc_result_t* r,
+                         mpc_err_t** e) {
 
-    case MPC_TYPE_FAIL:
-      free(p->data.fail.m);
-      break;
+  mpc_dfa_t* d = p->data.dfa.d;
+  mpc_dfa_edge_t* x;
+  mpc_state_t at = i->state;
+  int s = d->start;
+  int merged = 0;
+  char got = '\0';
+  char c;
+  char* out;
+  int n = 0, slots = 16;
+
+  out = mpc_malloc(i, slots);
+  mpc_input_mark(i);
 
-    case MPC_TYPE_ONEOF:
-    case MPC_TYPE_NONEOF:
-    case MPC_TYPE_STRING:
-      free(p->data.string.x);
+  while (1) {
+    c = mpc_input_getc(i);
+    x = &d->edges[s * d->classes_num + d->classes[(unsigned char)c]];
+    if (x->merged) {
+      merged = x->merged;
+      at = i->state;
+      got = c;
+    }
+    if (x->next < 0) {
       break;
+    }
+    if (n + 1 == slots) {
+      slots *= 2;
+      out = mpc_realloc(i, out, slots);
+    }
+    out[n++] = c;
+    mpc_input_success(i, c, NULL);
+    s = x->next;
+  }
 
-    case MPC_TYPE_APPLY:
-      mpc_undefine_unretained(p->data.apply.x, 0);
-      break;
-    case MPC_TYPE_APPLY_TO:
-      mpc_undefine_unretained(p->data.apply_to.x, 0);
-      break;
-    case MPC_TYPE_PREDICT:
-      mpc_undefine_unretained(p->data.predict.x, 0);
-      break;
+  if (merged && !i->suppress) {
+    *e = mpc_err_merge(i, *e, mpc_err_dfa(i, d, merged, at, got));
+  }
 
-    case MPC_TYPE_MAYBE:
-    case MPC_TYPE_NOT:
-      mpc_undefine_unretained(p->data.not.x, 0);
-      break;
+  if (x->next == MPC_DFA_ACCEPT) {
+    mpc_input_unmark(i);
+    out[n] = '\0';
+    MPC_SUCCESS(out);
+  }
 
-    case MPC_TYPE_EXPECT:
-      mpc_undefine_unretained(p->data.expect.x, 0);
-      free(p->data.expect.m);
-      break;
+  r->error = x->error && !i->suppress
+                 ? mpc_err_dfa(i, d, x->error, i->state, c)
+                 : NULL;
+  mpc_input_rewind(i);
+  mpc_free(i, out);
+  return 0;
+}
 
-    case MPC_TYPE_MANY:
-    case MPC_TYPE_MANY1:
-    case MPC_TYPE_COUNT:
-      mpc_undefine_unretained(p->data.repeat.x, 0);
-      break;
+/*
+** Skipping Alternatives
+**
+** An `or` with a table goes straight to the next
+** alternative that the next character could start.
+** Those passed over would have failed at once, so only
+** the errors they would have given are merged.
+*/
 
-    case MPC_TYPE_OR:
-      mpc_undefine_or(p);
-      break;
-    case MPC_TYPE_AND:
-      mpc_undefine_and(p);
-      break;
+static void mpc_or_skip(mpc_input_t* i, mpc_parser_t* p, char c,
+                        mpc_err_t** e) {
 
-    case MPC_TYPE_CHECK:
-      mpc_undefine_unretained(p->data.check.x, 0);
-      free(p->data.check.e);
-      break;
+  mpc_dfa_t* d;
+  mpc_dfa_edge_t* x;
+  int j;
 
-    case MPC_TYPE_CHECK_WITH:
-      mpc_undefine_unretained(p->data.check_with.x, 0);
-      free(p->data.check_with.e);
-      break;
+  if (p == NULL || i->suppress) {
+    return;
+  }
 
+  switch (p->type) {
+    case MPC_TYPE_EXPECT:
+      *e = mpc_err_merge(i, *e, mpc_err_new(i, p->data.expect.m));
+      break;
+    case MPC_TYPE_DFA:
+      d = p->data.dfa.d;
+      x = &d->edges[d->start * d->classes_num + d->classes[(unsigned char)c]];
+      if (x->merged) {
+        *e = mpc_err_merge(i, *e, mpc_err_dfa(i, d, x->merged, i->state, c));
+      }
+      if (x->error) {
+        *e = mpc_err_merge(i, *e, mpc_err_dfa(i, d, x->error, i->state, c));
+      }
+      break;
+    case MPC_TYPE_OR:
+      for (j = 0; j < p->data.or.n; j++) {
+        mpc_or_skip(i, p->data.or.table->fails[j], c, e);
+      }
+      break;
     default:
       break;
   }
+}
 
-  if (!force) {
-    free(p->name);
-    free(p);
+static int mpc_or_table_current(mpc_or_table_t* t) {
+  int k;
+  for (k = 0; k < t->rules_num; k++) {
+    if (t->rules[k]->version != t->versions[k]) {
+      return 0;
+    }
   }
+  return 1;
 }
 
-void mpc_delete(mpc_parser_t* p) {
-  if (p->retained) {
+#ifdef MPC_COUNT_TRIES
 
-    if (p->type != MPC_TYPE_UNDEFINED) {
-      mpc_undefine_unretained(p, 0);
-    }
+/*
+** Built with MPC_COUNT_TRIES, every alternative of an
+** `or` that is parsed or skipped is counted, across all
+** parses. Without tables each skipped one would have
+** been parsed too, and failed.
+*/
 
-    free(p->name);
-    free(p);
+static unsigned long mpc_or_tried = 0;
+static unsigned long mpc_or_skipped = 0;
 
-  } else {
-    mpc_undefine_unretained(p, 0);
-  }
+void mpc_or_counts(unsigned long* tried, unsigned long* skipped) {
+  *tried = mpc_or_tried;
+  *skipped = mpc_or_skipped;
+  mpc_or_tried = 0;
+  mpc_or_skipped = 0;
 }
 
-static void mpc_soft_delete(mpc_val_t* x) { mpc_undefine_unretained(x, 0); }
+#endif
 
-static mpc_parser_t* mpc_undefined(void) {
-  mpc_parser_t* p = calloc(1, sizeof(mpc_parser_t));
-  p->retained = 0;
-  p->type = MPC_TYPE_UNDEFINED;
-  p->name = NULL;
-  return p;
-}
+static int mpc_or_next(mpc_input_t* i, mpc_parser_t* p, int j, mpc_err_t** e) {
 
-mpc_parser_t* mpc_new(const char* name) {
-  mpc_parser_t* p = mpc_undefined();
-  p->retained = 1;
-  p->name = realloc(p->name, strlen(name) + 1);
-  strcpy(p->name, name);
-  return p;
+  mpc_or_table_t* t = p->data.or.table;
+  char* tries;
+  char c;
+
+  /* The table follows the DFAs, which are not used without backtracking */
+  if (t != NULL && i->backtrack >= 1 && mpc_or_table_current(t)) {
+    c = mpc_input_peekc(i);
+    tries = t->tries + t->classes[(unsigned char)c] * p->data.or.n;
+    while (j < p->data.or.n && !tries[j]) {
+      mpc_or_skip(i, t->fails[j], c, e);
+      j++;
+#ifdef MPC_COUNT_TRIES
+      mpc_or_skipped++;
+#endif
+    }
+  }
+
+#ifdef MPC_COUNT_TRIES
+  mpc_or_tried += j < p->data.or.n;
+#endif
+  return j;
 }
 
-mpc_parser_t* mpc_copy(mpc_parser_t* a) {
-  int i = 0;
-  mpc_parser_t* p;
+/*
+** AST Arenas
+**
+** The outermost parser wrapped by mpca_arena gives
+** the input an arena, which the mpca folds inside it
+** build their nodes in. Callbacks and other parses get
+** ordinary nodes from mpc_ast_new as always. If it
+** succeeds the tree it gives back owns the arena,
+** otherwise the arena stays with the input for the
+** next one until the input is done.
+*/
 
-  if (a->retained) {
-    return a;
+static mpc_ast_arena_t* mpc_ast_arena_new(void);
+
+static void mpc_arena_enter(mpc_input_t* i) {
+  if (i->arena == NULL) {
+    i->arena = mpc_ast_arena_new();
   }
+  i->in_arena = 1;
+}
 
-  p = mpc_undefined();
-  p->retained = a->retained;
-  p->type = a->type;
-  p->data = a->data;
+static void mpc_arena_leave(mpc_input_t* i, int x, mpc_result_t* r) {
+  i->in_arena = 0;
+  if (x && r->output && ((mpc_ast_t*)r->output)->arena == i->arena) {
+    i->arena->root = r->output;
+    i->arena = NULL;
+  }
+}
 
-  if (a->name) {
-    p->name = malloc(strlen(a->name) + 1);
-    strcpy(p->name, a->name);
+#ifndef MPC_PARSE_RECURSIVE
+
+/*
+** Iterative Parsing
+**
+** Unless built with MPC_PARSE_RECURSIVE, in which
+** case mpc_parse_run recurses for every parser as a
+** reference, parsing runs in a loop. Each parser it
+** is inside of has a frame on a stack of its own, so
+** nesting in the input uses no C stack. A parser is
+** entered at call, and resumed at ret once the one it
+** is waiting on has given back a result. What each
+** and or repeat has matched so far goes on a second
+** stack.
+*/
+
+enum { MPC_PARSE_FRAMES_MIN = 64 };
+
+typedef struct {
+  mpc_parser_t* p;
+  int j;
+  int base;
+  long pos;
+  int again;
+  mpc_err_t* outer;
+} mpc_frame_t;
+
+#define MPC_ENTER(x)                                                           \
+  f = &frames[top++];                                                          \
+  f->p = p;                                                                    \
+  f->base = rtop;                                                              \
+  p = x;                                                                       \
+  goto call
+#define MPC_KEEP(x)                                                            \
+  if (rtop == rslots) {                                                        \
+    rslots *= 2;                                                               \
+    results = realloc(results, sizeof(mpc_result_t) * rslots);                 \
+  }                                                                            \
+  results[rtop++] = x
+
+static int mpc_parse_loop(mpc_input_t* i, mpc_parser_t* p, mpc_result_t* r,
+                          mpc_err_t** e) {
+
+  int x = 0, k, n;
+  int top = 0, slots = MPC_PARSE_FRAMES_MIN;
+  int rtop = 0, rslots = MPC_PARSE_FRAMES_MIN;
+  mpc_frame_t* frames = malloc(sizeof(mpc_frame_t) * slots);
+  mpc_result_t* results = malloc(sizeof(mpc_result_t) * rslots);
+  mpc_result_t* rs;
+  mpc_frame_t* f;
+  mpc_err_t* merged;
+
+call:
+  if (top == slots) {
+    slots *= 2;
+    frames = realloc(frames, sizeof(mpc_frame_t) * slots);
   }
 
-  switch (a->type) {
+  switch (p->type) {
 
-    case MPC_TYPE_FAIL:
-      p->data.fail.m = malloc(strlen(a->data.fail.m) + 1);
-      strcpy(p->data.fail.m, a->data.fail.m);
-      break;
+      /* Basic Parsers */
 
+    case MPC_TYPE_ANY:
+      x = mpc_input_any(i, (char**)&r->output);
+      goto primitive;
+    case MPC_TYPE_SINGLE:
+      x = mpc_input_char(i, p->data.single.x, (char**)&r->output);
+      goto primitive;
+    case MPC_TYPE_RANGE:
+      x = mpc_input_range(i, p->data.range.x, p->data.range.y,
+                          (char**)&r->output);
+      goto primitive;
     case MPC_TYPE_ONEOF:
+      x = mpc_input_oneof(i, p->data.string.x, (char**)&r->output);
+      goto primitive;
     case MPC_TYPE_NONEOF:
+      x = mpc_input_noneof(i, p->data.string.x, (char**)&r->output);
+      goto primitive;
+    case MPC_TYPE_SATISFY:
+      x = mpc_input_satisfy(i, p->data.satisfy.f, (char**)&r->output);
+      goto primitive;
     case MPC_TYPE_STRING:
-      p->data.string.x = malloc(strlen(a->data.string.x) + 1);
-      strcpy(p->data.string.x, a->data.string.x);
-      break;
+      x = mpc_input_string(i, p->data.string.x, (char**)&r->output);
+      goto primitive;
+    case MPC_TYPE_ANCHOR:
+      x = mpc_input_anchor(i, p->data.anchor.f, (char**)&r->output);
+      goto primitive;
+    case MPC_TYPE_SOI:
+      x = mpc_input_soi(i, (char**)&r->output);
+      goto primitive;
+    case MPC_TYPE_EOI:
+      x = mpc_input_eoi(i, (char**)&r->output);
+      goto primitive;
+
+      /* Other parsers */
+
+    case MPC_TYPE_UNDEFINED:
+      r->error = mpc_err_fail(i, "Parser Undefined!");
+      x = 0;
+      goto ret;
+    case MPC_TYPE_PASS:
+      r->output = NULL;
+      x = 1;
+      goto ret;
+    case MPC_TYPE_FAIL:
+      r->error = mpc_err_fail(i, p->data.fail.m);
+      x = 0;
+      goto ret;
+    case MPC_TYPE_LIFT:
+      r->output = p->data.lift.lf();
+      x = 1;
+      goto ret;
+    case MPC_TYPE_LIFT_VAL:
+      r->output = p->data.lift.x;
+      x = 1;
+      goto ret;
+    case MPC_TYPE_STATE:
+      r->output = mpc_input_state_copy(i);
+      x = 1;
+      goto ret;
+
+      /* Application Parsers */
 
     case MPC_TYPE_APPLY:
-      p->data.apply.x = mpc_copy(a->data.apply.x);
+      MPC_ENTER(p->data.apply.x);
+    case MPC_TYPE_APPLY_TO:
+      MPC_ENTER(p->data.apply_to.x);
+    case MPC_TYPE_CHECK:
+      MPC_ENTER(p->data.check.x);
+    case MPC_TYPE_CHECK_WITH:
+      MPC_ENTER(p->data.check_with.x);
+    case MPC_TYPE_EXPECT:
+      mpc_input_suppress_enable(i);
+      MPC_ENTER(p->data.expect.x);
+    case MPC_TYPE_PREDICT:
+      mpc_input_backtrack_disable(i);
+      MPC_ENTER(p->data.predict.x);
+
+      /* Optional Parsers */
+
+    case MPC_TYPE_NOT:
+      mpc_input_mark(i);
+      mpc_input_suppress_enable(i);
+      MPC_ENTER(p->data.not.x);
+    case MPC_TYPE_MAYBE:
+      MPC_ENTER(p->data.not.x);
+
+      /* Repeat Parsers */
+
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      MPC_ENTER(p->data.repeat.x);
+
+      /* Combinatory Parsers */
+
+    case MPC_TYPE_OR:
+      if (p->data.or.n == 0) {
+        r->output = NULL;
+        x = 1;
+        goto ret;
+      }
+      k = mpc_or_next(i, p, 0, e);
+      if (k == p->data.or.n) {
+        r->error = NULL;
+        x = 0;
+        goto ret;
+      }
+      frames[top].j = k;
+      MPC_ENTER(p->data.or.xs[k]);
+
+    case MPC_TYPE_AND:
+      if (p->data.and.n == 0) {
+        r->output = NULL;
+        x = 1;
+        goto ret;
+      }
+      mpc_input_mark(i);
+      MPC_ENTER(p->data.and.xs[0]);
+
+      /* Without backtracking a failure may not leave the input where it was */
+
+    case MPC_TYPE_MEMO:
+      if (i->backtrack < 1) {
+        p = p->data.memo.x;
+        goto call;
+      }
+      f = &frames[top];
+      f->pos = i->state.pos;
+      x = mpc_memo_find(i, p, r, e, &f->again);
+      if (x != -1) {
+        goto ret;
+      }
+      /* Errors merged while parsing are collected apart so they can be kept */
+      f->outer = *e;
+      *e = NULL;
+      MPC_ENTER(p->data.memo.x);
+
+    case MPC_TYPE_DFA:
+      if (i->backtrack < 1) {
+        p = p->data.dfa.x;
+        goto call;
+      }
+      x = mpc_parse_dfa(i, p, r, e);
+      goto ret;
+
+    case MPC_TYPE_ARENA:
+      if (i->in_arena) {
+        p = p->data.arena.x;
+        goto call;
+      }
+      mpc_arena_enter(i);
+      MPC_ENTER(p->data.arena.x);
+
+      /* End */
+
+    default:
+      r->error = mpc_err_fail(i, "Unknown Parser Type Id!");
+      x = 0;
+      goto ret;
+  }
+
+primitive:
+  if (!x) {
+    r->error = NULL;
+  }
+
+ret:
+  if (top == 0) {
+    free(frames);
+    free(results);
+    return x;
+  }
+
+  f = &frames[top - 1];
+  p = f->p;
+  rs = results + f->base;
+  n = rtop - f->base;
+
+  switch (p->type) {
+
+    case MPC_TYPE_APPLY:
+      if (x) {
+        r->output = mpc_parse_apply(i, p->data.apply.f, r->output);
+      }
       break;
+
     case MPC_TYPE_APPLY_TO:
-      p->data.apply_to.x = mpc_copy(a->data.apply_to.x);
+      if (x) {
+        r->output = mpc_parse_apply_to(i, p->data.apply_to.f, r->output,
+                                       p->data.apply_to.d);
+      }
+      break;
+
+    case MPC_TYPE_CHECK:
+      if (x && !p->data.check.f(&r->output)) {
+        r->error = mpc_err_fail(i, p->data.check.e);
+        x = 0;
+      }
+      break;
+
+    case MPC_TYPE_CHECK_WITH:
+      if (x && !p->data.check_with.f(&r->output, p->data.check_with.d)) {
+        r->error = mpc_err_fail(i, p->data.check_with.e);
+        x = 0;
+      }
+      break;
+
+    case MPC_TYPE_EXPECT:
+      mpc_input_suppress_disable(i);
+      if (!x) {
+        r->error = mpc_err_new(i, p->data.expect.m);
+      }
       break;
+
     case MPC_TYPE_PREDICT:
-      p->data.predict.x = mpc_copy(a->data.predict.x);
+      mpc_input_backtrack_enable(i);
       break;
 
-    case MPC_TYPE_MAYBE:
     case MPC_TYPE_NOT:
-      p->data.not.x = mpc_copy(a->data.not.x);
+      if (x) {
+        mpc_input_rewind(i);
+        mpc_input_suppress_disable(i);
+        mpc_parse_dtor(i, p->data.not.dx, r->output);
+        r->error = mpc_err_new(i, "opposite");
+        x = 0;
+      } else {
+        mpc_input_unmark(i);
+        mpc_input_suppress_disable(i);
+        r->output = p->data.not.lf();
+        x = 1;
+      }
       break;
 
-    case MPC_TYPE_EXPECT:
-      p->data.expect.x = mpc_copy(a->data.expect.x);
-      p->data.expect.m = malloc(strlen(a->data.expect.m) + 1);
-      strcpy(p->data.expect.m, a->data.expect.m);
+    case MPC_TYPE_MAYBE:
+      if (!x) {
+        *e = mpc_err_merge(i, *e, r->error);
+        r->output = p->data.not.lf();
+        x = 1;
+      }
       break;
 
     case MPC_TYPE_MANY:
     case MPC_TYPE_MANY1:
+      if (x) {
+        MPC_KEEP(*r);
+        p = p->data.repeat.x;
+        goto call;
+      }
+      if (p->type == MPC_TYPE_MANY1 && n == 0) {
+        r->error = mpc_err_many1(i, r->error);
+        break;
+      }
+      *e = mpc_err_merge(i, *e, r->error);
+      r->output = mpc_parse_fold(i, p->data.repeat.f, n, (mpc_val_t**)rs);
+      rtop = f->base;
+      x = 1;
+      break;
+
     case MPC_TYPE_COUNT:
-      p->data.repeat.x = mpc_copy(a->data.repeat.x);
+      if (x) {
+        MPC_KEEP(*r);
+        if (++n != p->data.repeat.n) {
+          p = p->data.repeat.x;
+          goto call;
+        }
+        rs = results + f->base;
+        r->output = mpc_parse_fold(i, p->data.repeat.f, n, (mpc_val_t**)rs);
+      } else {
+        for (k = 0; k < n; k++) {
+          mpc_parse_dtor(i, p->data.repeat.dx, rs[k].output);
+        }
+        r->error = mpc_err_count(i, r->error, p->data.repeat.n);
+      }
+      rtop = f->base;
       break;
 
     case MPC_TYPE_OR:
-      p->data.or.xs = malloc(a->data.or.n * sizeof(mpc_parser_t*));
-      for (i = 0; i < a->data.or.n; i++) {
-        p->data.or.xs[i] = mpc_copy(a->data.or.xs[i]);
+      if (x) {
+        break;
+      }
+      *e = mpc_err_merge(i, *e, r->error);
+      f->j = mpc_or_next(i, p, f->j + 1, e);
+      if (f->j < p->data.or.n) {
+        p = p->data.or.xs[f->j];
+        goto call;
       }
+      r->error = NULL;
       break;
+
     case MPC_TYPE_AND:
-      p->data.and.xs = malloc(a->data.and.n * sizeof(mpc_parser_t*));
-      for (i = 0; i < a->data.and.n; i++) {
-        p->data.and.xs[i] = mpc_copy(a->data.and.xs[i]);
+      if (!x) {
+        mpc_input_rewind(i);
+        for (k = 0; k < n; k++) {
+          mpc_parse_dtor(i, p->data.and.dxs[k], rs[k].output);
+        }
+        rtop = f->base;
+        break;
       }
-      p->data.and.dxs = malloc((a->data.and.n - 1) * sizeof(mpc_dtor_t));
-      for (i = 0; i < a->data.and.n - 1; i++) {
-        p->data.and.dxs[i] = a->data.and.dxs[i];
+      MPC_KEEP(*r);
+      if (++n < p->data.and.n) {
+        p = p->data.and.xs[n];
+        goto call;
       }
+      mpc_input_unmark(i);
+      rs = results + f->base;
+      r->output = mpc_parse_fold(i, p->data.and.f, n, (mpc_val_t**)rs);
+      rtop = f->base;
       break;
 
-    case MPC_TYPE_CHECK:
-      p->data.check.x = mpc_copy(a->data.check.x);
-      p->data.check.e = malloc(strlen(a->data.check.e) + 1);
-      strcpy(p->data.check.e, a->data.check.e);
-      break;
-    case MPC_TYPE_CHECK_WITH:
-      p->data.check_with.x = mpc_copy(a->data.check_with.x);
-      p->data.check_with.e = malloc(strlen(a->data.check_with.e) + 1);
-      strcpy(p->data.check_with.e, a->data.check_with.e);
+    case MPC_TYPE_MEMO:
+      merged = *e;
+      *e = f->outer;
+      x = mpc_memo_keep(i, p, f->pos, f->again, x, r, e, merged);
       break;
 
-    default:
+    case MPC_TYPE_ARENA:
+      mpc_arena_leave(i, x, r);
       break;
   }
 
-  return p;
+  top--;
+  goto ret;
 }
 
-mpc_parser_t* mpc_undefine(mpc_parser_t* p) {
-  mpc_undefine_unretained(p, 1);
-  p->type = MPC_TYPE_UNDEFINED;
-  return p;
-}
+#undef MPC_ENTER
+#undef MPC_KEEP
 
-mpc_parser_t* mpc_define(mpc_parser_t* p, mpc_parser_t* a) {
+#endif
 
-  if (p->retained) {
-    p->type = a->type;
-    p->data = a->data;
+#undef MPC_SUCCESS
+#undef MPC_FAILURE
+#undef MPC_PRIMITIVE
+
+int mpc_parse_input(mpc_input_t* i, mpc_parser_t* p, mpc_result_t* r) {
+  int x;
+  mpc_err_t* e = mpc_err_fail(i, "Unknown Error");
+  e->state = mpc_state_invalid();
+#ifdef MPC_PARSE_RECURSIVE
+  x = mpc_parse_run(i, p, r, &e);
+#else
+  x = mpc_parse_loop(i, p, r, &e);
+#endif
+  if (x) {
+    mpc_err_delete_internal(i, e);
+    r->output = mpc_export(i, r->output);
   } else {
-    mpc_parser_t* a2 = mpc_failf("Attempt to assign to Unretained Parser!");
-    p->type = a2->type;
-    p->data = a2->data;
-    free(a2);
+    r->error = mpc_err_export(i, mpc_err_merge(i, e, r->error));
   }
-
-  free(a);
-  return p;
+  return x;
 }
 
-void mpc_cleanup(int n, ...) {
-  int i;
-  mpc_parser_t** list = malloc(sizeof(mpc_parser_t*) * n);
-
-  va_list va;
-  va_start(va, n);
-  for (i = 0; i < n; i++) {
-    list[i] = va_arg(va, mpc_parser_t*);
-  }
-  for (i = 0; i < n; i++) {
-    mpc_undefine(list[i]);
-  }
-  for (i = 0; i < n; i++) {
-    mpc_delete(list[i]);
-  }
-  va_end(va);
-
-  free(list);
+int mpc_parse(const char* filename, const char* string, mpc_parser_t* p,
+              mpc_result_t* r) {
+  int x;
+  mpc_input_t* i = mpc_input_new_string(filename, string);
+  x = mpc_parse_input(i, p, r);
+  mpc_input_delete(i);
+  return x;
 }
 
-mpc_parser_t* mpc_pass(void) {
-  mpc_parser_t* p = mpc_undefined();
-  p->type = MPC_TYPE_PASS;
-  return p;
+int mpc_nparse(const char* filename, const char* string, size_t length,
+               mpc_parser_t* p, mpc_result_t* r) {
+  int x;
+  mpc_input_t* i = mpc_input_new_nstring(filename, string, length);
+  x = mpc_parse_input(i, p, r);
+  mpc_input_delete(i);
+  return x;
 }
 
-mpc_parser_t* mpc_fail(const char* m) {
-  mpc_parser_t* p = mpc_undefined();
-  p->type = MPC_TYPE_FAIL;
-  p->data.fail.m = malloc(strlen(m) + 1);
-  strcpy(p->data.fail.m, m);
-  return p;
+/* Leaves the file just past what was parsed */
+int mpc_parse_file(const char* filename, FILE* file, mpc_parser_t* p,
+                   mpc_result_t* r) {
+  int x;
+  mpc_input_t* i = mpc_input_new_file(filename, file);
+  x = mpc_parse_input(i, p, r);
+  mpc_input_delete(i);
+  return x;
 }
 
 /*
-** As `snprintf` is not ANSI standard this
-** function `mpc_failf` should be considered
-** unsafe.
-**
-** You have a few options if this is going to be
-** trouble.
-**
-** - Ensure the format string does not exceed
-**   the buffer length using precision specifiers
-**   such as `%.512s`.
-**
-** - Patch this function in your code base to
-**   use `snprintf` or whatever variant your
-**   system supports.
-**
-** - Avoid it altogether.
-**
+** Reads the pipe in chunks, giving back what it read
+** past the end of the parse as far as the stream will
+** take it; see mpc_input_unread.
 */
+int mpc_parse_pipe(const char* filename, FILE* pipe, mpc_parser_t* p,
+                   mpc_result_t* r) {
+  int x;
+  mpc_input_t* i = mpc_input_new_pipe(filename, pipe);
+  x = mpc_parse_input(i, p, r);
+  mpc_input_delete(i);
+  return x;
+}
 
-mpc_parser_t* mpc_failf(const char* fmt, ...) {
+int mpc_parse_contents(const char* filename, mpc_parser_t* p, mpc_result_t* r) {
 
-  va_list va;
-  char* buffer;
+  FILE* f;
+  int res;
+  mpc_input_t* i = mpc_input_new_mmap(filename);
 
-  mpc_parser_t* p = mpc_undefined();
-  p->type = MPC_TYPE_FAIL;
+  if (i) {
+    res = mpc_parse_input(i, p, r);
+    mpc_input_delete(i);
+    return res;
+  }
 
-  va_start(va, fmt);
-  buffer = malloc(2048);
-  vsprintf(buffer, fmt, va);
-  va_end(va);
+  f = fopen(filename, "rb");
 
-  buffer = realloc(buffer, strlen(buffer) + 1);
-  p->data.fail.m = buffer;
-  return p;
-}
+  if (f == NULL) {
+    r->output = NULL;
+    r->error = mpc_err_file(filename, "Unable to open file!");
+    return 0;
+  }
 
-mpc_parser_t* mpc_lift_val(mpc_val_t* x) {
-  mpc_parser_t* p = mpc_undefined();
-  p->type = MPC_TYPE_LIFT_VAL;
-  p->data.lift.x = x;
-  return p;
+  res = mpc_parse_file(filename, f, p, r);
+  fclose(f);
+  return res;
 }
 
-mpc_parser_t* mpc_lift(mpc_ctor_t lf) {
-  mpc_parser_t* p = mpc_undefined();
-  p->type = MPC_TYPE_LIFT;
-  p->data.lift.lf = lf;
-  return p;
-}
+/*
+** Building a Parser
+*/
 
-mpc_parser_t* mpc_anchor(int (*f)(char, char)) {
-  mpc_parser_t* p = mpc_undefined();
-  p->type = MPC_TYPE_ANCHOR;
-  p->data.anchor.f = f;
-  return mpc_expect(p, "anchor");
+static void mpc_undefine_unretained(mpc_parser_t* p, int force);
+static void mpc_dfa_delete(mpc_dfa_t* d);
+static mpc_dfa_t* mpc_dfa_copy(mpc_dfa_t* a);
+
+static void mpc_or_table_delete(mpc_or_table_t* t) {
+  if (t == NULL) {
+    return;
+  }
+  free(t->tries);
+  free(t->fails);
+  free(t->rules);
+  free(t->versions);
+  free(t);
 }
 
-mpc_parser_t* mpc_state(void) {
-  mpc_parser_t* p = mpc_undefined();
-  p->type = MPC_TYPE_STATE;
-  return p;
+static void mpc_undefine_or(mpc_parser_t* p) {
+
+  int i;
+  for (i = 0; i < p->data.or.n; i++) {
+    mpc_undefine_unretained(p->data.or.xs[i], 0);
+  }
+  free(p->data.or.xs);
+  mpc_or_table_delete(p->data.or.table);
 }
 
-mpc_parser_t* mpc_expect(mpc_parser_t* a, const char* expected) {
-  mpc_parser_t* p = mpc_undefined();
-  p->type = MPC_TYPE_EXPECT;
-  p->data.expect.x = a;
-  p->data.expect.m = malloc(strlen(expected) + 1);
-  strcpy(p->data.expect.m, expected);
-  return p;
+static void mpc_undefine_and(mpc_parser_t* p) {
+
+  int i;
+  for (i = 0; i < p->data.and.n; i++) {
+    mpc_undefine_unretained(p->data.and.xs[i], 0);
+  }
+  free(p->data.and.xs);
+  free(p->data.and.dxs);
 }
 
-/*
-** As `snprintf` is not ANSI standard this
-** function `mpc_expectf` should be considered
-** unsafe.
-**
-** You have a few options if this is going to be
-** trouble.
-**
-** - Ensure the format string does not exceed
-**   the buffer length using precision specifiers
-**   such as `%.512s`.
-**
-** - Patch this function in your code base to
-**   use `snprintf` or whatever variant your
-**   system supports.
-**
-** - Avoid it altogether.
-**
-*/
+static void mpc_undefine_unretained(mpc_parser_t* p, int force) {
 
-mpc_parser_t* mpc_expectf(mpc_parser_t* a, const char* fmt, ...) {
-  va_list va;
-  char* buffer;
+  if (p->retained && !force) {
+    return;
+  }
 
-  mpc_parser_t* p = mpc_undefined();
-  p->type = MPC_TYPE_EXPECT;
+  switch (p->type) {
 
-  va_start(va, fmt);
-  buffer = malloc(2048);
-  vsprintf(buffer, fmt, va);
-  va_end(va);
+    case MPC_TYPE_FAIL:
+      free(p->data.fail.m);
+      break;
 
-  buffer = realloc(buffer, strlen(buffer) + 1);
-  p->data.expect.x = a;
-  p->data.expect.m = buffer;
-  return p;
-}
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+    case MPC_TYPE_STRING:
+      free(p->data.string.x);
+      break;
 
-/*
-** Basic Parsers
-*/
+    case MPC_TYPE_APPLY:
+      mpc_undefine_unretained(p->data.apply.x, 0);
+      break;
+    case MPC_TYPE_APPLY_TO:
+      mpc_undefine_unretained(p->data.apply_to.x, 0);
+      break;
+    case MPC_TYPE_PREDICT:
+      mpc_undefine_unretained(p->data.predict.x, 0);
+      break;
 
-mpc_parser_t* mpc_any(void) {
-  mpc_parser_t* p = mpc_undefined();
-  p->type = MPC_TYPE_ANY;
-  return mpc_expect(p, "any character");
-}
+    case MPC_TYPE_MAYBE:
+    case MPC_TYPE_NOT:
+      mpc_undefine_unretained(p->data.not.x, 0);
+      break;
 
-mpc_parser_t* mpc_char(char c) {
-  mpc_parser_t* p = mpc_undefined();
-  p->type = MPC_TYPE_SINGLE;
-  p->data.single.x = c;
-  return mpc_expectf(p, "'%c'", c);
-}
+    case MPC_TYPE_EXPECT:
+      mpc_undefine_unretained(p->data.expect.x, 0);
+      free(p->data.expect.m);
+      break;
 
-mpc_parser_t* mpc_range(char s, char e) {
-  mpc_parser_t* p = mpc_undefined();
-  p->type = MPC_TYPE_RANGE;
-  p->data.range.x = s;
-  p->data.range.y = e;
-  return mpc_expectf(p, "character between '%c' and '%c'", s, e);
-}
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      mpc_undefine_unretained(p->data.repeat.x, 0);
+      break;
 
-mpc_parser_t* mpc_oneof(const char* s) {
-  mpc_parser_t* p = mpc_undefined();
-  p->type = MPC_TYPE_ONEOF;
-  p->data.string.x = malloc(strlen(s) + 1);
-  strcpy(p->data.string.x, s);
-  return mpc_expectf(p, "one of '%s'", s);
-}
+    case MPC_TYPE_OR:
+      mpc_undefine_or(p);
+      break;
+    case MPC_TYPE_AND:
+      mpc_undefine_and(p);
+      break;
 
-mpc_parser_t* mpc_noneof(const char* s) {
-  mpc_parser_t* p = mpc_undefined();
-  p->type = MPC_TYPE_NONEOF;
-  p->data.string.x = malloc(strlen(s) + 1);
-  strcpy(p->data.string.x, s);
-  return mpc_expectf(p, "none of '%s'", s);
-}
+    case MPC_TYPE_CHECK:
+      mpc_undefine_unretained(p->data.check.x, 0);
+      free(p->data.check.e);
+      break;
 
-mpc_parser_t* mpc_satisfy(int (*f)(char)) {
-  mpc_parser_t* p = mpc_undefined();
-  p->type = MPC_TYPE_SATISFY;
-  p->data.satisfy.f = f;
-  return mpc_expectf(p, "character satisfying function %p", f);
-}
+    case MPC_TYPE_CHECK_WITH:
+      mpc_undefine_unretained(p->data.check_with.x, 0);
+      free(p->data.check_with.e);
+      break;
 
-mpc_parser_t* mpc_string(const char* s) {
-  mpc_parser_t* p = mpc_undefined();
-  p->type = MPC_TYPE_STRING;
-  p->data.string.x = malloc(strlen(s) + 1);
-  strcpy(p->data.string.x, s);
-  return mpc_expectf(p, "\"%s\"", s);
-}
+    case MPC_TYPE_MEMO:
+      mpc_undefine_unretained(p->data.memo.x, 0);
+      break;
 
-/*
-** Core Parsers
-*/
+    case MPC_TYPE_DFA:
+      mpc_dfa_delete(p->data.dfa.d);
+      mpc_undefine_unretained(p->data.dfa.x, 0);
+      break;
 
-mpc_parser_t* mpc_apply(mpc_parser_t* a, mpc_apply_t f) {
-  mpc_parser_t* p = mpc_undefined();
-  p->type = MPC_TYPE_APPLY;
-  p->data.apply.x = a;
-  p->data.apply.f = f;
-  return p;
+    case MPC_TYPE_ARENA:
+      mpc_undefine_unretained(p->data.arena.x, 0);
+      break;
+
+    default:
+      break;
+  }
+
+  if (!force) {
+    free(p->name);
+    free(p);
+  }
 }
 
-mpc_parser_t* mpc_apply_to(mpc_parser_t* a, mpc_apply_to_t f, void* x) {
-  mpc_parser_t* p = mpc_undefined();
-  p->type = MPC_TYPE_APPLY_TO;
-  p->data.apply_to.x = a;
-  p->data.apply_to.f = f;
-  p->data.apply_to.d = x;
-  return p;
+void mpc_delete(mpc_parser_t* p) {
+  if (p->retained) {
+
+    if (p->type != MPC_TYPE_UNDEFINED) {
+      mpc_undefine_unretained(p, 0);
+    }
+
+    free(p->name);
+    free(p);
+
+  } else {
+    mpc_undefine_unretained(p, 0);
+  }
 }
 
-mpc_parser_t* mpc_check(mpc_parser_t* a, mpc_check_t f, const char* e) {
-  mpc_parser_t* p = mpc_undefined();
-  p->type = MPC_TYPE_CHECK;
-  p->data.check.x = a;
-  p->data.check.f = f;
-  p->data.check.e = malloc(strlen(e) + 1);
-  strcpy(p->data.check.e, e);
+static void mpc_soft_delete(mpc_val_t* x) { mpc_undefine_unretained(x, 0); }
+
+static mpc_parser_t* mpc_undefined(void) {
+  mpc_parser_t* p = calloc(1, sizeof(mpc_parser_t));
+  p->retained = 0;
+  p->type = MPC_TYPE_UNDEFINED;
+  p->name = NULL;
   return p;
 }
 
-mpc_parser_t* mpc_check_with(mpc_parser_t* a, mpc_check_with_t f, void* x,
-                             const char* e) {
+mpc_parser_t* mpc_new(const char* name) {
   mpc_parser_t* p = mpc_undefined();
-  p->type = MPC_TYPE_CHECK_WITH;
-  p->data.check_with.x = a;
-  p->data.check_with.f = f;
-  p->data.check_with.d = x;
-  p->data.check_with.e = malloc(strlen(e) + 1);
-  strcpy(p->data.check_with.e, e);
+  p->retained = 1;
+  p->name = realloc(p->name, strlen(name) + 1);
+  strcpy(p->name, name);
   return p;
 }
 
-mpc_parser_t* mpc_checkf(mpc_parser_t* a, mpc_check_t f, const char* fmt, ...) {
-  va_list va;
-  char* buffer;
+mpc_parser_t* mpc_copy(mpc_parser_t* a) {
+  int i = 0;
   mpc_parser_t* p;
 
-  va_start(va, fmt);
-  buffer = malloc(2048);
-  vsprintf(buffer, fmt, va);
-  va_end(va);
+  if (a->retained) {
+    return a;
+  }
 
-  p = mpc_check(a, f, buffer);
-  free(buffer);
+  p = mpc_undefined();
+  p->retained = a->retained;
+  p->type = a->type;
+  p->data = a->data;
 
-  return p;
-}
+  if (a->name) {
+    p->name = malloc(strlen(a->name) + 1);
+    strcpy(p->name, a->name);
+  }
 
-mpc_parser_t* mpc_check_withf(mpc_parser_t* a, mpc_check_with_t f, void* x,
-                              const char* fmt, ...) {
-  va_list va;
-  char* buffer;
-  mpc_parser_t* p;
+  switch (a->type) {
 
-  va_start(va, fmt);
-  buffer = malloc(2048);
-  vsprintf(buffer, fmt, va);
-  va_end(va);
+    case MPC_TYPE_FAIL:
+      p->data.fail.m = malloc(strlen(a->data.fail.m) + 1);
+      strcpy(p->data.fail.m, a->data.fail.m);
+      break;
 
-  p = mpc_check_with(a, f, x, buffer);
-  free(buffer);
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+    case MPC_TYPE_STRING:
+      p->data.string.x = malloc(strlen(a->data.string.x) + 1);
+      strcpy(p->data.string.x, a->data.string.x);
+      break;
 
-  return p;
-}
+    case MPC_TYPE_APPLY:
+      p->data.apply.x = mpc_copy(a->data.apply.x);
+      break;
+    case MPC_TYPE_APPLY_TO:
+      p->data.apply_to.x = mpc_copy(a->data.apply_to.x);
+      break;
+    case MPC_TYPE_PREDICT:
+      p->data.predict.x = mpc_copy(a->data.predict.x);
+      break;
 
-mpc_parser_t* mpc_predictive(mpc_parser_t* a) {
-  mpc_parser_t* p = mpc_undefined();
-  p->type = MPC_TYPE_PREDICT;
-  p->data.predict.x = a;
-  return p;
-}
+    case MPC_TYPE_MAYBE:
+    case MPC_TYPE_NOT:
+      p->data.not.x = mpc_copy(a->data.not.x);
+      break;
 
-mpc_parser_t* mpc_not_lift(mpc_parser_t* a, mpc_dtor_t da, mpc_ctor_t lf) {
-  mpc_parser_t* p = mpc_undefined();
-  p->type = MPC_TYPE_NOT;
-  p->data.not.x = a;
-  p->data.not.dx = da;
-  p->data.not.lf = lf;
-  return p;
-}
+    case MPC_TYPE_EXPECT:
+      p->data.expect.x = mpc_copy(a->data.expect.x);
+      p->data.expect.m = malloc(strlen(a->data.expect.m) + 1);
+      strcpy(p->data.expect.m, a->data.expect.m);
+      break;
 
-mpc_parser_t* mpc_not(mpc_parser_t* a, mpc_dtor_t da) {
-  return mpc_not_lift(a, da, mpcf_ctor_null);
-}
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      p->data.repeat.x = mpc_copy(a->data.repeat.x);
+      break;
 
-mpc_parser_t* mpc_maybe_lift(mpc_parser_t* a, mpc_ctor_t lf) {
-  mpc_parser_t* p = mpc_undefined();
-  p->type = MPC_TYPE_MAYBE;
-  p->data.not.x = a;
-  p->data.not.lf = lf;
-  return p;
-}
+    case MPC_TYPE_OR:
+      p->data.or.xs = malloc(a->data.or.n * sizeof(mpc_parser_t*));
+      for (i = 0; i < a->data.or.n; i++) {
+        p->data.or.xs[i] = mpc_copy(a->data.or.xs[i]);
+      }
+      p->data.or.table = NULL;
+      break;
+    case MPC_TYPE_AND:
+      p->data.and.xs = malloc(a->data.and.n * sizeof(mpc_parser_t*));
+      for (i = 0; i < a->data.and.n; i++) {
+        p->data.and.xs[i] = mpc_copy(a->data.and.xs[i]);
+      }
+      p->data.and.dxs = malloc((a->data.and.n - 1) * sizeof(mpc_dtor_t));
+      for (i = 0; i < a->data.and.n - 1; i++) {
+        p->data.and.dxs[i] = a->data.and.dxs[i];
+      }
+      break;
 
-mpc_parser_t* mpc_maybe(mpc_parser_t* a) {
-  return mpc_maybe_lift(a, mpcf_ctor_null);
-}
+    case MPC_TYPE_CHECK:
+      p->data.check.x = mpc_copy(a->data.check.x);
+      p->data.check.e = malloc(strlen(a->data.check.e) + 1);
+      strcpy(p->data.check.e, a->data.check.e);
+      break;
+    case MPC_TYPE_CHECK_WITH:
+      p->data.check_with.x = mpc_copy(a->data.check_with.x);
+      p->data.check_with.e = malloc(strlen(a->data.check_with.e) + 1);
+      strcpy(p->data.check_with.e, a->data.check_with.e);
+      break;
 
-mpc_parser_t* mpc_many(mpc_fold_t f, mpc_parser_t* a) {
-  mpc_parser_t* p = mpc_undefined();
-  p->type = MPC_TYPE_MANY;
-  p->data.repeat.x = a;
-  p->data.repeat.f = f;
-  return p;
-}
+    case MPC_TYPE_MEMO:
+      p->data.memo.x = mpc_copy(a->data.memo.x);
+      break;
+
+    case MPC_TYPE_DFA:
+      p->data.dfa.d = mpc_dfa_copy(a->data.dfa.d);
+      p->data.dfa.x = mpc_copy(a->data.dfa.x);
+      break;
+
+    case MPC_TYPE_ARENA:
+      p->data.arena.x = mpc_copy(a->data.arena.x);
+      break;
+
+    default:
+      break;
+  }
 
-mpc_parser_t* mpc_many1(mpc_fold_t f, mpc_parser_t* a) {
-  mpc_parser_t* p = mpc_undefined();
-  p->type = MPC_TYPE_MANY1;
-  p->data.repeat.x = a;
-  p->data.repeat.f = f;
   return p;
 }
 
-mpc_parser_t* mpc_count(int n, mpc_fold_t f, mpc_parser_t* a, mpc_dtor_t da) {
-  mpc_parser_t* p = mpc_undefined();
-  p->type = MPC_TYPE_COUNT;
-  p->data.repeat.n = n;
-  p->data.repeat.f = f;
-  p->data.repeat.x = a;
-  p->data.repeat.dx = da;
+mpc_parser_t* mpc_undefine(mpc_parser_t* p) {
+  mpc_undefine_unretained(p, 1);
+  p->type = MPC_TYPE_UNDEFINED;
+  p->version++;
   return p;
 }
 
-mpc_parser_t* mpc_or(int n, ...) {
+mpc_parser_t* mpc_define(mpc_parser_t* p, mpc_parser_t* a) {
 
-  int i;
-  va_list va;
+  if (p->retained) {
+    p->type = a->type;
+    p->data = a->data;
+    p->version++;
+  } else {
+    mpc_parser_t* a2 = mpc_failf("Attempt to assign to Unretained Parser!");
+    p->type = a2->type;
+    p->data = a2->data;
+    free(a2);
+  }
 
-  mpc_parser_t* p = mpc_undefined();
+  free(a);
+  return p;
+}
 
-  p->type = MPC_TYPE_OR;
-  p->data.or.n = n;
-  p->data.or.xs = malloc(sizeof(mpc_parser_t*) * n);
+void mpc_cleanup(int n, ...) {
+  int i;
+  mpc_parser_t** list = malloc(sizeof(mpc_parser_t*) * n);
 
+  va_list va;
   va_start(va, n);
   for (i = 0; i < n; i++) {
-    p->data.or.xs[i] = va_arg(va, mpc_parser_t*);
+    list[i] = va_arg(va, mpc_parser_t*);
+  }
+  for (i = 0; i < n; i++) {
+    mpc_undefine(list[i]);
+  }
+  for (i = 0; i < n; i++) {
+    mpc_delete(list[i]);
   }
   va_end(va);
 
-  return p;
+  free(list);
 }
 
-mpc_parser_t* mpc_and(int n, mpc_fold_t f, ...) {
-
-  int i;
-  va_list va;
-
+mpc_parser_t* mpc_pass(void) {
   mpc_parser_t* p = mpc_undefined();
+  p->type = MPC_TYPE_PASS;
+  return p;
+}
 
-  p->type = MPC_TYPE_AND;
-  p->data.and.n = n;
-  p->data.and.f = f;
-  p->data.and.xs = malloc(sizeof(mpc_parser_t*) * n);
-  p->data.and.dxs = malloc(sizeof(mpc_dtor_t) * (n - 1));
-
-  va_start(va, f);
-  for (i = 0; i < n; i++) {
-    p->data.and.xs[i] = va_arg(va, mpc_parser_t*);
-  }
-  for (i = 0; i < (n - 1); i++) {
-    p->data.and.dxs[i] = va_arg(va, mpc_dtor_t);
-  }
-  va_end(va);
-
+mpc_parser_t* mpc_fail(const char* m) {
+  mpc_parser_t* p = mpc_undefined();
+  p->type = MPC_TYPE_FAIL;
+  p->data.fail.m = malloc(strlen(m) + 1);
+  strcpy(p->data.fail.m, m);
   return p;
 }
 
 /*
-** Common Parsers
+** As `snprintf` is not ANSI standard this
+** function `mpc_failf` should be considered
+** unsafe.
+**
+** You have a few options if this is going to be
+** trouble.
+**
+** - Ensure the format string does not exceed
+**   the buffer length using precision specifiers
+**   such as `%.512s`.
+**
+** - Patch this function in your code base to
+**   use `snprintf` or whatever variant your
+**   system supports.
+**
+** - Avoid it altogether.
+**
 */
 
-mpc_parser_t* mpc_soi(void) {
+mpc_parser_t* mpc_failf(const char* fmt, ...) {
+
+  va_list va;
+  char* buffer;
+
   mpc_parser_t* p = mpc_undefined();
-  p->type = MPC_TYPE_SOI;
-  return mpc_expect(p, "start of input");
+  p->type = MPC_TYPE_FAIL;
+
+  va_start(va, fmt);
+  buffer = malloc(2048);
+  vsprintf(buffer, fmt, va);
+  va_end(va);
+
+  buffer = realloc(buffer, strlen(buffer) + 1);
+  p->data.fail.m = buffer;
+  return p;
 }
 
-mpc_parser_t* mpc_eoi(void) {
+mpc_parser_t* mpc_lift_val(mpc_val_t* x) {
   mpc_parser_t* p = mpc_undefined();
-  p->type = MPC_TYPE_EOI;
-  return mpc_expect(p, "end of input");
+  p->type = MPC_TYPE_LIFT_VAL;
+  p->data.lift.x = x;
+  return p;
 }
 
-static int mpc_boundary_anchor(char prev, char next) {
-  const char* word = "abcdefghijklmnopqrstuvwxyz"
-                     "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-                     "0123456789_";
-  if (strchr(word, next) && prev == '\0') {
-    return 1;
-  }
-  if (strchr(word, prev) && next == '\0') {
-    return 1;
-  }
-  if (strchr(word, next) && !strchr(word, prev)) {
-    return 1;
-  }
-  if (!strchr(word, next) && strchr(word, prev)) {
-    return 1;
-  }
-  return 0;
+mpc_parser_t* mpc_lift(mpc_ctor_t lf) {
+  mpc_parser_t* p = mpc_undefined();
+  p->type = MPC_TYPE_LIFT;
+  p->data.lift.lf = lf;
+  return p;
 }
 
-static int mpc_boundary_newline_anchor(char prev, char next) {
-  (void)next;
-  return prev == '\n';
+mpc_parser_t* mpc_anchor(int (*f)(char, char)) {
+  mpc_parser_t* p = mpc_undefined();
+  p->type = MPC_TYPE_ANCHOR;
+  p->data.anchor.f = f;
+  return mpc_expect(p, "anchor");
 }
 
-mpc_parser_t* mpc_boundary(void) {
-  return mpc_expect(mpc_anchor(mpc_boundary_anchor), "word boundary");
-}
-mpc_parser_t* mpc_boundary_newline(void) {
-  return mpc_expect(mpc_anchor(mpc_boundary_newline_anchor),
-                    "start of newline");
+mpc_parser_t* mpc_state(void) {
+  mpc_parser_t* p = mpc_undefined();
+  p->type = MPC_TYPE_STATE;
+  return p;
 }
 
-mpc_parser_t* mpc_whitespace(void) {
-  return mpc_expect(mpc_oneof(" \f\n\r\t\v"), "whitespace");
-}
-mpc_parser_t* mpc_whitespaces(void) {
-  return mpc_expect(mpc_many(mpcf_strfold, mpc_whitespace()), "spaces");
+mpc_parser_t* mpc_expect(mpc_parser_t* a, const char* expected) {
+  mpc_parser_t* p = mpc_undefined();
+  p->type = MPC_TYPE_EXPECT;
+  p->data.expect.x = a;
+  p->data.expect.m = malloc(strlen(expected) + 1);
+  strcpy(p->data.expect.m, expected);
+  return p;
 }
-mpc_parser_t* mpc_blank(void) {
-  return mpc_expect(mpc_apply(mpc_whitespaces(), mpcf_free), "whitespace");
+
+/*
+** As `snprintf` is not ANSI standard this
+** function `mpc_expectf` should be considered
+** unsafe.
+**
+** You have a few options if this is going to be
+** trouble.
+**
+** - Ensure the format string does not exceed
+**   the buffer length using precision specifiers
+**   such as `%.512s`.
+**
+** - Patch this function in your code base to
+**   use `snprintf` or whatever variant your
+**   system supports.
+**
+** - Avoid it altogether.
+**
+*/
+
+mpc_parser_t* mpc_expectf(mpc_parser_t* a, const char* fmt, ...) {
+  va_list va;
+  char* buffer;
+
+  mpc_parser_t* p = mpc_undefined();
+  p->type = MPC_TYPE_EXPECT;
+
+  va_start(va, fmt);
+  buffer = malloc(2048);
+  vsprintf(buffer, fmt, va);
+  va_end(va);
+
+  buffer = realloc(buffer, strlen(buffer) + 1);
+  p->data.expect.x = a;
+  p->data.expect.m = buffer;
+  return p;
 }
 
-mpc_parser_t* mpc_newline(void) {
-  return mpc_expect(mpc_char('\n'), "newline");
+/*
+** Basic Parsers
+*/
+
+mpc_parser_t* mpc_any(void) {
+  mpc_parser_t* p = mpc_undefined();
+  p->type = MPC_TYPE_ANY;
+  return mpc_expect(p, "any character");
 }
-mpc_parser_t* mpc_tab(void) { return mpc_expect(mpc_char('\t'), "tab"); }
-mpc_parser_t* mpc_escape(void) {
-  return mpc_and(2, mpcf_strfold, mpc_char('\\'), mpc_any(), free);
+
+mpc_parser_t* mpc_char(char c) {
+  mpc_parser_t* p = mpc_undefined();
+  p->type = MPC_TYPE_SINGLE;
+  p->data.single.x = c;
+  return mpc_expectf(p, "'%c'", c);
 }
 
-mpc_parser_t* mpc_digit(void) {
-  return mpc_expect(mpc_oneof("0123456789"), "digit");
+mpc_parser_t* mpc_range(char s, char e) {
+  mpc_parser_t* p = mpc_undefined();
+  p->type = MPC_TYPE_RANGE;
+  p->data.range.x = s;
+  p->data.range.y = e;
+  return mpc_expectf(p, "character between '%c' and '%c'", s, e);
 }
-mpc_parser_t* mpc_hexdigit(void) {
-  return mpc_expect(mpc_oneof("0123456789ABCDEFabcdef"), "hex digit");
+
+mpc_parser_t* mpc_oneof(const char* s) {
+  mpc_parser_t* p = mpc_undefined();
+  p->type = MPC_TYPE_ONEOF;
+  p->data.string.x = malloc(strlen(s) + 1);
+  strcpy(p->data.string.x, s);
+  return mpc_expectf(p, "one of '%s'", s);
 }
-mpc_parser_t* mpc_octdigit(void) {
-  return mpc_expect(mpc_oneof("01234567"), "oct digit");
+
+mpc_parser_t* mpc_noneof(const char* s) {
+  mpc_parser_t* p = mpc_undefined();
+  p->type = MPC_TYPE_NONEOF;
+  p->data.string.x = malloc(strlen(s) + 1);
+  strcpy(p->data.string.x, s);
+  return mpc_expectf(p, "none of '%s'", s);
 }
-mpc_parser_t* mpc_digits(void) {
-  return mpc_expect(mpc_many1(mpcf_strfold, mpc_digit()), "digits");
+
+mpc_parser_t* mpc_satisfy(int (*f)(char)) {
+  mpc_parser_t* p = mpc_undefined();
+  p->type = MPC_TYPE_SATISFY;
+  p->data.satisfy.f = f;
+  return mpc_expectf(p, "character satisfying function %p", f);
 }
-mpc_parser_t* mpc_hexdigits(void) {
-  return mpc_expect(mpc_many1(mpcf_strfold, mpc_hexdigit()), "hex digits");
+
+mpc_parser_t* mpc_string(const char* s) {
+  mpc_parser_t* p = mpc_undefined();
+  p->type = MPC_TYPE_STRING;
+  p->data.string.x = malloc(strlen(s) + 1);
+  strcpy(p->data.string.x, s);
+  return mpc_expectf(p, "\"%s\"", s);
 }
-mpc_parser_t* mpc_octdigits(void) {
-  return mpc_expect(mpc_many1(mpcf_strfold, mpc_octdigit()), "oct digits");
+
+/*
+** Core Parsers
+*/
+
+mpc_parser_t* mpc_apply(mpc_parser_t* a, mpc_apply_t f) {
+  mpc_parser_t* p = mpc_undefined();
+  p->type = MPC_TYPE_APPLY;
+  p->data.apply.x = a;
+  p->data.apply.f = f;
+  return p;
 }
 
-mpc_parser_t* mpc_lower(void) {
-  return mpc_expect(mpc_oneof("abcdefghijklmnopqrstuvwxyz"),
-                    "lowercase letter");
+mpc_parser_t* mpc_apply_to(mpc_parser_t* a, mpc_apply_to_t f, void* x) {
+  mpc_parser_t* p = mpc_undefined();
+  p->type = MPC_TYPE_APPLY_TO;
+  p->data.apply_to.x = a;
+  p->data.apply_to.f = f;
+  p->data.apply_to.d = x;
+  return p;
 }
-mpc_parser_t* mpc_upper(void) {
-  return mpc_expect(mpc_oneof("ABCDEFGHIJKLMNOPQRSTUVWXYZ"),
-                    "uppercase letter");
+
+mpc_parser_t* mpc_check(mpc_parser_t* a, mpc_check_t f, const char* e) {
+  mpc_parser_t* p = mpc_undefined();
+  p->type = MPC_TYPE_CHECK;
+  p->data.check.x = a;
+  p->data.check.f = f;
+  p->data.check.e = malloc(strlen(e) + 1);
+  strcpy(p->data.check.e, e);
+  return p;
 }
-mpc_parser_t* mpc_alpha(void) {
-  return mpc_expect(
-      mpc_oneof("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"),
+
+mpc_parser_t* mpc_check_with(mpc_parser_t* a, mpc_check_with_t f, void* x,
+                             const char* e) {
+  mpc_parser_t* p = mpc_undefined();
+  p->type = MPC_TYPE_CHECK_WITH;
+  p->data.check_with.x = a;
+  p->data.check_with.f = f;
+  p->data.check_with.d = x;
+  p->data.check_with.e = malloc(strlen(e) + 1);
+  strcpy(p->data.check_with.e, e);
+  return p;
+}
+
+mpc_parser_t* mpc_checkf(mpc_parser_t* a, mpc_check_t f, const char* fmt, ...) {
+  va_list va;
+  char* buffer;
+  mpc_parser_t* p;
+
+  va_start(va, fmt);
+  buffer = malloc(2048);
+  vsprintf(buffer, fmt, va);
+  va_end(va);
+
+  p = mpc_check(a, f, buffer);
+  free(buffer);
+
+  return p;
+}
+
+mpc_parser_t* mpc_check_withf(mpc_parser_t* a, mpc_check_with_t f, void* x,
+                              const char* fmt, ...) {
+  va_list va;
+  char* buffer;
+  mpc_parser_t* p;
+
+  va_start(va, fmt);
+  buffer = malloc(2048);
+  vsprintf(buffer, fmt, va);
+  va_end(va);
+
+  p = mpc_check_with(a, f, x, buffer);
+  free(buffer);
+
+  return p;
+}
+
+mpc_parser_t* mpc_predictive(mpc_parser_t* a) {
+  mpc_parser_t* p = mpc_undefined();
+  p->type = MPC_TYPE_PREDICT;
+  p->data.predict.x = a;
+  return p;
+}
+
+mpc_parser_t* mpc_memo(mpc_parser_t* a, mpc_dup_t c, mpc_dtor_t da) {
+  mpc_parser_t* p = mpc_undefined();
+  p->type = MPC_TYPE_MEMO;
+  p->data.memo.x = a;
+  p->data.memo.c = c;
+  p->data.memo.dx = da;
+  return p;
+}
+
+mpc_parser_t* mpc_not_lift(mpc_parser_t* a, mpc_dtor_t da, mpc_ctor_t lf) {
+  mpc_parser_t* p = mpc_undefined();
+  p->type = MPC_TYPE_NOT;
+  p->data.not.x = a;
+  p->data.not.dx = da;
+  p->data.not.lf = lf;
+  return p;
+}
+
+mpc_parser_t* mpc_not(mpc_parser_t* a, mpc_dtor_t da) {
+  return mpc_not_lift(a, da, mpcf_ctor_null);
+}
+
+mpc_parser_t* mpc_maybe_lift(mpc_parser_t* a, mpc_ctor_t lf) {
+  mpc_parser_t* p = mpc_undefined();
+  p->type = MPC_TYPE_MAYBE;
+  p->data.not.x = a;
+  p->data.not.lf = lf;
+  return p;
+}
+
+mpc_parser_t* mpc_maybe(mpc_parser_t* a) {
+  return mpc_maybe_lift(a, mpcf_ctor_null);
+}
+
+mpc_parser_t* mpc_many(mpc_fold_t f, mpc_parser_t* a) {
+  mpc_parser_t* p = mpc_undefined();
+  p->type = MPC_TYPE_MANY;
+  p->data.repeat.x = a;
+  p->data.repeat.f = f;
+  return p;
+}
+
+mpc_parser_t* mpc_many1(mpc_fold_t f, mpc_parser_t* a) {
+  mpc_parser_t* p = mpc_undefined();
+  p->type = MPC_TYPE_MANY1;
+  p->data.repeat.x = a;
+  p->data.repeat.f = f;
+  return p;
+}
+
+mpc_parser_t* mpc_count(int n, mpc_fold_t f, mpc_parser_t* a, mpc_dtor_t da) {
+  mpc_parser_t* p = mpc_undefined();
+  p->type = MPC_TYPE_COUNT;
+  p->data.repeat.n = n;
+  p->data.repeat.f = f;
+  p->data.repeat.x = a;
+  p->data.repeat.dx = da;
+  return p;
+}
+
+mpc_parser_t* mpc_or(int n, ...) {
+
+  int i;
+  va_list va;
+
+  mpc_parser_t* p = mpc_undefined();
+
+  p->type = MPC_TYPE_OR;
+  p->data.or.n = n;
+  p->data.or.xs = malloc(sizeof(mpc_parser_t*) * n);
+
+  va_start(va, n);
+  for (i = 0; i < n; i++) {
+    p->data.or.xs[i] = va_arg(va, mpc_parser_t*);
+  }
+  va_end(va);
+
+  return p;
+}
+
+mpc_parser_t* mpc_and(int n, mpc_fold_t f, ...) {
+
+  int i;
+  va_list va;
+
+  mpc_parser_t* p = mpc_undefined();
+
+  p->type = MPC_TYPE_AND;
+  p->data.and.n = n;
+  p->data.and.f = f;
+  p->data.and.xs = malloc(sizeof(mpc_parser_t*) * n);
+  p->data.and.dxs = malloc(sizeof(mpc_dtor_t) * (n - 1));
+
+  va_start(va, f);
+  for (i = 0; i < n; i++) {
+    p->data.and.xs[i] = va_arg(va, mpc_parser_t*);
+  }
+  for (i = 0; i < (n - 1); i++) {
+    p->data.and.dxs[i] = va_arg(va, mpc_dtor_t);
+  }
+  va_end(va);
+
+  return p;
+}
+
+/*
+** Common Parsers
+*/
+
+mpc_parser_t* mpc_soi(void) {
+  mpc_parser_t* p = mpc_undefined();
+  p->type = MPC_TYPE_SOI;
+  return mpc_expect(p, "start of input");
+}
+
+mpc_parser_t* mpc_eoi(void) {
+  mpc_parser_t* p = mpc_undefined();
+  p->type = MPC_TYPE_EOI;
+  return mpc_expect(p, "end of input");
+}
+
+static int mpc_boundary_anchor(char prev, char next) {
+  const char* word = "abcdefghijklmnopqrstuvwxyz"
+                     "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                     "0123456789_";
+  if (strchr(word, next) && prev == '\0') {
+    return 1;
+  }
+  if (strchr(word, prev) && next == '\0') {
+    return 1;
+  }
+  if (strchr(word, next) && !strchr(word, prev)) {
+    return 1;
+  }
+  if (!strchr(word, next) && strchr(word, prev)) {
+    return 1;
+  }
+  return 0;
+}
+
+static int mpc_boundary_newline_anchor(char prev, char next) {
+  (void)next;
+  return prev == '\n';
+}
+
+mpc_parser_t* mpc_boundary(void) {
+  return mpc_expect(mpc_anchor(mpc_boundary_anchor), "word boundary");
+}
+mpc_parser_t* mpc_boundary_newline(void) {
+  return mpc_expect(mpc_anchor(mpc_boundary_newline_anchor),
+                    "start of newline");
+}
+
+mpc_parser_t* mpc_whitespace(void) {
+  return mpc_expect(mpc_oneof(" \f\n\r\t\v"), "whitespace");
+}
+mpc_parser_t* mpc_whitespaces(void) {
+  return mpc_expect(mpc_many(mpcf_strfold, mpc_whitespace()), "spaces");
+}
+mpc_parser_t* mpc_blank(void) {
+  return mpc_expect(mpc_apply(mpc_whitespaces(), mpcf_free), "whitespace");
+}
+
+mpc_parser_t* mpc_newline(void) {
+  return mpc_expect(mpc_char('\n'), "newline");
+}
+mpc_parser_t* mpc_tab(void) { return mpc_expect(mpc_char('\t'), "tab"); }
+mpc_parser_t* mpc_escape(void) {
+  return mpc_and(2, mpcf_strfold, mpc_char('\\'), mpc_any(), free);
+}
+
+mpc_parser_t* mpc_digit(void) {
+  return mpc_expect(mpc_oneof("0123456789"), "digit");
+}
+mpc_parser_t* mpc_hexdigit(void) {
+  return mpc_expect(mpc_oneof("0123456789ABCDEFabcdef"), "hex digit");
+}
+mpc_parser_t* mpc_octdigit(void) {
+  return mpc_expect(mpc_oneof("01234567"), "oct digit");
+}
+mpc_parser_t* mpc_digits(void) {
+  return mpc_expect(mpc_many1(mpcf_strfold, mpc_digit()), "digits");
+}
+mpc_parser_t* mpc_hexdigits(void) {
+  return mpc_expect(mpc_many1(mpcf_strfold, mpc_hexdigit()), "hex digits");
+}
+mpc_parser_t* mpc_octdigits(void) {
+  return mpc_expect(mpc_many1(mpcf_strfold, mpc_octdigit()), "oct digits");
+}
+
+mpc_parser_t* mpc_lower(void) {
+  return mpc_expect(mpc_oneof("abcdefghijklmnopqrstuvwxyz"),
+                    "lowercase letter");
+}
+mpc_parser_t* mpc_upper(void) {
+  return mpc_expect(mpc_oneof("ABCDEFGHIJKLMNOPQRSTUVWXYZ"),
+                    "uppercase letter");
+}
+mpc_parser_t* mpc_alpha(void) {
+  return mpc_expect(
+      mpc_oneof("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"),
       "letter");
 }
 mpc_parser_t* mpc_underscore(void) {
@@ -2320,424 +3517,1195 @@ mpc_parser_t* mpc_alphanum(void) {
                     "alphanumeric");
 }
 
-mpc_parser_t* mpc_int(void) {
-  return mpc_expect(mpc_apply(mpc_digits(), mpcf_int), "integer");
-}
-mpc_parser_t* mpc_hex(void) {
-  return mpc_expect(mpc_apply(mpc_hexdigits(), mpcf_hex), "hexadecimal");
-}
-mpc_parser_t* mpc_oct(void) {
-  return mpc_expect(mpc_apply(mpc_octdigits(), mpcf_oct), "octadecimal");
-}
-mpc_parser_t* mpc_number(void) {
-  return mpc_expect(mpc_or(3, mpc_int(), mpc_hex(), mpc_oct()), "number");
+mpc_parser_t* mpc_int(void) {
+  return mpc_expect(mpc_apply(mpc_digits(), mpcf_int), "integer");
+}
+mpc_parser_t* mpc_hex(void) {
+  return mpc_expect(mpc_apply(mpc_hexdigits(), mpcf_hex), "hexadecimal");
+}
+mpc_parser_t* mpc_oct(void) {
+  return mpc_expect(mpc_apply(mpc_octdigits(), mpcf_oct), "octadecimal");
+}
+mpc_parser_t* mpc_number(void) {
+  return mpc_expect(mpc_or(3, mpc_int(), mpc_hex(), mpc_oct()), "number");
+}
+
+mpc_parser_t* mpc_real(void) {
+
+  /* [+-]?\d+(\.\d+)?([eE][+-]?[0-9]+)? */
+
+  mpc_parser_t *p0, *p1, *p2, *p30, *p31, *p32, *p3;
+
+  p0 = mpc_maybe_lift(mpc_oneof("+-"), mpcf_ctor_str);
+  p1 = mpc_digits();
+  p2 = mpc_maybe_lift(
+      mpc_and(2, mpcf_strfold, mpc_char('.'), mpc_digits(), free),
+      mpcf_ctor_str);
+  p30 = mpc_oneof("eE");
+  p31 = mpc_maybe_lift(mpc_oneof("+-"), mpcf_ctor_str);
+  p32 = mpc_digits();
+  p3 = mpc_maybe_lift(mpc_and(3, mpcf_strfold, p30, p31, p32, free, free),
+                      mpcf_ctor_str);
+
+  return mpc_expect(mpc_and(4, mpcf_strfold, p0, p1, p2, p3, free, free, free),
+                    "real");
+}
+
+mpc_parser_t* mpc_float(void) {
+  return mpc_expect(mpc_apply(mpc_real(), mpcf_float), "float");
+}
+
+mpc_parser_t* mpc_char_lit(void) {
+  return mpc_expect(
+      mpc_between(mpc_or(2, mpc_escape(), mpc_any()), free, "'", "'"), "char");
+}
+
+mpc_parser_t* mpc_string_lit(void) {
+  mpc_parser_t* strchar = mpc_or(2, mpc_escape(), mpc_noneof("\""));
+  return mpc_expect(
+      mpc_between(mpc_many(mpcf_strfold, strchar), free, "\"", "\""), "string");
+}
+
+mpc_parser_t* mpc_regex_lit(void) {
+  mpc_parser_t* regexchar = mpc_or(2, mpc_escape(), mpc_noneof("/"));
+  return mpc_expect(
+      mpc_between(mpc_many(mpcf_strfold, regexchar), free, "/", "/"), "regex");
+}
+
+mpc_parser_t* mpc_ident(void) {
+  mpc_parser_t *p0, *p1;
+  p0 = mpc_or(2, mpc_alpha(), mpc_underscore());
+  p1 = mpc_many(mpcf_strfold, mpc_alphanum());
+  return mpc_and(2, mpcf_strfold, p0, p1, free);
+}
+
+/*
+** Useful Parsers
+*/
+
+mpc_parser_t* mpc_startwith(mpc_parser_t* a) {
+  return mpc_and(2, mpcf_snd, mpc_soi(), a, mpcf_dtor_null);
+}
+mpc_parser_t* mpc_endwith(mpc_parser_t* a, mpc_dtor_t da) {
+  return mpc_and(2, mpcf_fst, a, mpc_eoi(), da);
+}
+mpc_parser_t* mpc_whole(mpc_parser_t* a, mpc_dtor_t da) {
+  return mpc_and(3, mpcf_snd, mpc_soi(), a, mpc_eoi(), mpcf_dtor_null, da);
+}
+
+mpc_parser_t* mpc_stripl(mpc_parser_t* a) {
+  return mpc_and(2, mpcf_snd, mpc_blank(), a, mpcf_dtor_null);
+}
+mpc_parser_t* mpc_stripr(mpc_parser_t* a) {
+  return mpc_and(2, mpcf_fst, a, mpc_blank(), mpcf_dtor_null);
+}
+mpc_parser_t* mpc_strip(mpc_parser_t* a) {
+  return mpc_and(3, mpcf_snd, mpc_blank(), a, mpc_blank(), mpcf_dtor_null,
+                 mpcf_dtor_null);
+}
+mpc_parser_t* mpc_tok(mpc_parser_t* a) {
+  return mpc_and(2, mpcf_fst, a, mpc_blank(), mpcf_dtor_null);
+}
+mpc_parser_t* mpc_sym(const char* s) { return mpc_tok(mpc_string(s)); }
+
+mpc_parser_t* mpc_total(mpc_parser_t* a, mpc_dtor_t da) {
+  return mpc_whole(mpc_strip(a), da);
+}
+
+mpc_parser_t* mpc_between(mpc_parser_t* a, mpc_dtor_t ad, const char* o,
+                          const char* c) {
+  return mpc_and(3, mpcf_snd_free, mpc_string(o), a, mpc_string(c), free, ad);
+}
+
+mpc_parser_t* mpc_parens(mpc_parser_t* a, mpc_dtor_t ad) {
+  return mpc_between(a, ad, "(", ")");
+}
+mpc_parser_t* mpc_braces(mpc_parser_t* a, mpc_dtor_t ad) {
+  return mpc_between(a, ad, "<", ">");
+}
+mpc_parser_t* mpc_brackets(mpc_parser_t* a, mpc_dtor_t ad) {
+  return mpc_between(a, ad, "{", "}");
+}
+mpc_parser_t* mpc_squares(mpc_parser_t* a, mpc_dtor_t ad) {
+  return mpc_between(a, ad, "[", "]");
+}
+
+mpc_parser_t* mpc_tok_between(mpc_parser_t* a, mpc_dtor_t ad, const char* o,
+                              const char* c) {
+  return mpc_and(3, mpcf_snd_free, mpc_sym(o), mpc_tok(a), mpc_sym(c), free,
+                 ad);
+}
+
+mpc_parser_t* mpc_tok_parens(mpc_parser_t* a, mpc_dtor_t ad) {
+  return mpc_tok_between(a, ad, "(", ")");
+}
+mpc_parser_t* mpc_tok_braces(mpc_parser_t* a, mpc_dtor_t ad) {
+  return mpc_tok_between(a, ad, "<", ">");
+}
+mpc_parser_t* mpc_tok_brackets(mpc_parser_t* a, mpc_dtor_t ad) {
+  return mpc_tok_between(a, ad, "{", "}");
+}
+mpc_parser_t* mpc_tok_squares(mpc_parser_t* a, mpc_dtor_t ad) {
+  return mpc_tok_between(a, ad, "[", "]");
+}
+
+/*
+** Regular Expression Parsers
+*/
+
+/*
+** So here is a cute bootstrapping.
+**
+** I'm using the previously defined
+** mpc constructs and functions to
+** parse the user regex string and
+** construct a parser from it.
+**
+** As it turns out lots of the standard
+** mpc functions look a lot like `fold`
+** functions and so can be used indirectly
+** by many of the parsing functions to build
+** a parser directly - as we are parsing.
+**
+** This is certainly something that
+** would be less elegant/interesting
+** in a two-phase parser which first
+** builds an AST and then traverses it
+** to generate the object.
+**
+** This whole thing acts as a great
+** case study for how trivial it can be
+** to write a great parser in a few
+** lines of code using mpc.
+*/
+
+/*
+**
+**  ### Regular Expression Grammar
+**
+**      <regex> : <term> | (<term> "|" <regex>)
+**
+**      <term> : <factor>*
+**
+**      <factor> : <base>
+**               | <base> "*"
+**               | <base> "+"
+**               | <base> "?"
+**               | <base> "{" <digits> "}"
+**
+**      <base> : <char>
+**             | "\" <char>
+**             | "(" <regex> ")"
+**             | "[" <range> "]"
+*/
+
+static mpc_val_t* mpcf_re_or(int n, mpc_val_t** xs) {
+  (void)n;
+  if (xs[1] == NULL) {
+    return xs[0];
+  } else {
+    return mpc_or(2, xs[0], xs[1]);
+  }
+}
+
+static mpc_val_t* mpcf_re_and(int n, mpc_val_t** xs) {
+  int i;
+  mpc_parser_t* p = mpc_lift(mpcf_ctor_str);
+  for (i = 0; i < n; i++) {
+    p = mpc_and(2, mpcf_strfold, p, xs[i], free);
+  }
+  return p;
+}
+
+static mpc_val_t* mpcf_re_repeat(int n, mpc_val_t** xs) {
+  int num;
+  (void)n;
+  if (xs[1] == NULL) {
+    return xs[0];
+  }
+  switch (((char*)xs[1])[0]) {
+    case '*': {
+      free(xs[1]);
+      return mpc_many(mpcf_strfold, xs[0]);
+    }; break;
+    case '+': {
+      free(xs[1]);
+      return mpc_many1(mpcf_strfold, xs[0]);
+    }; break;
+    case '?': {
+      free(xs[1]);
+      return mpc_maybe_lift(xs[0], mpcf_ctor_str);
+    }; break;
+    default:
+      num = *(int*)xs[1];
+      free(xs[1]);
+  }
+
+  return mpc_count(num, mpcf_strfold, xs[0], free);
+}
+
+static mpc_parser_t* mpc_re_escape_char(char c) {
+  switch (c) {
+    case 'a':
+      return mpc_char('\a');
+    case 'f':
+      return mpc_char('\f');
+    case 'n':
+      return mpc_char('\n');
+    case 'r':
+      return mpc_char('\r');
+    case 't':
+      return mpc_char('\t');
+    case 'v':
+      return mpc_char('\v');
+    case 'b':
+      return mpc_and(2, mpcf_snd, mpc_boundary(), mpc_lift(mpcf_ctor_str),
+                     free);
+    case 'B':
+      return mpc_not_lift(mpc_boundary(), free, mpcf_ctor_str);
+    case 'A':
+      return mpc_and(2, mpcf_snd, mpc_soi(), mpc_lift(mpcf_ctor_str), free);
+    case 'Z':
+      return mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free);
+    case 'd':
+      return mpc_digit();
+    case 'D':
+      return mpc_not_lift(mpc_digit(), free, mpcf_ctor_str);
+    case 's':
+      return mpc_whitespace();
+    case 'S':
+      return mpc_not_lift(mpc_whitespace(), free, mpcf_ctor_str);
+    case 'w':
+      return mpc_alphanum();
+    case 'W':
+      return mpc_not_lift(mpc_alphanum(), free, mpcf_ctor_str);
+    default:
+      return NULL;
+  }
+}
+
+static mpc_val_t* mpcf_re_escape(mpc_val_t* x, void* data) {
+
+  int mode = *((int*)data);
+  char* s = x;
+  mpc_parser_t* p;
+
+  /* Any Character */
+  if (s[0] == '.') {
+    free(s);
+    if (mode & MPC_RE_DOTALL) {
+      return mpc_any();
+    } else {
+      return mpc_expect(mpc_noneof("\n"), "any character except a newline");
+    }
+  }
+
+  /* Start of Input */
+  if (s[0] == '^') {
+    free(s);
+    if (mode & MPC_RE_MULTILINE) {
+      return mpc_and(2, mpcf_snd, mpc_or(2, mpc_soi(), mpc_boundary_newline()),
+                     mpc_lift(mpcf_ctor_str), free);
+    } else {
+      return mpc_and(2, mpcf_snd, mpc_soi(), mpc_lift(mpcf_ctor_str), free);
+    }
+  }
+
+  /* End of Input */
+  if (s[0] == '$') {
+    free(s);
+    if (mode & MPC_RE_MULTILINE) {
+      return mpc_or(
+          2, mpc_newline(),
+          mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free));
+    } else {
+      return mpc_or(
+          2, mpc_and(2, mpcf_fst, mpc_newline(), mpc_eoi(), free),
+          mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free));
+    }
+  }
+
+  /* Regex Escape */
+  if (s[0] == '\\') {
+    p = mpc_re_escape_char(s[1]);
+    p = (p == NULL) ? mpc_char(s[1]) : p;
+    free(s);
+    return p;
+  }
+
+  /* Regex Standard */
+  p = mpc_char(s[0]);
+  free(s);
+  return p;
+}
+
+static const char* mpc_re_range_escape_char(char c) {
+  switch (c) {
+    case '-':
+      return "-";
+    case 'a':
+      return "\a";
+    case 'f':
+      return "\f";
+    case 'n':
+      return "\n";
+    case 'r':
+      return "\r";
+    case 't':
+      return "\t";
+    case 'v':
+      return "\v";
+    case 'b':
+      return "\b";
+    case 'd':
+      return "0123456789";
+    case 's':
+      return " \f\n\r\t\v";
+    case 'w':
+      return "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_";
+    default:
+      return NULL;
+  }
+}
+
+static char* mpc_re_range_chars(const char* s) {
+
+  size_t i, j;
+  size_t start, end;
+  const char* tmp = NULL;
+  int comp = s[0] == '^' ? 1 : 0;
+  char* range = calloc(1, 1);
+
+  for (i = comp; i < strlen(s); i++) {
+
+    /* Regex Range Escape */
+    if (s[i] == '\\') {
+      tmp = mpc_re_range_escape_char(s[i + 1]);
+      if (tmp != NULL) {
+        range = realloc(range, strlen(range) + strlen(tmp) + 1);
+        strcat(range, tmp);
+      } else {
+        range = realloc(range, strlen(range) + 1 + 1);
+        range[strlen(range) + 1] = '\0';
+        range[strlen(range) + 0] = s[i + 1];
+      }
+      i++;
+    }
+
+    /* Regex Range...Range */
+    else if (s[i] == '-') {
+      if (s[i + 1] == '\0' || i == 0) {
+        range = realloc(range, strlen(range) + strlen("-") + 1);
+        strcat(range, "-");
+      } else {
+        start = s[i - 1] + 1;
+        end = s[i + 1] - 1;
+        for (j = start; j <= end; j++) {
+          range = realloc(range, strlen(range) + 1 + 1 + 1);
+          range[strlen(range) + 1] = '\0';
+          range[strlen(range) + 0] = (char)j;
+        }
+      }
+    }
+
+    /* Regex Range Normal */
+    else {
+      range = realloc(range, strlen(range) + 1 + 1);
+      range[strlen(range) + 1] = '\0';
+      range[strlen(range) + 0] = s[i];
+    }
+  }
+
+  return range;
 }
 
-mpc_parser_t* mpc_real(void) {
+static mpc_val_t* mpcf_re_range(mpc_val_t* x) {
 
-  /* [+-]?\d+(\.\d+)?([eE][+-]?[0-9]+)? */
+  mpc_parser_t* out;
+  const char* s = x;
+  char* range;
 
-  mpc_parser_t *p0, *p1, *p2, *p30, *p31, *p32, *p3;
+  if (s[0] == '\0') {
+    free(x);
+    return mpc_fail("Invalid Regex Range Expression");
+  }
+  if (s[0] == '^' && s[1] == '\0') {
+    free(x);
+    return mpc_fail("Invalid Regex Range Expression");
+  }
 
-  p0 = mpc_maybe_lift(mpc_oneof("+-"), mpcf_ctor_str);
-  p1 = mpc_digits();
-  p2 = mpc_maybe_lift(
-      mpc_and(2, mpcf_strfold, mpc_char('.'), mpc_digits(), free),
-      mpcf_ctor_str);
-  p30 = mpc_oneof("eE");
-  p31 = mpc_maybe_lift(mpc_oneof("+-"), mpcf_ctor_str);
-  p32 = mpc_digits();
-  p3 = mpc_maybe_lift(mpc_and(3, mpcf_strfold, p30, p31, p32, free, free),
-                      mpcf_ctor_str);
+  range = mpc_re_range_chars(s);
+  out = s[0] == '^' ? mpc_noneof(range) : mpc_oneof(range);
 
-  return mpc_expect(mpc_and(4, mpcf_strfold, p0, p1, p2, p3, free, free, free),
-                    "real");
+  free(x);
+  free(range);
+
+  return out;
 }
 
-mpc_parser_t* mpc_float(void) {
-  return mpc_expect(mpc_apply(mpc_real(), mpcf_float), "float");
+/*
+** Regex DFA Compiler
+**
+** Alongside its combinators a regex is compiled to
+** a DFA where that gives the same results. It does
+** whenever backtracking is never needed: once a `|`,
+** `?` or `*` has taken its first choice and consumed
+** input, the choice it would fall back to must have
+** failed already or be unable to matter. Anchors,
+** negated escapes and regexes needing more than
+** MPC_DFA_STATES_MAX states keep their combinators.
+**
+** Each piece of the regex becomes a fragment of the
+** table, built bottom up as it is read.
+*/
+
+enum { MPC_DFA_STATES_MAX = 256 };
+
+typedef struct {
+  int start;
+  int num;
+  mpc_dfa_edge_t* edges;
+} mpc_dfa_frag_t;
+
+typedef struct {
+  const char* s;
+  int mode;
+  char** labels;
+  int labels_num;
+  int** lists;
+  int lists_num;
+} mpc_dfa_compiler_t;
+
+static int mpc_dfa_list(mpc_dfa_compiler_t* c, const int* ids, int n) {
+  int j;
+  for (j = 0; j < c->lists_num; j++) {
+    if (c->lists[j][0] == n &&
+        (n == 0 || memcmp(c->lists[j] + 1, ids, sizeof(int) * n) == 0)) {
+      return j;
+    }
+  }
+  c->lists = realloc(c->lists, sizeof(int*) * (c->lists_num + 1));
+  c->lists[c->lists_num] = malloc(sizeof(int) * (n + 1));
+  c->lists[c->lists_num][0] = n;
+  if (n > 0) {
+    memcpy(c->lists[c->lists_num] + 1, ids, sizeof(int) * n);
+  }
+  return c->lists_num++;
 }
 
-mpc_parser_t* mpc_char_lit(void) {
-  return mpc_expect(
-      mpc_between(mpc_or(2, mpc_escape(), mpc_any()), free, "'", "'"), "char");
+static int mpc_dfa_label(mpc_dfa_compiler_t* c, const char* label) {
+  int j;
+  for (j = 0; j < c->labels_num; j++) {
+    if (strcmp(c->labels[j], label) == 0) {
+      break;
+    }
+  }
+  if (j == c->labels_num) {
+    c->labels = realloc(c->labels, sizeof(char*) * (c->labels_num + 1));
+    c->labels[j] = malloc(strlen(label) + 1);
+    strcpy(c->labels[j], label);
+    c->labels_num++;
+  }
+  return mpc_dfa_list(c, &j, 1);
+}
+
+static int mpc_dfa_concat(mpc_dfa_compiler_t* c, int a, int b) {
+  int l;
+  int* ids;
+  int na = c->lists[a][0];
+  int nb = c->lists[b][0];
+  if (na == 0 || nb == 0) {
+    return na == 0 ? b : a;
+  }
+  ids = malloc(sizeof(int) * (na + nb));
+  memcpy(ids, c->lists[a] + 1, sizeof(int) * na);
+  memcpy(ids + na, c->lists[b] + 1, sizeof(int) * nb);
+  l = mpc_dfa_list(c, ids, na + nb);
+  free(ids);
+  return l;
+}
+
+/* The error mpc_err_repeat makes from the one in list a */
+static int mpc_dfa_repeat(mpc_dfa_compiler_t* c, int a, const char* prefix) {
+  int j, l;
+  int* ids = c->lists[a];
+  size_t len = strlen(prefix) + 1;
+  char* label;
+  if (ids[0] == 0) {
+    return 0;
+  }
+  for (j = 1; j <= ids[0]; j++) {
+    len += strlen(c->labels[ids[j]]) + strlen(", ");
+  }
+  label = malloc(len);
+  strcpy(label, prefix);
+  for (j = 1; j <= ids[0]; j++) {
+    strcat(label, c->labels[ids[j]]);
+    if (j < ids[0] - 1) {
+      strcat(label, ", ");
+    }
+    if (j == ids[0] - 1) {
+      strcat(label, " or ");
+    }
+  }
+  l = mpc_dfa_label(c, label);
+  free(label);
+  return l;
 }
 
-mpc_parser_t* mpc_string_lit(void) {
-  mpc_parser_t* strchar = mpc_or(2, mpc_escape(), mpc_noneof("\""));
-  return mpc_expect(
-      mpc_between(mpc_many(mpcf_strfold, strchar), free, "\"", "\""), "string");
+static mpc_dfa_frag_t* mpc_dfa_frag_new(int num) {
+  mpc_dfa_frag_t* f;
+  if (num > MPC_DFA_STATES_MAX) {
+    return NULL;
+  }
+  f = malloc(sizeof(mpc_dfa_frag_t));
+  f->start = 0;
+  f->num = num;
+  f->edges = calloc(num * 256, sizeof(mpc_dfa_edge_t));
+  return f;
 }
 
-mpc_parser_t* mpc_regex_lit(void) {
-  mpc_parser_t* regexchar = mpc_or(2, mpc_escape(), mpc_noneof("/"));
-  return mpc_expect(
-      mpc_between(mpc_many(mpcf_strfold, regexchar), free, "/", "/"), "regex");
+static void mpc_dfa_frag_delete(mpc_dfa_frag_t* f) {
+  if (f) {
+    free(f->edges);
+    free(f);
+  }
 }
 
-mpc_parser_t* mpc_ident(void) {
-  mpc_parser_t *p0, *p1;
-  p0 = mpc_or(2, mpc_alpha(), mpc_underscore());
-  p1 = mpc_many(mpcf_strfold, mpc_alphanum());
-  return mpc_and(2, mpcf_strfold, p0, p1, free);
+static mpc_dfa_frag_t* mpc_dfa_frag_copy(mpc_dfa_frag_t* a) {
+  mpc_dfa_frag_t* f = mpc_dfa_frag_new(a->num);
+  f->start = a->start;
+  memcpy(f->edges, a->edges, sizeof(mpc_dfa_edge_t) * a->num * 256);
+  return f;
+}
+
+/* Drop the states which can not be reached from the start */
+static mpc_dfa_frag_t* mpc_dfa_frag_prune(mpc_dfa_frag_t* a) {
+
+  int j, k, n = 0;
+  int* order = malloc(sizeof(int) * a->num);
+  int* index = malloc(sizeof(int) * a->num);
+  mpc_dfa_frag_t* f;
+  mpc_dfa_edge_t* x;
+
+  for (j = 0; j < a->num; j++) {
+    index[j] = -1;
+  }
+  index[a->start] = 0;
+  order[n++] = a->start;
+
+  for (j = 0; j < n; j++) {
+    for (k = 0; k < 256; k++) {
+      x = &a->edges[order[j] * 256 + k];
+      if (x->next >= 0 && index[x->next] == -1) {
+        index[x->next] = n;
+        order[n++] = x->next;
+      }
+    }
+  }
+
+  f = mpc_dfa_frag_new(n);
+  for (j = 0; f && j < n; j++) {
+    for (k = 0; k < 256; k++) {
+      x = &f->edges[j * 256 + k];
+      *x = a->edges[order[j] * 256 + k];
+      x->next = x->next >= 0 ? index[x->next] : x->next;
+    }
+  }
+
+  free(order);
+  free(index);
+  mpc_dfa_frag_delete(a);
+  return f;
 }
 
 /*
-** Useful Parsers
+** Can the fragment fail once in state s? When loud is
+** set failures which merge or return some error are
+** allowed, since that error hides any from before.
 */
+static int mpc_dfa_frag_fails(mpc_dfa_frag_t* f, int s, int loud) {
 
-mpc_parser_t* mpc_startwith(mpc_parser_t* a) {
-  return mpc_and(2, mpcf_snd, mpc_soi(), a, mpcf_dtor_null);
-}
-mpc_parser_t* mpc_endwith(mpc_parser_t* a, mpc_dtor_t da) {
-  return mpc_and(2, mpcf_fst, a, mpc_eoi(), da);
-}
-mpc_parser_t* mpc_whole(mpc_parser_t* a, mpc_dtor_t da) {
-  return mpc_and(3, mpcf_snd, mpc_soi(), a, mpc_eoi(), mpcf_dtor_null, da);
-}
+  int j, k, n = 0, fails = 0;
+  int* order = malloc(sizeof(int) * f->num);
+  char* seen = calloc(f->num, 1);
+  mpc_dfa_edge_t* x;
 
-mpc_parser_t* mpc_stripl(mpc_parser_t* a) {
-  return mpc_and(2, mpcf_snd, mpc_blank(), a, mpcf_dtor_null);
-}
-mpc_parser_t* mpc_stripr(mpc_parser_t* a) {
-  return mpc_and(2, mpcf_fst, a, mpc_blank(), mpcf_dtor_null);
-}
-mpc_parser_t* mpc_strip(mpc_parser_t* a) {
-  return mpc_and(3, mpcf_snd, mpc_blank(), a, mpc_blank(), mpcf_dtor_null,
-                 mpcf_dtor_null);
-}
-mpc_parser_t* mpc_tok(mpc_parser_t* a) {
-  return mpc_and(2, mpcf_fst, a, mpc_blank(), mpcf_dtor_null);
-}
-mpc_parser_t* mpc_sym(const char* s) { return mpc_tok(mpc_string(s)); }
+  seen[s] = 1;
+  order[n++] = s;
 
-mpc_parser_t* mpc_total(mpc_parser_t* a, mpc_dtor_t da) {
-  return mpc_whole(mpc_strip(a), da);
-}
+  for (j = 0; j < n && !fails; j++) {
+    for (k = 0; k < 256; k++) {
+      x = &f->edges[order[j] * 256 + k];
+      if (x->next == MPC_DFA_FAIL && !(loud && (x->merged || x->error))) {
+        fails = 1;
+      }
+      if (x->next >= 0 && !seen[x->next]) {
+        seen[x->next] = 1;
+        order[n++] = x->next;
+      }
+    }
+  }
 
-mpc_parser_t* mpc_between(mpc_parser_t* a, mpc_dtor_t ad, const char* o,
-                          const char* c) {
-  return mpc_and(3, mpcf_snd_free, mpc_string(o), a, mpc_string(c), free, ad);
+  free(order);
+  free(seen);
+  return fails;
 }
 
-mpc_parser_t* mpc_parens(mpc_parser_t* a, mpc_dtor_t ad) {
-  return mpc_between(a, ad, "(", ")");
-}
-mpc_parser_t* mpc_braces(mpc_parser_t* a, mpc_dtor_t ad) {
-  return mpc_between(a, ad, "<", ">");
-}
-mpc_parser_t* mpc_brackets(mpc_parser_t* a, mpc_dtor_t ad) {
-  return mpc_between(a, ad, "{", "}");
-}
-mpc_parser_t* mpc_squares(mpc_parser_t* a, mpc_dtor_t ad) {
-  return mpc_between(a, ad, "[", "]");
+static mpc_dfa_frag_t* mpc_dfa_class(mpc_dfa_compiler_t* c, const char* in,
+                                     const char* label) {
+  int k;
+  int l = mpc_dfa_label(c, label);
+  mpc_dfa_frag_t* f = mpc_dfa_frag_new(2);
+  for (k = 0; k < 256; k++) {
+    f->edges[k].next = k != 0 && in[k] ? 1 : MPC_DFA_FAIL;
+    f->edges[k].error = f->edges[k].next == 1 ? 0 : l;
+    f->edges[256 + k].next = MPC_DFA_ACCEPT;
+  }
+  return f;
 }
 
-mpc_parser_t* mpc_tok_between(mpc_parser_t* a, mpc_dtor_t ad, const char* o,
-                              const char* c) {
-  return mpc_and(3, mpcf_snd_free, mpc_sym(o), mpc_tok(a), mpc_sym(c), free,
-                 ad);
+static mpc_dfa_frag_t* mpc_dfa_empty(void) {
+  int k;
+  mpc_dfa_frag_t* f = mpc_dfa_frag_new(1);
+  for (k = 0; k < 256; k++) {
+    f->edges[k].next = MPC_DFA_ACCEPT;
+  }
+  return f;
 }
 
-mpc_parser_t* mpc_tok_parens(mpc_parser_t* a, mpc_dtor_t ad) {
-  return mpc_tok_between(a, ad, "(", ")");
-}
-mpc_parser_t* mpc_tok_braces(mpc_parser_t* a, mpc_dtor_t ad) {
-  return mpc_tok_between(a, ad, "<", ">");
-}
-mpc_parser_t* mpc_tok_brackets(mpc_parser_t* a, mpc_dtor_t ad) {
-  return mpc_tok_between(a, ad, "{", "}");
+/* Give failures the error of mpc_many1 or mpc_count around the fragment */
+static mpc_dfa_frag_t* mpc_dfa_repeat_errors(mpc_dfa_compiler_t* c,
+                                             mpc_dfa_frag_t* f,
+                                             const char* prefix) {
+  int j;
+  for (j = 0; j < f->num * 256; j++) {
+    if (f->edges[j].next == MPC_DFA_FAIL) {
+      f->edges[j].error = mpc_dfa_repeat(c, f->edges[j].error, prefix);
+    }
+  }
+  return f;
 }
-mpc_parser_t* mpc_tok_squares(mpc_parser_t* a, mpc_dtor_t ad) {
-  return mpc_tok_between(a, ad, "[", "]");
+
+static mpc_dfa_frag_t* mpc_dfa_and(mpc_dfa_compiler_t* c, mpc_dfa_frag_t* a,
+                                   mpc_dfa_frag_t* b) {
+
+  int j, k;
+  mpc_dfa_frag_t* f;
+  mpc_dfa_edge_t *x, *y;
+
+  if (a == NULL || b == NULL || !(f = mpc_dfa_frag_new(a->num + b->num))) {
+    mpc_dfa_frag_delete(a);
+    mpc_dfa_frag_delete(b);
+    return NULL;
+  }
+
+  f->start = a->start;
+
+  /* Where a stops b starts, on the same character */
+  for (j = 0; j < a->num; j++) {
+    for (k = 0; k < 256; k++) {
+      x = &f->edges[j * 256 + k];
+      *x = a->edges[j * 256 + k];
+      if (x->next == MPC_DFA_ACCEPT) {
+        y = &b->edges[b->start * 256 + k];
+        x->next = y->next >= 0 ? y->next + a->num : y->next;
+        x->merged = mpc_dfa_concat(c, x->merged, y->merged);
+        x->error = y->error;
+      }
+    }
+  }
+
+  for (j = 0; j < b->num; j++) {
+    for (k = 0; k < 256; k++) {
+      x = &f->edges[(a->num + j) * 256 + k];
+      *x = b->edges[j * 256 + k];
+      x->next = x->next >= 0 ? x->next + a->num : x->next;
+    }
+  }
+
+  mpc_dfa_frag_delete(a);
+  mpc_dfa_frag_delete(b);
+  return mpc_dfa_frag_prune(f);
 }
 
 /*
-** Regular Expression Parsers
+** For `a|b` both are run side by side until one is
+** known to give the result. While a runs b may not
+** merge errors, and may only stop where whatever a
+** does next can not change the result.
 */
+static mpc_dfa_frag_t* mpc_dfa_or(mpc_dfa_compiler_t* c, mpc_dfa_frag_t* a,
+                                  mpc_dfa_frag_t* b) {
+
+  int j, k, n, ok = 1;
+  int* pairs;
+  int* which;
+  mpc_dfa_frag_t* f;
+  mpc_dfa_edge_t *x, *ea, *eb;
+
+  if (a == NULL || b == NULL || !(f = mpc_dfa_frag_new(a->num + b->num))) {
+    mpc_dfa_frag_delete(a);
+    mpc_dfa_frag_delete(b);
+    return NULL;
+  }
 
-/*
-** So here is a cute bootstrapping.
-**
-** I'm using the previously defined
-** mpc constructs and functions to
-** parse the user regex string and
-** construct a parser from it.
-**
-** As it turns out lots of the standard
-** mpc functions look a lot like `fold`
-** functions and so can be used indirectly
-** by many of the parsing functions to build
-** a parser directly - as we are parsing.
-**
-** This is certainly something that
-** would be less elegant/interesting
-** in a two-phase parser which first
-** builds an AST and then traverses it
-** to generate the object.
-**
-** This whole thing acts as a great
-** case study for how trivial it can be
-** to write a great parser in a few
-** lines of code using mpc.
-*/
+  /* Once one side is alone its failures are merged by the `or` */
+  for (j = 0; j < a->num + b->num; j++) {
+    for (k = 0; k < 256; k++) {
+      x = &f->edges[j * 256 + k];
+      *x = j < a->num ? a->edges[j * 256 + k]
+                      : b->edges[(j - a->num) * 256 + k];
+      if (j >= a->num && x->next >= 0) {
+        x->next += a->num;
+      }
+      if (x->next == MPC_DFA_FAIL) {
+        x->merged = mpc_dfa_concat(c, x->merged, x->error);
+        x->error = 0;
+      }
+    }
+  }
 
-/*
-**
-**  ### Regular Expression Grammar
-**
-**      <regex> : <term> | (<term> "|" <regex>)
-**
-**      <term> : <factor>*
-**
-**      <factor> : <base>
-**               | <base> "*"
-**               | <base> "+"
-**               | <base> "?"
-**               | <base> "{" <digits> "}"
-**
-**      <base> : <char>
-**             | "\" <char>
-**             | "(" <regex> ")"
-**             | "[" <range> "]"
-*/
+  pairs = malloc(sizeof(int) * a->num * b->num);
+  which = malloc(sizeof(int) * 2 * MPC_DFA_STATES_MAX);
+  for (j = 0; j < a->num * b->num; j++) {
+    pairs[j] = -1;
+  }
+
+  n = f->num;
+  f->start = n;
+  pairs[a->start * b->num + b->start] = n;
+  which[0] = a->start;
+  which[1] = b->start;
+
+  for (j = f->num; j < n + 1 && ok; j++) {
+
+    if (j == f->num) {
+      f->num++;
+      f->edges = realloc(f->edges, sizeof(mpc_dfa_edge_t) * f->num * 256);
+    }
+
+    for (k = 0; k < 256 && ok; k++) {
+
+      ea = &a->edges[which[(j - a->num - b->num) * 2 + 0] * 256 + k];
+      eb = &b->edges[which[(j - a->num - b->num) * 2 + 1] * 256 + k];
+      x = &f->edges[j * 256 + k];
+      x->error = 0;
+
+      if (ea->next == MPC_DFA_ACCEPT) {
+        x->next = MPC_DFA_ACCEPT;
+        x->merged = ea->merged;
+      } else if (ea->next == MPC_DFA_FAIL) {
+        x->merged = mpc_dfa_concat(c, ea->merged, ea->error);
+        x->merged = mpc_dfa_concat(c, x->merged, eb->merged);
+        x->next = eb->next >= 0 ? eb->next + a->num : eb->next;
+        if (eb->next == MPC_DFA_FAIL) {
+          x->merged = mpc_dfa_concat(c, x->merged, eb->error);
+        }
+      } else if (eb->next >= 0 && !eb->merged) {
+        x->merged = ea->merged;
+        if (pairs[ea->next * b->num + eb->next] == -1) {
+          if (n + 1 - a->num - b->num == MPC_DFA_STATES_MAX) {
+            ok = 0;
+            break;
+          }
+          n++;
+          pairs[ea->next * b->num + eb->next] = n;
+          which[(n - a->num - b->num) * 2 + 0] = ea->next;
+          which[(n - a->num - b->num) * 2 + 1] = eb->next;
+        }
+        x->next = pairs[ea->next * b->num + eb->next];
+      } else if (eb->next == MPC_DFA_FAIL &&
+                 !mpc_dfa_frag_fails(a, ea->next, 1)) {
+        x->merged = ea->merged;
+        x->next = ea->next;
+      } else if (eb->next == MPC_DFA_ACCEPT &&
+                 !mpc_dfa_frag_fails(a, ea->next, 0)) {
+        x->merged = ea->merged;
+        x->next = ea->next;
+      } else {
+        ok = 0;
+      }
+    }
+  }
+
+  free(pairs);
+  free(which);
+  mpc_dfa_frag_delete(a);
+  mpc_dfa_frag_delete(b);
 
-static mpc_val_t* mpcf_re_or(int n, mpc_val_t** xs) {
-  (void)n;
-  if (xs[1] == NULL) {
-    return xs[0];
-  } else {
-    return mpc_or(2, xs[0], xs[1]);
+  if (!ok) {
+    mpc_dfa_frag_delete(f);
+    return NULL;
   }
+  return mpc_dfa_frag_prune(f);
 }
 
-static mpc_val_t* mpcf_re_and(int n, mpc_val_t** xs) {
-  int i;
-  mpc_parser_t* p = mpc_lift(mpcf_ctor_str);
-  for (i = 0; i < n; i++) {
-    p = mpc_and(2, mpcf_strfold, p, xs[i], free);
+/* For `a?` and `a*`, where stopping is the choice fallen back to */
+static mpc_dfa_frag_t* mpc_dfa_option(mpc_dfa_compiler_t* c,
+                                      mpc_dfa_frag_t* a, int many) {
+
+  int j, k, s;
+  mpc_dfa_frag_t* f;
+  mpc_dfa_edge_t *x, *y;
+
+  if (a == NULL || !(f = mpc_dfa_frag_new(a->num + 1))) {
+    mpc_dfa_frag_delete(a);
+    return NULL;
   }
-  return p;
-}
 
-static mpc_val_t* mpcf_re_repeat(int n, mpc_val_t** xs) {
-  int num;
-  (void)n;
-  if (xs[1] == NULL) {
-    return xs[0];
+  s = a->num;
+  f->start = s;
+  memcpy(f->edges, a->edges, sizeof(mpc_dfa_edge_t) * a->num * 256);
+
+  for (k = 0; k < 256; k++) {
+    x = &f->edges[s * 256 + k];
+    *x = a->edges[a->start * 256 + k];
+    if (x->next == MPC_DFA_FAIL) {
+      x->next = MPC_DFA_ACCEPT;
+      x->merged = mpc_dfa_concat(c, x->merged, x->error);
+      x->error = 0;
+    } else if (x->next == MPC_DFA_ACCEPT && many) {
+      mpc_dfa_frag_delete(a);
+      mpc_dfa_frag_delete(f);
+      return NULL;
+    }
   }
-  switch (((char*)xs[1])[0]) {
-    case '*': {
-      free(xs[1]);
-      return mpc_many(mpcf_strfold, xs[0]);
-    }; break;
-    case '+': {
-      free(xs[1]);
-      return mpc_many1(mpcf_strfold, xs[0]);
-    }; break;
-    case '?': {
-      free(xs[1]);
-      return mpc_maybe_lift(xs[0], mpcf_ctor_str);
-    }; break;
-    default:
-      num = *(int*)xs[1];
-      free(xs[1]);
+
+  /* Each time round `a*` stops where the next time starts */
+  for (j = 0; j < a->num && many; j++) {
+    for (k = 0; k < 256; k++) {
+      x = &f->edges[j * 256 + k];
+      y = &f->edges[s * 256 + k];
+      if (x->next == MPC_DFA_ACCEPT) {
+        x->next = y->next;
+        x->merged = mpc_dfa_concat(c, x->merged, y->merged);
+      }
+    }
   }
 
-  return mpc_count(num, mpcf_strfold, xs[0], free);
-}
+  mpc_dfa_frag_delete(a);
 
-static mpc_parser_t* mpc_re_escape_char(char c) {
-  switch (c) {
-    case 'a':
-      return mpc_char('\a');
-    case 'f':
-      return mpc_char('\f');
-    case 'n':
-      return mpc_char('\n');
-    case 'r':
-      return mpc_char('\r');
-    case 't':
-      return mpc_char('\t');
-    case 'v':
-      return mpc_char('\v');
-    case 'b':
-      return mpc_and(2, mpcf_snd, mpc_boundary(), mpc_lift(mpcf_ctor_str),
-                     free);
-    case 'B':
-      return mpc_not_lift(mpc_boundary(), free, mpcf_ctor_str);
-    case 'A':
-      return mpc_and(2, mpcf_snd, mpc_soi(), mpc_lift(mpcf_ctor_str), free);
-    case 'Z':
-      return mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free);
-    case 'd':
-      return mpc_digit();
-    case 'D':
-      return mpc_not_lift(mpc_digit(), free, mpcf_ctor_str);
-    case 's':
-      return mpc_whitespace();
-    case 'S':
-      return mpc_not_lift(mpc_whitespace(), free, mpcf_ctor_str);
-    case 'w':
-      return mpc_alphanum();
-    case 'W':
-      return mpc_not_lift(mpc_alphanum(), free, mpcf_ctor_str);
-    default:
+  for (k = 0; k < 256; k++) {
+    x = &f->edges[s * 256 + k];
+    if (x->next >= 0 && mpc_dfa_frag_fails(f, x->next, 0)) {
+      mpc_dfa_frag_delete(f);
       return NULL;
+    }
   }
+
+  return mpc_dfa_frag_prune(f);
 }
 
-static mpc_val_t* mpcf_re_escape(mpc_val_t* x, void* data) {
+static mpc_dfa_frag_t* mpc_dfa_regex(mpc_dfa_compiler_t* c);
 
-  int mode = *((int*)data);
-  char* s = x;
-  mpc_parser_t* p;
+static mpc_dfa_frag_t* mpc_dfa_range(mpc_dfa_compiler_t* c) {
 
-  /* Any Character */
-  if (s[0] == '.') {
-    free(s);
-    if (mode & MPC_RE_DOTALL) {
-      return mpc_any();
-    } else {
-      return mpc_expect(mpc_noneof("\n"), "any character except a newline");
+  int k;
+  char in[256];
+  char* range;
+  char* label;
+  mpc_dfa_frag_t* f;
+  const char* start = c->s;
+
+  while (*c->s != '\0' && *c->s != ']') {
+    if (*c->s == '\\' && c->s[1] == '\0') {
+      return NULL;
     }
+    c->s += *c->s == '\\' ? 2 : 1;
   }
 
-  /* Start of Input */
-  if (s[0] == '^') {
-    free(s);
-    if (mode & MPC_RE_MULTILINE) {
-      return mpc_and(2, mpcf_snd, mpc_or(2, mpc_soi(), mpc_boundary_newline()),
-                     mpc_lift(mpcf_ctor_str), free);
-    } else {
-      return mpc_and(2, mpcf_snd, mpc_soi(), mpc_lift(mpcf_ctor_str), free);
+  if (*c->s != ']' || c->s == start || (*start == '^' && c->s == start + 1)) {
+    return NULL;
+  }
+
+  label = malloc(c->s - start + 1);
+  memcpy(label, start, c->s - start);
+  label[c->s - start] = '\0';
+  range = mpc_re_range_chars(label);
+  free(label);
+  c->s++;
+
+  for (k = 0; k < 256; k++) {
+    in[k] = (strchr(range, k) != NULL) != (*start == '^');
+  }
+  label = malloc(strlen(range) + strlen("none of ''") + 1);
+  sprintf(label, *start == '^' ? "none of '%s'" : "one of '%s'", range);
+  f = mpc_dfa_class(c, in, label);
+  free(label);
+  free(range);
+  return f;
+}
+
+static mpc_dfa_frag_t* mpc_dfa_base(mpc_dfa_compiler_t* c) {
+
+  int k, none = 0;
+  char in[256];
+  char label[64];
+  const char* set = NULL;
+  char x = *c->s;
+  mpc_dfa_frag_t* f;
+
+  if (x == '(') {
+    c->s++;
+    f = mpc_dfa_regex(c);
+    if (*c->s != ')') {
+      mpc_dfa_frag_delete(f);
+      return NULL;
     }
+    c->s++;
+    return f;
   }
 
-  /* End of Input */
-  if (s[0] == '$') {
-    free(s);
-    if (mode & MPC_RE_MULTILINE) {
-      return mpc_or(
-          2, mpc_newline(),
-          mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free));
-    } else {
-      return mpc_or(
-          2, mpc_and(2, mpcf_fst, mpc_newline(), mpc_eoi(), free),
-          mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free));
+  if (x == '[') {
+    c->s++;
+    return mpc_dfa_range(c);
+  }
+
+  if (x == '^' || x == '$' || (x == '\\' && c->s[1] == '\0')) {
+    return NULL;
+  }
+
+  c->s += x == '\\' ? 2 : 1;
+  sprintf(label, "'%c'", x);
+
+  if (x == '.') {
+    none = 1;
+    set = (c->mode & MPC_RE_DOTALL) ? "" : "\n";
+    strcpy(label, (c->mode & MPC_RE_DOTALL) ? "any character"
+                                            : "any character except a newline");
+  }
+
+  if (x == '\\') {
+    x = c->s[-1];
+    switch (x) {
+      case 'a': x = '\a'; break;
+      case 'f': x = '\f'; break;
+      case 'n': x = '\n'; break;
+      case 'r': x = '\r'; break;
+      case 't': x = '\t'; break;
+      case 'v': x = '\v'; break;
+      case 'b': case 'B': case 'A': case 'Z':
+      case 'D': case 'S': case 'W':
+        return NULL;
+      case 'd':
+        set = "0123456789";
+        strcpy(label, "digit");
+        break;
+      case 's':
+        set = " \f\n\r\t\v";
+        strcpy(label, "whitespace");
+        break;
+      case 'w':
+        set = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_";
+        strcpy(label, "alphanumeric");
+        break;
+      default:
+        break;
+    }
+    if (set == NULL) {
+      sprintf(label, "'%c'", x);
     }
   }
 
-  /* Regex Escape */
-  if (s[0] == '\\') {
-    p = mpc_re_escape_char(s[1]);
-    p = (p == NULL) ? mpc_char(s[1]) : p;
-    free(s);
-    return p;
+  for (k = 0; k < 256; k++) {
+    if (set == NULL) {
+      in[k] = (char)k == x;
+    } else {
+      in[k] = (strchr(set, k) != NULL) != none;
+    }
   }
 
-  /* Regex Standard */
-  p = mpc_char(s[0]);
-  free(s);
-  return p;
+  return mpc_dfa_class(c, in, label);
 }
 
-static const char* mpc_re_range_escape_char(char c) {
-  switch (c) {
-    case '-':
-      return "-";
-    case 'a':
-      return "\a";
-    case 'f':
-      return "\f";
-    case 'n':
-      return "\n";
-    case 'r':
-      return "\r";
-    case 't':
-      return "\t";
-    case 'v':
-      return "\v";
-    case 'b':
-      return "\b";
-    case 'd':
-      return "0123456789";
-    case 's':
-      return " \f\n\r\t\v";
-    case 'w':
-      return "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_";
+static mpc_dfa_frag_t* mpc_dfa_factor(mpc_dfa_compiler_t* c) {
+
+  int j, k, n;
+  char prefix[32];
+  mpc_dfa_frag_t* f;
+  mpc_dfa_frag_t* a = mpc_dfa_base(c);
+
+  if (a == NULL) {
+    return NULL;
+  }
+
+  switch (*c->s) {
+    case '*':
+      c->s++;
+      return mpc_dfa_option(c, a, 1);
+    case '?':
+      c->s++;
+      return mpc_dfa_option(c, a, 0);
+    case '+':
+      c->s++;
+      f = mpc_dfa_repeat_errors(c, mpc_dfa_frag_copy(a), "one or more of ");
+      return mpc_dfa_and(c, f, mpc_dfa_option(c, a, 1));
+    case '{':
+      n = isdigit((unsigned char)c->s[1])
+              ? (int)strtol(c->s + 1, (char**)&c->s, 10)
+              : 0;
+      if (*c->s != '}' || n < 1 || n > MPC_DFA_STATES_MAX) {
+        mpc_dfa_frag_delete(a);
+        return NULL;
+      }
+      c->s++;
+      sprintf(prefix, "%i of ", n);
+      f = mpc_dfa_repeat_errors(c, mpc_dfa_frag_copy(a), prefix);
+      for (j = 1; f && j < n; j++) {
+        f = mpc_dfa_and(
+            c, f, mpc_dfa_repeat_errors(c, mpc_dfa_frag_copy(a), prefix));
+      }
+      mpc_dfa_frag_delete(a);
+
+      /* mpc_count does not rewind when a later time round fails */
+      for (j = 0; f && j < 256; j++) {
+        k = f->edges[f->start * 256 + j].next;
+        if (k >= 0 && mpc_dfa_frag_fails(f, k, 0)) {
+          mpc_dfa_frag_delete(f);
+          f = NULL;
+        }
+      }
+      return f;
     default:
-      return NULL;
+      return a;
   }
 }
 
-static mpc_val_t* mpcf_re_range(mpc_val_t* x) {
+static mpc_dfa_frag_t* mpc_dfa_regex(mpc_dfa_compiler_t* c) {
 
-  mpc_parser_t* out;
-  size_t i, j;
-  size_t start, end;
-  const char* tmp = NULL;
-  const char* s = x;
-  int comp = s[0] == '^' ? 1 : 0;
-  char* range = calloc(1, 1);
+  mpc_dfa_frag_t* f = NULL;
 
-  if (s[0] == '\0') {
-    free(range);
-    free(x);
-    return mpc_fail("Invalid Regex Range Expression");
+  while (*c->s != '\0' && *c->s != ')' && *c->s != '|') {
+    f = f ? mpc_dfa_and(c, f, mpc_dfa_factor(c)) : mpc_dfa_factor(c);
+    if (f == NULL) {
+      return NULL;
+    }
   }
-  if (s[0] == '^' && s[1] == '\0') {
-    free(range);
-    free(x);
-    return mpc_fail("Invalid Regex Range Expression");
+  f = f ? f : mpc_dfa_empty();
+
+  if (*c->s == '|') {
+    c->s++;
+    f = mpc_dfa_or(c, f, mpc_dfa_regex(c));
   }
 
-  for (i = comp; i < strlen(s); i++) {
+  return f;
+}
 
-    /* Regex Range Escape */
-    if (s[i] == '\\') {
-      tmp = mpc_re_range_escape_char(s[i + 1]);
-      if (tmp != NULL) {
-        range = realloc(range, strlen(range) + strlen(tmp) + 1);
-        strcat(range, tmp);
-      } else {
-        range = realloc(range, strlen(range) + 1 + 1);
-        range[strlen(range) + 1] = '\0';
-        range[strlen(range) + 0] = s[i + 1];
-      }
-      i++;
-    }
+static void mpc_dfa_delete(mpc_dfa_t* d) {
+  int j;
+  for (j = 0; j < d->labels_num; j++) {
+    free(d->labels[j]);
+  }
+  for (j = 0; j < d->lists_num; j++) {
+    free(d->lists[j]);
+  }
+  free(d->labels);
+  free(d->lists);
+  free(d->edges);
+  free(d);
+}
 
-    /* Regex Range...Range */
-    else if (s[i] == '-') {
-      if (s[i + 1] == '\0' || i == 0) {
-        range = realloc(range, strlen(range) + strlen("-") + 1);
-        strcat(range, "-");
-      } else {
-        start = s[i - 1] + 1;
-        end = s[i + 1] - 1;
-        for (j = start; j <= end; j++) {
-          range = realloc(range, strlen(range) + 1 + 1 + 1);
-          range[strlen(range) + 1] = '\0';
-          range[strlen(range) + 0] = (char)j;
+static mpc_dfa_t* mpc_dfa_copy(mpc_dfa_t* a) {
+  int j;
+  mpc_dfa_t* d = malloc(sizeof(mpc_dfa_t));
+  *d = *a;
+  d->edges = malloc(sizeof(mpc_dfa_edge_t) * a->states_num * a->classes_num);
+  memcpy(d->edges, a->edges,
+         sizeof(mpc_dfa_edge_t) * a->states_num * a->classes_num);
+  d->labels = malloc(sizeof(char*) * a->labels_num);
+  for (j = 0; j < a->labels_num; j++) {
+    d->labels[j] = malloc(strlen(a->labels[j]) + 1);
+    strcpy(d->labels[j], a->labels[j]);
+  }
+  d->lists = malloc(sizeof(int*) * a->lists_num);
+  for (j = 0; j < a->lists_num; j++) {
+    d->lists[j] = malloc(sizeof(int) * (a->lists[j][0] + 1));
+    memcpy(d->lists[j], a->lists[j], sizeof(int) * (a->lists[j][0] + 1));
+  }
+  return d;
+}
+
+/* Returns NULL when the regex needs its combinators */
+static mpc_dfa_t* mpc_dfa_compile(const char* re, int mode) {
+
+  int j, k, s;
+  mpc_dfa_compiler_t c;
+  mpc_dfa_frag_t* f;
+  mpc_dfa_t* d = NULL;
+  int column[256];
+
+  c.s = re;
+  c.mode = mode;
+  c.labels = NULL;
+  c.labels_num = 0;
+  c.lists = NULL;
+  c.lists_num = 0;
+  mpc_dfa_list(&c, NULL, 0);
+
+  f = mpc_dfa_regex(&c);
+
+  if (f && *c.s == '\0') {
+
+    d = malloc(sizeof(mpc_dfa_t));
+    d->start = f->start;
+    d->states_num = f->num;
+    d->classes_num = 0;
+
+    /* Characters whose columns are the same share a class */
+    for (k = 0; k < 256; k++) {
+      for (j = 0; j < d->classes_num; j++) {
+        for (s = 0; s < f->num; s++) {
+          if (memcmp(&f->edges[s * 256 + k], &f->edges[s * 256 + column[j]],
+                     sizeof(mpc_dfa_edge_t)) != 0) {
+            break;
+          }
+        }
+        if (s == f->num) {
+          break;
         }
       }
+      if (j == d->classes_num) {
+        column[d->classes_num++] = k;
+      }
+      d->classes[k] = (unsigned char)j;
     }
 
-    /* Regex Range Normal */
-    else {
-      range = realloc(range, strlen(range) + 1 + 1);
-      range[strlen(range) + 1] = '\0';
-      range[strlen(range) + 0] = s[i];
+    d->edges = malloc(sizeof(mpc_dfa_edge_t) * f->num * d->classes_num);
+    for (s = 0; s < f->num; s++) {
+      for (j = 0; j < d->classes_num; j++) {
+        d->edges[s * d->classes_num + j] = f->edges[s * 256 + column[j]];
+      }
     }
+
+    d->labels = c.labels;
+    d->labels_num = c.labels_num;
+    d->lists = c.lists;
+    d->lists_num = c.lists_num;
   }
 
-  out = comp == 1 ? mpc_noneof(range) : mpc_oneof(range);
+  mpc_dfa_frag_delete(f);
 
-  free(x);
-  free(range);
+  if (d == NULL) {
+    for (j = 0; j < c.labels_num; j++) {
+      free(c.labels[j]);
+    }
+    for (j = 0; j < c.lists_num; j++) {
+      free(c.lists[j]);
+    }
+    free(c.labels);
+    free(c.lists);
+  }
 
-  return out;
+  return d;
+}
+
+static mpc_parser_t* mpc_dfa_parser(mpc_dfa_t* d, mpc_parser_t* x) {
+  mpc_parser_t* p = mpc_undefined();
+  p->type = MPC_TYPE_DFA;
+  p->data.dfa.d = d;
+  p->data.dfa.x = x;
+  return p;
 }
 
 mpc_parser_t* mpc_re(const char* re) { return mpc_re_mode(re, MPC_RE_DEFAULT); }
@@ -2747,6 +4715,7 @@ mpc_parser_t* mpc_re_mode(const char* re, int mode) {
   char* err_msg;
   mpc_parser_t* err_out;
   mpc_result_t r;
+  mpc_dfa_t* d = NULL;
   mpc_parser_t *Regex, *Term, *Factor, *Base, *Range, *RegexEnclose;
 
   Regex = mpc_new("regex");
@@ -2793,13 +4762,15 @@ mpc_parser_t* mpc_re_mode(const char* re, int mode) {
     mpc_err_delete(r.error);
     free(err_msg);
     r.output = err_out;
+  } else if (!(mode & MPC_RE_NO_DFA)) {
+    d = mpc_dfa_compile(re, mode);
   }
 
   mpc_cleanup(6, RegexEnclose, Regex, Term, Factor, Base, Range);
 
   mpc_optimise(r.output);
 
-  return r.output;
+  return d ? mpc_dfa_parser(d, r.output) : r.output;
 }
 
 /*
@@ -3219,6 +5190,15 @@ static void mpc_print_unretained(mpc_parser_t* p, int force) {
   if (p->type == MPC_TYPE_PREDICT) {
     mpc_print_unretained(p->data.predict.x, 0);
   }
+  if (p->type == MPC_TYPE_MEMO) {
+    mpc_print_unretained(p->data.memo.x, 0);
+  }
+  if (p->type == MPC_TYPE_DFA) {
+    mpc_print_unretained(p->data.dfa.x, 0);
+  }
+  if (p->type == MPC_TYPE_ARENA) {
+    mpc_print_unretained(p->data.arena.x, 0);
+  }
 
   if (p->type == MPC_TYPE_NOT) {
     mpc_print_unretained(p->data.not.x, 0);
@@ -3345,6 +5325,114 @@ int mpc_test_pass(mpc_parser_t* p, const char* s, const void* d,
 ** AST
 */
 
+static mpc_ast_arena_t* mpc_ast_arena_new(void) {
+  mpc_ast_arena_t* m = malloc(sizeof(mpc_ast_arena_t));
+  m->blocks = NULL;
+  m->blocks_num = 0;
+  m->used = 0;
+  m->size = 0;
+  m->tags_num = 0;
+  m->tags_slots = MPC_AST_ARENA_TAGS_MIN;
+  m->tags = calloc(m->tags_slots, sizeof(char*));
+  m->root = NULL;
+  return m;
+}
+
+static void mpc_ast_arena_delete(mpc_ast_arena_t* m) {
+  int j;
+  for (j = 0; j < m->blocks_num; j++) {
+    free(m->blocks[j]);
+  }
+  free(m->blocks);
+  free(m->tags);
+  free(m);
+}
+
+static size_t mpc_ast_arena_size(size_t n) {
+  size_t a = sizeof(mpc_ast_arena_align_t);
+  return (n + a - 1) / a * a;
+}
+
+static void* mpc_ast_arena_alloc(mpc_ast_arena_t* m, size_t n) {
+
+  char* b;
+  n = mpc_ast_arena_size(n);
+
+  if (m->used + n > m->size) {
+    m->size = m->size ? m->size * 2 : MPC_AST_ARENA_BLOCK;
+    if (m->size < n) {
+      m->size = n;
+    }
+    m->blocks = realloc(m->blocks, sizeof(char*) * (m->blocks_num + 1));
+    m->blocks[m->blocks_num++] = malloc(m->size);
+    m->used = 0;
+  }
+
+  b = m->blocks[m->blocks_num - 1] + m->used;
+  m->used += n;
+  return b;
+}
+
+static char** mpc_ast_arena_slot(mpc_ast_arena_t* m, const char* t) {
+
+  char** slot;
+  unsigned long h = 5381;
+  const char* c;
+
+  for (c = t; *c; c++) {
+    h = h * 33 + (unsigned char)*c;
+  }
+
+  while (1) {
+    slot = &m->tags[h & (unsigned long)(m->tags_slots - 1)];
+    if (*slot == NULL || strcmp(*slot, t) == 0) {
+      return slot;
+    }
+    h++;
+  }
+}
+
+/*
+** Give the tag t, the last thing allocated, the copy
+** every node shares, handing t back if there is one.
+*/
+static char* mpc_ast_arena_intern(mpc_ast_arena_t* m, char* t) {
+
+  int j;
+  char** old;
+  int old_slots;
+  char** slot = mpc_ast_arena_slot(m, t);
+
+  if (*slot) {
+    m->used -= mpc_ast_arena_size(strlen(t) + 1);
+    return *slot;
+  }
+
+  *slot = t;
+  m->tags_num++;
+
+  if (m->tags_num * 2 > m->tags_slots) {
+    old = m->tags;
+    old_slots = m->tags_slots;
+    m->tags_slots *= 2;
+    m->tags = calloc(m->tags_slots, sizeof(char*));
+    for (j = 0; j < old_slots; j++) {
+      if (old[j]) {
+        *mpc_ast_arena_slot(m, old[j]) = old[j];
+      }
+    }
+    free(old);
+  }
+
+  return t;
+}
+
+static char* mpc_ast_arena_tag(mpc_ast_arena_t* m, const char* t) {
+  char* u = mpc_ast_arena_alloc(m, strlen(t) + 1);
+  strcpy(u, t);
+  return mpc_ast_arena_intern(m, u);
+}
+
 void mpc_ast_delete(mpc_ast_t* a) {
 
   int i;
@@ -3353,6 +5441,14 @@ void mpc_ast_delete(mpc_ast_t* a) {
     return;
   }
 
+  /* Only the root of a tree in an arena frees anything */
+  if (a->arena) {
+    if (a->arena->root == a) {
+      mpc_ast_arena_delete(a->arena);
+    }
+    return;
+  }
+
   for (i = 0; i < a->children_num; i++) {
     mpc_ast_delete(a->children[i]);
   }
@@ -3364,29 +5460,89 @@ void mpc_ast_delete(mpc_ast_t* a) {
 }
 
 static void mpc_ast_delete_no_children(mpc_ast_t* a) {
+  if (a->arena) {
+    return;
+  }
   free(a->children);
   free(a->tag);
   free(a->contents);
   free(a);
 }
 
-mpc_ast_t* mpc_ast_new(const char* tag, const char* contents) {
-
-  mpc_ast_t* a = malloc(sizeof(mpc_ast_t));
+/*
+** Build a node in the arena m, or on the heap if m is
+** NULL. Only the parsers wrapped by mpca_arena pass an
+** arena, so every other caller gets ordinary nodes.
+*/
+static mpc_ast_t* mpc_ast_new_in(mpc_ast_arena_t* m, const char* tag,
+                                 const char* contents) {
 
-  a->tag = malloc(strlen(tag) + 1);
-  strcpy(a->tag, tag);
+  mpc_ast_t* a;
 
-  a->contents = malloc(strlen(contents) + 1);
-  strcpy(a->contents, contents);
+  if (m) {
+    a = mpc_ast_arena_alloc(m, sizeof(mpc_ast_t));
+    a->contents = mpc_ast_arena_alloc(m, strlen(contents) + 1);
+    strcpy(a->contents, contents);
+    a->tag = mpc_ast_arena_tag(m, tag);
+  } else {
+    a = malloc(sizeof(mpc_ast_t));
+    a->tag = malloc(strlen(tag) + 1);
+    strcpy(a->tag, tag);
+    a->contents = malloc(strlen(contents) + 1);
+    strcpy(a->contents, contents);
+  }
 
+  a->id = 0;
   a->state = mpc_state_new();
 
   a->children_num = 0;
   a->children = NULL;
+  a->arena = m;
   return a;
 }
 
+mpc_ast_t* mpc_ast_new(const char* tag, const char* contents) {
+  return mpc_ast_new_in(NULL, tag, contents);
+}
+
+static mpc_ast_t* mpc_ast_copy_in(mpc_ast_arena_t* m, mpc_ast_t* a) {
+  int j;
+  mpc_ast_t* b;
+  if (a == NULL) {
+    return NULL;
+  }
+  b = mpc_ast_new_in(m, a->tag, a->contents);
+  b->id = a->id;
+  b->state = a->state;
+  if (m) {
+    for (j = 0; j < a->children_num; j++) {
+      mpc_ast_add_child(b, mpc_ast_copy_in(m, a->children[j]));
+    }
+    return b;
+  }
+  b->children_num = a->children_num;
+  b->children = malloc(sizeof(mpc_ast_t*) * a->children_num);
+  for (j = 0; j < a->children_num; j++) {
+    b->children[j] = mpc_ast_copy_in(m, a->children[j]);
+  }
+  return b;
+}
+
+/*
+** A tree is either all in one arena or all on the heap,
+** so a node from anywhere else is copied into m and the
+** original deleted, never linked in.
+*/
+static mpc_ast_t* mpc_ast_into(mpc_ast_arena_t* m, mpc_ast_t* a) {
+  mpc_ast_t* b;
+  if (a == NULL || a->arena == m) {
+    return a;
+  }
+  b = mpc_ast_copy_in(m, a);
+  mpc_ast_delete(a);
+  return b;
+}
+
 mpc_ast_t* mpc_ast_build(int n, const char* tag, ...) {
 
   mpc_ast_t* a = mpc_ast_new(tag, "");
@@ -3418,7 +5574,7 @@ mpc_ast_t* mpc_ast_add_root(mpc_ast_t* a) {
     return a;
   }
 
-  r = mpc_ast_new(">", "");
+  r = mpc_ast_new_in(a->arena, ">", "");
   mpc_ast_add_child(r, a);
   return r;
 }
@@ -3447,6 +5603,26 @@ int mpc_ast_eq(mpc_ast_t* a, mpc_ast_t* b) {
 }
 
 mpc_ast_t* mpc_ast_add_child(mpc_ast_t* r, mpc_ast_t* a) {
+
+  mpc_ast_t** cs;
+
+  a = mpc_ast_into(r->arena, a);
+
+  /* In an arena the children have room for a power of two of them */
+  if (r->arena) {
+    if ((r->children_num & (r->children_num - 1)) == 0) {
+      cs = mpc_ast_arena_alloc(r->arena,
+                               sizeof(mpc_ast_t*) *
+                                   (r->children_num ? r->children_num * 2 : 1));
+      if (r->children_num) {
+        memcpy(cs, r->children, sizeof(mpc_ast_t*) * r->children_num);
+      }
+      r->children = cs;
+    }
+    r->children[r->children_num++] = a;
+    return r;
+  }
+
   r->children_num++;
   r->children = realloc(r->children, sizeof(mpc_ast_t*) * r->children_num);
   r->children[r->children_num - 1] = a;
@@ -3454,9 +5630,18 @@ mpc_ast_t* mpc_ast_add_child(mpc_ast_t* r, mpc_ast_t* a) {
 }
 
 mpc_ast_t* mpc_ast_add_tag(mpc_ast_t* a, const char* t) {
+  char* u;
   if (a == NULL) {
     return a;
   }
+  if (a->arena) {
+    u = mpc_ast_arena_alloc(a->arena, strlen(t) + 1 + strlen(a->tag) + 1);
+    strcpy(u, t);
+    strcat(u, "|");
+    strcat(u, a->tag);
+    a->tag = mpc_ast_arena_intern(a->arena, u);
+    return a;
+  }
   a->tag = realloc(a->tag, strlen(t) + 1 + strlen(a->tag) + 1);
   memmove(a->tag + strlen(t) + 1, a->tag, strlen(a->tag) + 1);
   memmove(a->tag, t, strlen(t));
@@ -3465,9 +5650,17 @@ mpc_ast_t* mpc_ast_add_tag(mpc_ast_t* a, const char* t) {
 }
 
 mpc_ast_t* mpc_ast_add_root_tag(mpc_ast_t* a, const char* t) {
+  char* u;
   if (a == NULL) {
     return a;
   }
+  if (a->arena) {
+    u = mpc_ast_arena_alloc(a->arena, (strlen(t) - 1) + strlen(a->tag) + 1);
+    memcpy(u, t, strlen(t) - 1);
+    strcpy(u + (strlen(t) - 1), a->tag);
+    a->tag = mpc_ast_arena_intern(a->arena, u);
+    return a;
+  }
   a->tag = realloc(a->tag, (strlen(t) - 1) + strlen(a->tag) + 1);
   memmove(a->tag + (strlen(t) - 1), a->tag, strlen(a->tag) + 1);
   memmove(a->tag, t, (strlen(t) - 1));
@@ -3475,6 +5668,10 @@ mpc_ast_t* mpc_ast_add_root_tag(mpc_ast_t* a, const char* t) {
 }
 
 mpc_ast_t* mpc_ast_tag(mpc_ast_t* a, const char* t) {
+  if (a->arena) {
+    a->tag = mpc_ast_arena_tag(a->arena, t);
+    return a;
+  }
   a->tag = realloc(a->tag, strlen(t) + 1);
   strcpy(a->tag, t);
   return a;
@@ -3683,7 +5880,8 @@ void mpc_ast_traverse_free(mpc_ast_trav_t** trav) {
   }
 }
 
-mpc_val_t* mpcf_fold_ast(int n, mpc_val_t** xs) {
+static mpc_val_t* mpcf_fold_ast_in(mpc_ast_arena_t* m, int n,
+                                   mpc_val_t** xs) {
 
   int i, j;
   mpc_ast_t** as = (mpc_ast_t**)xs;
@@ -3702,7 +5900,7 @@ mpc_val_t* mpcf_fold_ast(int n, mpc_val_t** xs) {
     return xs[1];
   }
 
-  r = mpc_ast_new(">", "");
+  r = mpc_ast_new_in(m, ">", "");
 
   for (i = 0; i < n; i++) {
 
@@ -3710,9 +5908,14 @@ mpc_val_t* mpcf_fold_ast(int n, mpc_val_t** xs) {
       continue;
     }
 
+    as[i] = mpc_ast_into(m, as[i]);
+
     if (as[i] && as[i]->children_num == 0) {
       mpc_ast_add_child(r, as[i]);
     } else if (as[i] && as[i]->children_num == 1) {
+      if (as[i]->children[0]->id == 0) {
+        as[i]->children[0]->id = as[i]->id;
+      }
       mpc_ast_add_child(r,
                         mpc_ast_add_root_tag(as[i]->children[0], as[i]->tag));
       mpc_ast_delete_no_children(as[i]);
@@ -3731,6 +5934,10 @@ mpc_val_t* mpcf_fold_ast(int n, mpc_val_t** xs) {
   return r;
 }
 
+mpc_val_t* mpcf_fold_ast(int n, mpc_val_t** xs) {
+  return mpcf_fold_ast_in(NULL, n, xs);
+}
+
 mpc_val_t* mpcf_str_ast(mpc_val_t* c) {
   mpc_ast_t* a = mpc_ast_new("", c);
   free(c);
@@ -3823,6 +6030,13 @@ mpc_parser_t* mpca_total(mpc_parser_t* a) {
   return mpc_total(a, (mpc_dtor_t)mpc_ast_delete);
 }
 
+mpc_parser_t* mpca_arena(mpc_parser_t* a) {
+  mpc_parser_t* p = mpc_undefined();
+  p->type = MPC_TYPE_ARENA;
+  p->data.arena.x = a;
+  return p;
+}
+
 /*
 ** Grammar Parser
 */
@@ -3998,6 +6212,7 @@ static mpc_parser_t* mpca_grammar_find_parser(char* x, mpca_grammar_st_t* st) {
         return mpc_failf("No Parser in position %i! Only supplied %i Parsers!",
                          i, st->parsers_num);
       }
+      st->parsers[st->parsers_num - 1]->id = st->parsers_num;
     }
 
     return st->parsers[st->parsers_num - 1];
@@ -4029,6 +6244,7 @@ static mpc_parser_t* mpca_grammar_find_parser(char* x, mpca_grammar_st_t* st) {
       if (p == NULL || p->name == NULL) {
         return mpc_failf("Unknown Parser '%s'!", x);
       }
+      p->id = st->parsers_num;
       if (p->name && strcmp(p->name, x) == 0) {
         return p;
       }
@@ -4036,6 +6252,23 @@ static mpc_parser_t* mpca_grammar_find_parser(char* x, mpca_grammar_st_t* st) {
   }
 }
 
+/*
+** Each parser given to the grammar is numbered by its
+** place among them, counting from one. A node built by
+** a rule takes its tag and, unless a rule inside gave
+** it one already, its number as the id, so the node for
+** a token has the id of the innermost rule matching it.
+** Nodes no rule built have id zero.
+*/
+static mpc_val_t* mpca_ast_add_rule(mpc_val_t* x, void* d) {
+  mpc_ast_t* a = x;
+  mpc_parser_t* p = d;
+  if (a && a->id == 0) {
+    a->id = p->id;
+  }
+  return mpc_ast_add_tag(a, p->name);
+}
+
 static mpc_val_t* mpcaf_grammar_id(mpc_val_t* x, void* s) {
 
   mpca_grammar_st_t* st = s;
@@ -4043,7 +6276,7 @@ static mpc_val_t* mpcaf_grammar_id(mpc_val_t* x, void* s) {
   free(x);
 
   if (p->name) {
-    return mpca_state(mpca_root(mpca_add_tag(p, p->name)));
+    return mpca_state(mpca_root(mpc_apply_to(p, mpca_ast_add_rule, p)));
   } else {
     return mpca_state(mpca_root(p));
   }
@@ -4176,6 +6409,11 @@ static void mpca_stmt_list_delete(mpc_val_t* x) {
   free(x);
 }
 
+/* Packrat keeps its copies on the heap, whatever arena they came from */
+static mpc_val_t* mpca_ast_dup(mpc_val_t* x) {
+  return mpc_ast_copy_in(NULL, x);
+}
+
 static mpc_val_t* mpca_stmt_list_apply_to(mpc_val_t* x, void* s) {
 
   mpca_grammar_st_t* st = s;
@@ -4192,6 +6430,13 @@ static mpc_val_t* mpca_stmt_list_apply_to(mpc_val_t* x, void* s) {
     if (stmt->name) {
       stmt->grammar = mpc_expect(stmt->grammar, stmt->name);
     }
+    if (st->flags & MPCA_LANG_PACKRAT) {
+      stmt->grammar =
+          mpc_memo(stmt->grammar, mpca_ast_dup, (mpc_dtor_t)mpc_ast_delete);
+    }
+    if (st->flags & MPCA_LANG_ARENA) {
+      stmt->grammar = mpca_arena(stmt->grammar);
+    }
     mpc_optimise(stmt->grammar);
     mpc_define(left, stmt->grammar);
     free(stmt->ident);
@@ -4395,6 +6640,15 @@ static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
   if (p->type == MPC_TYPE_PREDICT) {
     return 1 + mpc_nodecount_unretained(p->data.predict.x, 0);
   }
+  if (p->type == MPC_TYPE_MEMO) {
+    return 1 + mpc_nodecount_unretained(p->data.memo.x, 0);
+  }
+  if (p->type == MPC_TYPE_DFA) {
+    return 1 + mpc_nodecount_unretained(p->data.dfa.x, 0);
+  }
+  if (p->type == MPC_TYPE_ARENA) {
+    return 1 + mpc_nodecount_unretained(p->data.arena.x, 0);
+  }
 
   if (p->type == MPC_TYPE_CHECK) {
     return 1 + mpc_nodecount_unretained(p->data.check.x, 0);
@@ -4439,10 +6693,315 @@ static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
   return 1;
 }
 
+/*
+** Counts `or` nodes, how many have tables, and for
+** those how many alternatives there are against the
+** most tried on any one character.
+*/
+
+static void mpc_orcount_unretained(mpc_parser_t* p, int force, int* counts) {
+
+  int j, k, c, m;
+  mpc_or_table_t* t;
+
+  if (p->retained && !force) {
+    return;
+  }
+
+  switch (p->type) {
+    case MPC_TYPE_EXPECT:
+      mpc_orcount_unretained(p->data.expect.x, 0, counts);
+      break;
+    case MPC_TYPE_APPLY:
+      mpc_orcount_unretained(p->data.apply.x, 0, counts);
+      break;
+    case MPC_TYPE_APPLY_TO:
+      mpc_orcount_unretained(p->data.apply_to.x, 0, counts);
+      break;
+    case MPC_TYPE_PREDICT:
+      mpc_orcount_unretained(p->data.predict.x, 0, counts);
+      break;
+    case MPC_TYPE_MEMO:
+      mpc_orcount_unretained(p->data.memo.x, 0, counts);
+      break;
+    case MPC_TYPE_DFA:
+      mpc_orcount_unretained(p->data.dfa.x, 0, counts);
+      break;
+    case MPC_TYPE_ARENA:
+      mpc_orcount_unretained(p->data.arena.x, 0, counts);
+      break;
+    case MPC_TYPE_CHECK:
+      mpc_orcount_unretained(p->data.check.x, 0, counts);
+      break;
+    case MPC_TYPE_CHECK_WITH:
+      mpc_orcount_unretained(p->data.check_with.x, 0, counts);
+      break;
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:
+      mpc_orcount_unretained(p->data.not.x, 0, counts);
+      break;
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      mpc_orcount_unretained(p->data.repeat.x, 0, counts);
+      break;
+    case MPC_TYPE_AND:
+      for (j = 0; j < p->data.and.n; j++) {
+        mpc_orcount_unretained(p->data.and.xs[j], 0, counts);
+      }
+      break;
+    case MPC_TYPE_OR:
+      counts[0]++;
+      t = p->data.or.table;
+      if (t) {
+        counts[1]++;
+        counts[2] += p->data.or.n;
+        m = 0;
+        for (k = 0; k < t->classes_num; k++) {
+          for (c = 0, j = 0; j < p->data.or.n; j++) {
+            c += t->tries[k * p->data.or.n + j];
+          }
+          m = c > m ? c : m;
+        }
+        counts[3] += m;
+      }
+      for (j = 0; j < p->data.or.n; j++) {
+        mpc_orcount_unretained(p->data.or.xs[j], 0, counts);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
 void mpc_stats(mpc_parser_t* p) {
+  int counts[4] = {0, 0, 0, 0};
+  mpc_orcount_unretained(p, 1, counts);
   printf("Stats\n");
   printf("=====\n");
   printf("Node Count: %i\n", mpc_nodecount_unretained(p, 1));
+  printf("Or Count: %i (%i with tables)\n", counts[0], counts[1]);
+  printf("Alternatives: %i (at most %i tried)\n", counts[2], counts[3]);
+}
+
+/*
+** The first set of a parser is the characters on
+** which it might do something other than fail where
+** it starts. It is known only for parsers that, on any
+** other, fail leaving no trace but the error from the
+** parser put in fails. Rules are followed into their
+** definitions, so a table stays right only as long as
+** the rules it reaches are not defined again.
+*/
+
+enum { MPC_FIRST_DEPTH_MAX = 64 };
+
+static void mpc_first_add(unsigned char* first, int c) {
+  first[c / 8] |= 1 << (c % 8);
+}
+
+static int mpc_first_has(unsigned char* first, int c) {
+  return first[c / 8] & (1 << (c % 8));
+}
+
+static int mpc_first_char(mpc_parser_t* p, char c) {
+  switch (p->type) {
+    case MPC_TYPE_SINGLE:
+      return c == p->data.single.x;
+    case MPC_TYPE_RANGE:
+      return c >= p->data.range.x && c <= p->data.range.y;
+    case MPC_TYPE_ONEOF:
+      return strchr(p->data.string.x, c) != 0;
+    case MPC_TYPE_NONEOF:
+      return strchr(p->data.string.x, c) == 0;
+    case MPC_TYPE_SATISFY:
+      return p->data.satisfy.f(c);
+    case MPC_TYPE_STRING:
+      return c == p->data.string.x[0];
+    default:
+      return 1;
+  }
+}
+
+static void mpc_or_table_rule(mpc_or_table_t* t, mpc_parser_t* p, int v) {
+  int k;
+  for (k = 0; k < t->rules_num; k++) {
+    if (t->rules[k] == p) {
+      return;
+    }
+  }
+  t->rules = realloc(t->rules, sizeof(mpc_parser_t*) * (t->rules_num + 1));
+  t->versions = realloc(t->versions, sizeof(int) * (t->rules_num + 1));
+  t->rules[t->rules_num] = p;
+  t->versions[t->rules_num] = v;
+  t->rules_num++;
+}
+
+static int mpc_first(mpc_parser_t* p, unsigned char* first,
+                     mpc_parser_t** fails, int depth, mpc_or_table_t* t) {
+
+  mpc_dfa_t* d;
+  mpc_or_table_t* u;
+  int c, j;
+
+  memset(first, 0, 32);
+  *fails = NULL;
+
+  if (depth > MPC_FIRST_DEPTH_MAX) {
+    return 0;
+  }
+
+  /* Undefined rules are not known, which stays right once they are */
+  if (p->retained && p->type != MPC_TYPE_UNDEFINED) {
+    mpc_or_table_rule(t, p, p->version);
+  }
+
+  switch (p->type) {
+
+    /* Nothing is read at the end of the input */
+    case MPC_TYPE_SINGLE:
+    case MPC_TYPE_RANGE:
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+    case MPC_TYPE_SATISFY:
+    case MPC_TYPE_STRING:
+      if (p->type == MPC_TYPE_STRING && p->data.string.x[0] == '\0') {
+        return 0;
+      }
+      for (c = 1; c < 256; c++) {
+        if (mpc_first_char(p, (char)c)) {
+          mpc_first_add(first, c);
+        }
+      }
+      return 1;
+
+    case MPC_TYPE_EXPECT:
+      if (!mpc_first(p->data.expect.x, first, fails, depth + 1, t)) {
+        return 0;
+      }
+      *fails = p;
+      return 1;
+
+    case MPC_TYPE_APPLY:
+      return mpc_first(p->data.apply.x, first, fails, depth + 1, t);
+    case MPC_TYPE_APPLY_TO:
+      return mpc_first(p->data.apply_to.x, first, fails, depth + 1, t);
+    case MPC_TYPE_CHECK:
+      return mpc_first(p->data.check.x, first, fails, depth + 1, t);
+    case MPC_TYPE_CHECK_WITH:
+      return mpc_first(p->data.check_with.x, first, fails, depth + 1, t);
+    case MPC_TYPE_MEMO:
+      return mpc_first(p->data.memo.x, first, fails, depth + 1, t);
+    case MPC_TYPE_ARENA:
+      return mpc_first(p->data.arena.x, first, fails, depth + 1, t);
+
+    case MPC_TYPE_DFA:
+      d = p->data.dfa.d;
+      for (c = 0; c < 256; c++) {
+        if (d->edges[d->start * d->classes_num + d->classes[c]].next !=
+            MPC_DFA_FAIL) {
+          mpc_first_add(first, c);
+        }
+      }
+      *fails = p;
+      return 1;
+
+    /* What comes before the first parser that reads can't fail */
+    case MPC_TYPE_AND:
+      for (j = 0; j < p->data.and.n; j++) {
+        if (p->data.and.xs[j]->type != MPC_TYPE_PASS &&
+            p->data.and.xs[j]->type != MPC_TYPE_LIFT &&
+            p->data.and.xs[j]->type != MPC_TYPE_LIFT_VAL &&
+            p->data.and.xs[j]->type != MPC_TYPE_STATE) {
+          return mpc_first(p->data.and.xs[j], first, fails, depth + 1, t);
+        }
+      }
+      return 0;
+
+    case MPC_TYPE_OR:
+      u = p->data.or.table;
+      if (u == NULL || !u->known || !mpc_or_table_current(u)) {
+        return 0;
+      }
+      for (j = 0; j < u->rules_num; j++) {
+        mpc_or_table_rule(t, u->rules[j], u->versions[j]);
+      }
+      memcpy(first, u->first, 32);
+      *fails = p;
+      return 1;
+
+    default:
+      return 0;
+  }
+}
+
+static void mpc_optimise_or(mpc_parser_t* p) {
+
+  int j, k, c, known = 0;
+  int n = p->data.or.n;
+  unsigned char* firsts;
+  char* row;
+  mpc_or_table_t* t;
+
+  mpc_or_table_delete(p->data.or.table);
+  p->data.or.table = NULL;
+
+  if (n == 0) {
+    return;
+  }
+
+  t = malloc(sizeof(mpc_or_table_t));
+  t->fails = malloc(sizeof(mpc_parser_t*) * n);
+  t->known = 1;
+  t->tries = NULL;
+  t->rules = NULL;
+  t->versions = NULL;
+  t->rules_num = 0;
+  memset(t->first, 0, 32);
+  firsts = malloc(32 * n);
+
+  for (j = 0; j < n; j++) {
+    if (mpc_first(p->data.or.xs[j], firsts + 32 * j, &t->fails[j], 0, t)) {
+      known++;
+    } else {
+      memset(firsts + 32 * j, 0xFF, 32);
+      t->known = 0;
+    }
+    for (c = 0; c < 32; c++) {
+      t->first[c] |= firsts[32 * j + c];
+    }
+  }
+
+  if (known == 0) {
+    free(firsts);
+    mpc_or_table_delete(t);
+    return;
+  }
+
+  /* Characters on which the same alternatives are tried share a class */
+  t->classes_num = 0;
+  t->tries = NULL;
+  row = malloc(n);
+  for (c = 0; c < 256; c++) {
+    for (j = 0; j < n; j++) {
+      row[j] = mpc_first_has(firsts + 32 * j, c) != 0;
+    }
+    for (k = 0; k < t->classes_num; k++) {
+      if (memcmp(t->tries + k * n, row, n) == 0) {
+        break;
+      }
+    }
+    if (k == t->classes_num) {
+      t->classes_num++;
+      t->tries = realloc(t->tries, n * t->classes_num);
+      memcpy(t->tries + k * n, row, n);
+    }
+    t->classes[c] = (unsigned char)k;
+  }
+
+  free(row);
+  free(firsts);
+  p->data.or.table = t;
 }
 
 static void mpc_optimise_unretained(mpc_parser_t* p, int force) {
@@ -4474,6 +7033,15 @@ static void mpc_optimise_unretained(mpc_parser_t* p, int force) {
   if (p->type == MPC_TYPE_PREDICT) {
     mpc_optimise_unretained(p->data.predict.x, 0);
   }
+  if (p->type == MPC_TYPE_MEMO) {
+    mpc_optimise_unretained(p->data.memo.x, 0);
+  }
+  if (p->type == MPC_TYPE_DFA) {
+    mpc_optimise_unretained(p->data.dfa.x, 0);
+  }
+  if (p->type == MPC_TYPE_ARENA) {
+    mpc_optimise_unretained(p->data.arena.x, 0);
+  }
   if (p->type == MPC_TYPE_NOT) {
     mpc_optimise_unretained(p->data.not.x, 0);
   }
@@ -4521,6 +7089,7 @@ static void mpc_optimise_unretained(mpc_parser_t* p, int force) {
           realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m - 1));
       memmove(p->data.or.xs + n - 1, t->data.or.xs, m * sizeof(mpc_parser_t*));
       free(t->data.or.xs);
+      mpc_or_table_delete(t->data.or.table);
       free(t->name);
       free(t);
       continue;
@@ -4543,6 +7112,7 @@ static void mpc_optimise_unretained(mpc_parser_t* p, int force) {
               (n - 1) * sizeof(mpc_parser_t*));
       memmove(p->data.or.xs, t->data.or.xs, m * sizeof(mpc_parser_t*));
       free(t->data.or.xs);
+      mpc_or_table_delete(t->data.or.table);
       free(t->name);
       free(t);
       continue;
@@ -4679,7 +7249,12 @@ static void mpc_optimise_unretained(mpc_parser_t* p, int force) {
       continue;
     }
 
-    return;
+    break;
+  }
+
+  /* Skip `or` alternatives by the next character */
+  if (p->type == MPC_TYPE_OR) {
+    mpc_optimise_or(p);
   }
 }
 
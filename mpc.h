@@ -87,6 +87,8 @@ typedef mpc_val_t* (*mpc_apply_t)(mpc_val_t*);
 typedef mpc_val_t* (*mpc_apply_to_t)(mpc_val_t*, void*);
 typedef mpc_val_t* (*mpc_fold_t)(int, mpc_val_t**);
 
+typedef mpc_val_t* (*mpc_dup_t)(mpc_val_t*);
+
 typedef int (*mpc_check_t)(mpc_val_t**);
 typedef int (*mpc_check_with_t)(mpc_val_t**, void*);
 
@@ -154,6 +156,7 @@ mpc_parser_t* mpc_or(int n, ...);
 mpc_parser_t* mpc_and(int n, mpc_fold_t f, ...);
 
 mpc_parser_t* mpc_predictive(mpc_parser_t* a);
+mpc_parser_t* mpc_memo(mpc_parser_t* a, mpc_dup_t c, mpc_dtor_t da);
 
 /*
 ** Common Parsers
@@ -279,9 +282,16 @@ enum {
   MPC_RE_M = 1,
   MPC_RE_S = 2,
   MPC_RE_MULTILINE = 1,
-  MPC_RE_DOTALL = 2
+  MPC_RE_DOTALL = 2,
+  MPC_RE_NO_DFA = 4
 };
 
+/*
+** Regexes are compiled to a DFA where it gives the same
+** results as their combinators. MPC_RE_NO_DFA keeps the
+** combinators alone.
+*/
+
 mpc_parser_t* mpc_re(const char* re);
 mpc_parser_t* mpc_re_mode(const char* re, int mode);
 
@@ -289,12 +299,16 @@ mpc_parser_t* mpc_re_mode(const char* re, int mode);
 ** AST
 */
 
+struct mpc_ast_arena_t;
+
 typedef struct mpc_ast_t {
   char* tag;
   char* contents;
   mpc_state_t state;
   int children_num;
   struct mpc_ast_t** children;
+  int id;
+  struct mpc_ast_arena_t* arena;
 } mpc_ast_t;
 
 mpc_ast_t* mpc_ast_new(const char* tag, const char* contents);
@@ -349,6 +363,7 @@ mpc_parser_t* mpca_add_tag(mpc_parser_t* a, const char* t);
 mpc_parser_t* mpca_root(mpc_parser_t* a);
 mpc_parser_t* mpca_state(mpc_parser_t* a);
 mpc_parser_t* mpca_total(mpc_parser_t* a);
+mpc_parser_t* mpca_arena(mpc_parser_t* a);
 
 mpc_parser_t* mpca_not(mpc_parser_t* a);
 mpc_parser_t* mpca_maybe(mpc_parser_t* a);
@@ -363,7 +378,9 @@ mpc_parser_t* mpca_and(int n, ...);
 enum {
   MPCA_LANG_DEFAULT = 0,
   MPCA_LANG_PREDICTIVE = 1,
-  MPCA_LANG_WHITESPACE_SENSITIVE = 2
+  MPCA_LANG_WHITESPACE_SENSITIVE = 2,
+  MPCA_LANG_PACKRAT = 4,
+  MPCA_LANG_ARENA = 8
 };
 
 mpc_parser_t* mpca_grammar(int flags, const char* grammar, ...);
@@ -381,6 +398,10 @@ void mpc_print(mpc_parser_t* p);
 void mpc_optimise(mpc_parser_t* p);
 void mpc_stats(mpc_parser_t* p);
 
+#ifdef MPC_COUNT_TRIES
+void mpc_or_counts(unsigned long* tried, unsigned long* skipped);
+#endif
+
 int mpc_test_pass(mpc_parser_t* p, const char* s, const void* d,
                   int (*tester)(const void*, const void*),
                   mpc_dtor_t destructor, void (*printer)(const void*));
@@ -393,4 +414,4 @@ int mpc_test_fail(mpc_parser_t* p, const char* s, const void* d,
 }
 #endif
 
-#endif
\ No newline at end of file
+#endif
\ No newline at end of file
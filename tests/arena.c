@@ -0,0 +1,110 @@
+/*
+** Checks that trees built by parsers wrapped in
+** mpca_arena are each wholly in one arena or wholly on
+** the heap, whatever callbacks and nested parses do.
+*/
+
+#include "mpc.h"
+#include "check.h"
+
+/* Whether every node of a is in the arena m */
+static int all_in(mpc_ast_t* a, struct mpc_ast_arena_t* m) {
+  int j;
+  if (a->arena != m) { return 0; }
+  for (j = 0; j < a->children_num; j++) {
+    if (!all_in(a->children[j], m)) { return 0; }
+  }
+  return 1;
+}
+
+static mpc_parser_t* Word;
+static mpc_parser_t* Words;
+
+static mpc_ast_t* parse(const char* s) {
+  mpc_result_t r;
+  if (!mpc_parse("<test>", s, Words, &r)) {
+    mpc_err_print(r.error);
+    mpc_err_delete(r.error);
+    return NULL;
+  }
+  return r.output;
+}
+
+static int user_heap = 0;
+static int nested_ok = 0;
+
+static mpc_val_t* user_node(mpc_val_t* x) {
+  mpc_ast_t* a = mpc_ast_new("user", x);
+  user_heap = a->arena == NULL;
+  free(x);
+  return a;
+}
+
+static mpc_val_t* nested_parse(mpc_val_t* x) {
+  mpc_ast_t* a = parse("in side");
+  nested_ok = a && a->arena && all_in(a, a->arena);
+  mpc_ast_delete(a);
+  return mpcf_str_ast(x);
+}
+
+int main(void) {
+
+  mpc_parser_t* user;
+  mpc_parser_t* nested;
+  mpc_ast_t *a, *b, *c;
+  mpc_val_t* xs[2];
+  mpc_result_t r;
+
+  Word = mpc_new("word");
+  Words = mpc_new("words");
+  mpca_lang(MPCA_LANG_ARENA,
+    " word  : /[a-z]+/ ;          "
+    " words : /^/ <word>+ /$/ ;   ",
+    Word, Words, NULL);
+
+  puts("arena grammars");
+  a = parse("some words here");
+  check(a && a->arena != NULL, "give trees in an arena");
+  check(a && all_in(a, a->arena), "with every node in it");
+  b = parse("more words");
+  check(b && a && b->arena != a->arena, "one arena per parse");
+
+  puts("callbacks");
+  user = mpca_arena(mpca_and(2,
+    mpca_tag(mpc_apply(mpc_re("[a-z]+"), mpcf_str_ast), "word"),
+    mpc_apply(mpc_re(" [a-z]+"), user_node)));
+  check(mpc_parse("<test>", "ab cd", user, &r), "parse");
+  check(user_heap, "get heap nodes from mpc_ast_new");
+  c = r.output;
+  check(c->arena && all_in(c, c->arena), "which are copied into the arena");
+  mpc_ast_delete(c);
+
+  puts("nested parses");
+  nested = mpca_arena(mpca_and(2,
+    mpca_tag(mpc_apply(mpc_re("[a-z]+"), nested_parse), "outer"),
+    mpca_tag(mpc_apply(mpc_re(" [a-z]+"), mpcf_str_ast), "outer")));
+  check(mpc_parse("<test>", "ab cd", nested, &r), "parse");
+  check(nested_ok, "get trees in their own arena");
+  c = r.output;
+  check(c->arena && all_in(c, c->arena), "leaving the outer tree whole");
+  mpc_ast_delete(c);
+
+  puts("mixing");
+  c = mpc_ast_new("heap", "x");
+  xs[0] = c;
+  xs[1] = a->children[1];
+  c = mpcf_fold_ast(2, xs);
+  check(all_in(c, NULL), "mpcf_fold_ast copies arena nodes to the heap");
+  mpc_ast_add_child(b, mpc_ast_new("heap", "y"));
+  check(all_in(b, b->arena), "mpc_ast_add_child copies into the arena");
+  mpc_ast_add_child(c, b);
+  check(all_in(c, NULL), "a whole arena tree is copied out and freed");
+  mpc_ast_delete(c);
+  mpc_ast_delete(a);
+
+  mpc_delete(user);
+  mpc_delete(nested);
+  mpc_cleanup(2, Word, Words);
+
+  return failed;
+}
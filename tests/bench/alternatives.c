@@ -0,0 +1,79 @@
+/*
+** Counts the alternatives of `or` parsers that the Lispy
+** grammar parses, and those its first-set tables skip, on
+** Chapter 14/std.lspy and on a long run of code. Without
+** tables every skipped alternative would be parsed too.
+**
+** Needs -DMPC_COUNT_TRIES.
+*/
+
+#include <time.h>
+#include "mpc.h"
+
+static const char* line =
+  "(fun {f x} {if (> x 0) {f (- x 1)} {\"done\"}}) ; a comment\n";
+
+static void count(const char* what, mpc_parser_t* p, const char* filename,
+                  const char* input) {
+
+  mpc_result_t r;
+  unsigned long tried, skipped;
+  clock_t start = clock();
+  double secs;
+  int ok = input ? mpc_parse(filename, input, p, &r)
+                 : mpc_parse_contents(filename, p, &r);
+
+  secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+  if (!ok) {
+    mpc_err_print(r.error);
+    mpc_err_delete(r.error);
+    exit(1);
+  }
+  mpc_ast_delete(r.output);
+
+  mpc_or_counts(&tried, &skipped);
+  printf("%-10s %10lu %10lu %10lu %8.3fs\n", what, tried, skipped,
+         tried + skipped, secs);
+}
+
+int main(void) {
+
+  mpc_parser_t* Number = mpc_new("number");
+  mpc_parser_t* Symbol = mpc_new("symbol");
+  mpc_parser_t* String = mpc_new("string");
+  mpc_parser_t* Comment = mpc_new("comment");
+  mpc_parser_t* Sexpr = mpc_new("sexpr");
+  mpc_parser_t* Qexpr = mpc_new("qexpr");
+  mpc_parser_t* Expr = mpc_new("expr");
+  mpc_parser_t* Lispy = mpc_new("lispy");
+  size_t len = strlen(line);
+  int n = 20000;
+  char* code = malloc(len * n + 1);
+  unsigned long tried, skipped;
+  int j;
+
+  mpca_lang(MPCA_LANG_DEFAULT,
+    " number  : /-?[0-9]+/ ;                       "
+    " symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ; "
+    " string  : /\"(\\\\.|[^\"])*\"/ ;             "
+    " comment : /;[^\\r\\n]*/ ;                    "
+    " sexpr   : '(' <expr>* ')' ;                  "
+    " qexpr   : '{' <expr>* '}' ;                  "
+    " expr    : <number>  | <symbol> | <string>    "
+    "         | <comment> | <sexpr>  | <qexpr> ;   "
+    " lispy   : /^/ <expr>* /$/ ;                  ",
+    Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy, NULL);
+  mpc_or_counts(&tried, &skipped);
+
+  for (j = 0; j < n; j++) { memcpy(code + len * j, line, len); }
+  code[len * n] = '\0';
+
+  printf("%-10s %10s %10s %10s %9s\n", "input", "tried", "skipped",
+         "no tables", "time");
+  count("std.lspy", Lispy, "Chapter 14/std.lspy", NULL);
+  count("code", Lispy, "<code>", code);
+
+  free(code);
+  mpc_cleanup(8, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+  return 0;
+}
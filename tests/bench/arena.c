@@ -0,0 +1,114 @@
+/*
+** Counts the allocations made parsing the Lispy grammar
+** with and without MPCA_LANG_ARENA, on Chapter 14/std.lspy
+** and on a long run of code, and times parsing, walking
+** and deleting the trees. The walk reads every tag and
+** contents, as lval_read does. The counts take in
+** everything from reading the input to deleting the tree.
+**
+** Needs -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc.
+*/
+
+#include <time.h>
+#include "mpc.h"
+
+void* __real_malloc(size_t n);
+void* __real_calloc(size_t n, size_t m);
+void* __real_realloc(void* p, size_t n);
+
+static unsigned long allocs = 0;
+
+void* __wrap_malloc(size_t n) { allocs++; return __real_malloc(n); }
+void* __wrap_calloc(size_t n, size_t m) { allocs++; return __real_calloc(n, m); }
+void* __wrap_realloc(void* p, size_t n) { allocs++; return __real_realloc(p, n); }
+
+static const char* line =
+  "(fun {f x} {if (> x 0) {f (- x 1)} {\"done\"}}) ; a comment\n";
+
+static size_t walk(mpc_ast_t* a) {
+  size_t n = strlen(a->tag) + strlen(a->contents);
+  int j;
+  for (j = 0; j < a->children_num; j++) { n += walk(a->children[j]); }
+  return n;
+}
+
+static int parse(mpc_parser_t* p, const char* filename, const char* input) {
+  mpc_result_t r;
+  int ok = input ? mpc_parse(filename, input, p, &r)
+                 : mpc_parse_contents(filename, p, &r);
+  if (!ok) {
+    mpc_err_print(r.error);
+    mpc_err_delete(r.error);
+    exit(1);
+  }
+  ok = walk(r.output) > 0;
+  mpc_ast_delete(r.output);
+  return ok;
+}
+
+static void count(const char* what, mpc_parser_t* p, const char* filename,
+                  const char* input, int reps) {
+
+  unsigned long before = allocs;
+  clock_t start;
+  double secs;
+  int j;
+
+  parse(p, filename, input);
+  printf("%-16s %12lu", what, allocs - before);
+
+  start = clock();
+  for (j = 0; j < reps; j++) { parse(p, filename, input); }
+  secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+  printf(" %10.3fms\n", secs * 1000 / reps);
+}
+
+static void run(const char* what, int flags, const char* code) {
+
+  mpc_parser_t* Number = mpc_new("number");
+  mpc_parser_t* Symbol = mpc_new("symbol");
+  mpc_parser_t* String = mpc_new("string");
+  mpc_parser_t* Comment = mpc_new("comment");
+  mpc_parser_t* Sexpr = mpc_new("sexpr");
+  mpc_parser_t* Qexpr = mpc_new("qexpr");
+  mpc_parser_t* Expr = mpc_new("expr");
+  mpc_parser_t* Lispy = mpc_new("lispy");
+  char name[32];
+
+  mpca_lang(flags,
+    " number  : /-?[0-9]+/ ;                       "
+    " symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ; "
+    " string  : /\"(\\\\.|[^\"])*\"/ ;             "
+    " comment : /;[^\\r\\n]*/ ;                    "
+    " sexpr   : '(' <expr>* ')' ;                  "
+    " qexpr   : '{' <expr>* '}' ;                  "
+    " expr    : <number>  | <symbol> | <string>    "
+    "         | <comment> | <sexpr>  | <qexpr> ;   "
+    " lispy   : /^/ <expr>* /$/ ;                  ",
+    Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy, NULL);
+
+  sprintf(name, "std.lspy %s", what);
+  count(name, Lispy, "Chapter 14/std.lspy", NULL, 100);
+  sprintf(name, "code %s", what);
+  count(name, Lispy, "<code>", code, 5);
+
+  mpc_cleanup(8, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+}
+
+int main(void) {
+
+  size_t len = strlen(line);
+  int n = 20000;
+  char* code = malloc(len * n + 1);
+  int j;
+
+  for (j = 0; j < n; j++) { memcpy(code + len * j, line, len); }
+  code[len * n] = '\0';
+
+  printf("%-16s %12s %12s\n", "input", "allocations", "time");
+  run("malloc", MPCA_LANG_DEFAULT, code);
+  run("arena", MPCA_LANG_ARENA, code);
+
+  free(code);
+  return 0;
+}
@@ -0,0 +1,130 @@
+/*
+** Times a grammar that backtracks exponentially unless
+** parsed with packrat. In
+**
+**   e : <t> '+' <e> | <t> ;
+**   t : '(' <e> ')' | 'n' ;
+**
+** both alternatives of e begin with t, so without packrat
+** every level of nesting parses the levels inside it twice.
+** Each case is timed on ((...(n)...)) nested to some depth,
+** as a recogniser built from combinators with NULL outputs
+** and as ASTs built by mpca_lang.
+*/
+
+#include <time.h>
+#include "mpc.h"
+
+static mpc_val_t* dup_null(mpc_val_t* x) { return x; }
+
+static mpc_val_t* fold_free(int n, mpc_val_t** xs) {
+  int j;
+  for (j = 0; j < n; j++) { free(xs[j]); }
+  return NULL;
+}
+
+static char* nested(int depth) {
+  char* s = malloc(depth * 2 + 2);
+  int j;
+  for (j = 0; j < depth; j++) {
+    s[j] = '(';
+    s[depth + 1 + j] = ')';
+  }
+  s[depth] = 'n';
+  s[depth * 2 + 1] = '\0';
+  return s;
+}
+
+static double recognise(int packrat, int depth) {
+
+  mpc_parser_t* e = mpc_new("e");
+  mpc_parser_t* t = mpc_new("t");
+  mpc_parser_t* top = mpc_whole(e, free);
+  mpc_parser_t* ea = mpc_or(2,
+    mpc_and(3, fold_free, t, mpc_char('+'), e, free, free), t);
+  mpc_parser_t* ta = mpc_or(2,
+    mpc_and(3, fold_free, mpc_char('('), e, mpc_char(')'), free, free),
+    mpc_and(1, fold_free, mpc_char('n')));
+  char* s = nested(depth);
+  mpc_result_t r;
+  clock_t start;
+  double secs;
+
+  mpc_define(e, packrat ? mpc_memo(ea, dup_null, free) : ea);
+  mpc_define(t, packrat ? mpc_memo(ta, dup_null, free) : ta);
+
+  start = clock();
+  if (!mpc_parse("<bench>", s, top, &r)) {
+    mpc_err_print(r.error);
+    mpc_err_delete(r.error);
+    exit(1);
+  }
+  secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  free(s);
+  mpc_delete(top);
+  mpc_cleanup(2, e, t);
+  return secs;
+}
+
+static double build(int packrat, int depth) {
+
+  mpc_parser_t* e = mpc_new("e");
+  mpc_parser_t* t = mpc_new("t");
+  mpc_parser_t* top = mpc_new("top");
+  char* s = nested(depth);
+  mpc_result_t r;
+  mpc_err_t* err;
+  clock_t start;
+  double secs;
+
+  err = mpca_lang(packrat ? MPCA_LANG_PACKRAT : MPCA_LANG_DEFAULT,
+    " e   : <t> '+' <e> | <t> ;         "
+    " t   : '(' <e> ')' | 'n' ;         "
+    " top : /^/ <e> /$/ ;               ",
+    e, t, top, NULL);
+  if (err) {
+    mpc_err_print(err);
+    mpc_err_delete(err);
+    exit(1);
+  }
+
+  start = clock();
+  if (!mpc_parse("<bench>", s, top, &r)) {
+    mpc_err_print(r.error);
+    mpc_err_delete(r.error);
+    exit(1);
+  }
+  secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  mpc_ast_delete(r.output);
+  free(s);
+  mpc_cleanup(3, e, t, top);
+  return secs;
+}
+
+static void row(const char* name, double (*f)(int, int), int packrat,
+                const int* depths) {
+  int j;
+  printf("%-22s", name);
+  for (j = 0; depths[j]; j++) {
+    printf("  d=%-5d %7.3fs", depths[j], f(packrat, depths[j]));
+  }
+  printf("\n");
+}
+
+int main(void) {
+
+  const int small[] = { 12, 15, 18, 0 };
+  const int large[] = { 1000, 2000, 4000, 0 };
+  const int ast[] = { 100, 200, 400, 0 };
+
+  row("recogniser, plain", recognise, 0, small);
+  row("recogniser, packrat", recognise, 1, small);
+  row("recogniser, packrat", recognise, 1, large);
+  row("mpca_lang, plain", build, 0, small);
+  row("mpca_lang, packrat", build, 1, small);
+  row("mpca_lang, packrat", build, 1, ast);
+
+  return 0;
+}
@@ -0,0 +1,33 @@
+#!/bin/sh
+# Builds each tests/bench/*.c against mpc.c and runs it.
+#
+# Usage: tests/bench/bench.sh [files...]   (from the top folder)
+#
+# Each benchmark prints its own timings. One that needs extra flags to
+# build, such as a define for mpc.c, says so with a line "** Needs -DFLAG."
+# in its header. One that is also to be built and run a second time with
+# more flags, such as to compare parsing engines, has a line
+# "** Also with -DFLAG." too. pipe.c parses 100 MB, which takes about a
+# minute, so give the others by name to skip it. Set CC or CFLAGS to change
+# how they are built.
+
+cd "$(dirname "$0")/../.." || exit 1
+
+FILES=${*:-tests/bench/*.c}
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:-"-std=c11 -O2"}
+BIN=${TMPDIR:-/tmp}/mpc-bench.$$
+
+trap 'rm -f "$BIN"' EXIT
+
+for f in $FILES; do
+  echo "$f"
+  FLAGS=$(sed -n 's/^\*\* Needs \(-.*\)\.$/\1/p' "$f")
+  ALSO=$(sed -n 's/^\*\* Also with \(-.*\)\.$/\1/p' "$f")
+  $CC $CFLAGS $FLAGS -I. "$f" mpc.c -lm -o "$BIN" && "$BIN" || exit 1
+  if [ -n "$ALSO" ]; then
+    echo "$f $ALSO"
+    $CC $CFLAGS $FLAGS $ALSO -I. "$f" mpc.c -lm -o "$BIN" && "$BIN" || exit 1
+  fi
+done
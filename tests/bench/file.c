@@ -0,0 +1,105 @@
+/*
+** Times Lispy expressions read from a regular file in
+** MB/s, through mpc_parse_contents, which maps the file
+** into memory, and through mpc_parse_file, which reads it
+** into a buffer in chunks. The top rule frees each
+** expression's AST as soon as it is parsed.
+*/
+
+#include <time.h>
+#include "mpc.h"
+
+static const char* line =
+  "(def {xs} {1 -2 \"three\" (+ 4 5)}) ; a comment\n";
+
+static const char* path = "mpc-bench-file.lspy";
+
+static mpc_val_t* ast_free(mpc_val_t* x) {
+  mpc_ast_delete(x);
+  return NULL;
+}
+
+static mpc_val_t* fold_null(int n, mpc_val_t** xs) {
+  (void)n; (void)xs;
+  return NULL;
+}
+
+/* Writes lines to path until it holds at least mb megabytes */
+static void make_file(int mb) {
+  size_t len = strlen(line);
+  size_t total = (size_t)mb * 1024 * 1024;
+  size_t sent;
+  FILE* f = fopen(path, "wb");
+  if (!f) { exit(1); }
+  for (sent = 0; sent < total; sent += len) { fputs(line, f); }
+  fclose(f);
+}
+
+static double parse(mpc_parser_t* top, int contents) {
+
+  mpc_result_t r;
+  clock_t start = clock();
+  double secs;
+  FILE* f = NULL;
+  int ok;
+
+  if (contents) {
+    ok = mpc_parse_contents(path, top, &r);
+  } else {
+    f = fopen(path, "rb");
+    ok = mpc_parse_file(path, f, top, &r);
+  }
+  if (!ok) {
+    mpc_err_print(r.error);
+    mpc_err_delete(r.error);
+    exit(1);
+  }
+  secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  if (f) { fclose(f); }
+  return secs;
+}
+
+int main(void) {
+
+  mpc_parser_t* Number = mpc_new("number");
+  mpc_parser_t* Symbol = mpc_new("symbol");
+  mpc_parser_t* String = mpc_new("string");
+  mpc_parser_t* Comment = mpc_new("comment");
+  mpc_parser_t* Sexpr = mpc_new("sexpr");
+  mpc_parser_t* Qexpr = mpc_new("qexpr");
+  mpc_parser_t* Expr = mpc_new("expr");
+  mpc_parser_t* top;
+  int sizes[] = { 1, 10 };
+  int j;
+
+  mpca_lang(MPCA_LANG_DEFAULT,
+    " number  : /-?[0-9]+/ ;                       "
+    " symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ; "
+    " string  : /\"(\\\\.|[^\"])*\"/ ;             "
+    " comment : /;[^\\r\\n]*/ ;                    "
+    " sexpr   : '(' <expr>* ')' ;                  "
+    " qexpr   : '{' <expr>* '}' ;                  "
+    " expr    : <number>  | <symbol> | <string>    "
+    "         | <comment> | <sexpr>  | <qexpr> ;   ",
+    Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, NULL);
+
+  top = mpc_and(3, fold_null,
+    mpc_soi(), mpc_many(fold_null, mpc_apply(mpc_copy(Expr), ast_free)),
+    mpc_eoi(), free, free);
+
+  printf("%-8s %12s %12s\n", "size", "contents", "file");
+  for (j = 0; j < 2; j++) {
+    double mapped, read;
+    make_file(sizes[j]);
+    mapped = parse(top, 1);
+    read = parse(top, 0);
+    printf("%4d MB  %7.2f MB/s %7.2f MB/s\n", sizes[j],
+           sizes[j] / mapped, sizes[j] / read);
+  }
+  remove(path);
+
+  mpc_delete(top);
+  mpc_cleanup(7, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr);
+  return 0;
+}
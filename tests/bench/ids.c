@@ -0,0 +1,126 @@
+/*
+** Times the read phase of Chapter 14's lval_read over trees
+** the Lispy grammar has already parsed, from std.lspy and
+** from a long run of code. Each walk sorts every node into
+** numbers, strings, symbols and expressions, skipping
+** brackets, anchors and comments, first by searching its
+** tag and contents as lval_read used to and then by
+** switching on the id mpca_lang gave it.
+*/
+
+#include <time.h>
+#include "mpc.h"
+
+/* The ids of the rules, in the order they are passed to mpca_lang */
+enum { NUMBER = 1, SYMBOL, STRING, COMMENT, SEXPR, QEXPR, EXPR, LISPY };
+
+static const char* line =
+  "(fun {f x} {if (> x 0) {f (- x 1)} {\"done\"}}) ; a comment\n";
+
+static void by_tag(mpc_ast_t* t, long* kinds) {
+  int i;
+  if (strstr(t->tag, "number")) { kinds[NUMBER]++; return; }
+  if (strstr(t->tag, "string")) { kinds[STRING]++; return; }
+  if (strstr(t->tag, "symbol")) { kinds[SYMBOL]++; return; }
+  if (strcmp(t->tag, ">") == 0) { kinds[SEXPR]++; }
+  if (strstr(t->tag, "sexpr")) { kinds[SEXPR]++; }
+  if (strstr(t->tag, "qexpr")) { kinds[QEXPR]++; }
+  for (i = 0; i < t->children_num; i++) {
+    if (strcmp(t->children[i]->contents, "(") == 0) { continue; }
+    if (strcmp(t->children[i]->contents, ")") == 0) { continue; }
+    if (strcmp(t->children[i]->contents, "}") == 0) { continue; }
+    if (strcmp(t->children[i]->contents, "{") == 0) { continue; }
+    if (strcmp(t->children[i]->tag, "regex") == 0) { continue; }
+    if (strstr(t->children[i]->tag, "comment")) { continue; }
+    by_tag(t->children[i], kinds);
+  }
+}
+
+static void by_id(mpc_ast_t* t, long* kinds) {
+  int i;
+  switch (t->id) {
+    case NUMBER: kinds[NUMBER]++; return;
+    case STRING: kinds[STRING]++; return;
+    case SYMBOL: kinds[SYMBOL]++; return;
+    case QEXPR: kinds[QEXPR]++; break;
+    default: kinds[SEXPR]++; break;
+  }
+  for (i = 0; i < t->children_num; i++) {
+    int id = t->children[i]->id;
+    if (id == 0 || id == COMMENT) { continue; }
+    by_id(t->children[i], kinds);
+  }
+}
+
+static double walk(void (*f)(mpc_ast_t*, long*), mpc_ast_t* t, int reps,
+                   long* kinds) {
+  clock_t start = clock();
+  int j;
+  for (j = 0; j < reps; j++) { f(t, kinds); }
+  return (double)(clock() - start) / CLOCKS_PER_SEC * 1000 / reps;
+}
+
+static void time_reads(const char* what, mpc_parser_t* p,
+                       const char* filename, const char* input, int reps) {
+
+  mpc_result_t r;
+  long tags[LISPY + 1] = { 0 }, ids[LISPY + 1] = { 0 };
+  double t, i;
+  int ok = input ? mpc_parse(filename, input, p, &r)
+                 : mpc_parse_contents(filename, p, &r);
+
+  if (!ok) {
+    mpc_err_print(r.error);
+    mpc_err_delete(r.error);
+    exit(1);
+  }
+
+  t = walk(by_tag, r.output, reps, tags);
+  i = walk(by_id, r.output, reps, ids);
+  if (memcmp(tags, ids, sizeof(tags)) != 0) {
+    printf("%s: tags and ids disagree\n", what);
+    exit(1);
+  }
+  printf("%-10s %10.3fms %10.3fms %8.2fx\n", what, t, i, t / i);
+
+  mpc_ast_delete(r.output);
+}
+
+int main(void) {
+
+  mpc_parser_t* Number = mpc_new("number");
+  mpc_parser_t* Symbol = mpc_new("symbol");
+  mpc_parser_t* String = mpc_new("string");
+  mpc_parser_t* Comment = mpc_new("comment");
+  mpc_parser_t* Sexpr = mpc_new("sexpr");
+  mpc_parser_t* Qexpr = mpc_new("qexpr");
+  mpc_parser_t* Expr = mpc_new("expr");
+  mpc_parser_t* Lispy = mpc_new("lispy");
+  size_t len = strlen(line);
+  int n = 20000;
+  char* code = malloc(len * n + 1);
+  int j;
+
+  mpca_lang(MPCA_LANG_DEFAULT,
+    " number  : /-?[0-9]+/ ;                       "
+    " symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ; "
+    " string  : /\"(\\\\.|[^\"])*\"/ ;             "
+    " comment : /;[^\\r\\n]*/ ;                    "
+    " sexpr   : '(' <expr>* ')' ;                  "
+    " qexpr   : '{' <expr>* '}' ;                  "
+    " expr    : <number>  | <symbol> | <string>    "
+    "         | <comment> | <sexpr>  | <qexpr> ;   "
+    " lispy   : /^/ <expr>* /$/ ;                  ",
+    Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy, NULL);
+
+  for (j = 0; j < n; j++) { memcpy(code + len * j, line, len); }
+  code[len * n] = '\0';
+
+  printf("%-10s %12s %12s %9s\n", "input", "tags", "ids", "speedup");
+  time_reads("std.lspy", Lispy, "Chapter 14/std.lspy", NULL, 1000);
+  time_reads("code", Lispy, "<code>", code, 10);
+
+  free(code);
+  mpc_cleanup(8, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+  return 0;
+}
@@ -0,0 +1,102 @@
+/*
+** Times the Lispy grammar on (x {x (x ... )}) nested to
+** increasing depths, with the engine mpc.c was built
+** with: the default iterative one, or the recursive one
+** of MPC_PARSE_RECURSIVE. The recursive engine uses C
+** stack for every level, so it is only given depths an
+** 8 MB stack holds; the rest print as -.
+**
+** Also with -DMPC_PARSE_RECURSIVE.
+*/
+
+#include <time.h>
+#include "mpc.h"
+
+#ifdef MPC_PARSE_RECURSIVE
+static const char* engine = "recursive";
+static const int max_depth = 4000;
+#else
+static const char* engine = "iterative";
+static const int max_depth = 1000000;
+#endif
+
+static char* nested(int depth) {
+  char* s = malloc(depth * 4 + 2);
+  char* p = s;
+  int j;
+  for (j = 0; j < depth; j++) {
+    *p++ = j % 2 ? '{' : '(';
+    *p++ = 'x';
+    *p++ = ' ';
+  }
+  for (j = depth - 1; j >= 0; j--) {
+    *p++ = j % 2 ? '}' : ')';
+  }
+  *p = '\0';
+  return s;
+}
+
+/* Milliseconds per parse of input nested to depth */
+static double parse(mpc_parser_t* p, int depth) {
+
+  char* input = nested(depth);
+  int reps = depth < 100000 ? 100000 / depth : 1;
+  mpc_result_t r;
+  clock_t start = clock();
+  double ms;
+  int j;
+
+  for (j = 0; j < reps; j++) {
+    if (!mpc_parse("<nested>", input, p, &r)) {
+      mpc_err_print(r.error);
+      mpc_err_delete(r.error);
+      exit(1);
+    }
+    mpc_ast_delete(r.output);
+  }
+  ms = (double)(clock() - start) / CLOCKS_PER_SEC * 1000 / reps;
+
+  free(input);
+  return ms;
+}
+
+int main(void) {
+
+  mpc_parser_t* Number = mpc_new("number");
+  mpc_parser_t* Symbol = mpc_new("symbol");
+  mpc_parser_t* String = mpc_new("string");
+  mpc_parser_t* Comment = mpc_new("comment");
+  mpc_parser_t* Sexpr = mpc_new("sexpr");
+  mpc_parser_t* Qexpr = mpc_new("qexpr");
+  mpc_parser_t* Expr = mpc_new("expr");
+  mpc_parser_t* Lispy = mpc_new("lispy");
+  int depths[] = { 100, 1000, 2000, 4000, 10000, 100000 };
+  int j;
+
+  mpca_lang(MPCA_LANG_DEFAULT,
+    " number  : /-?[0-9]+/ ;                       "
+    " symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ; "
+    " string  : /\"(\\\\.|[^\"])*\"/ ;             "
+    " comment : /;[^\\r\\n]*/ ;                    "
+    " sexpr   : '(' <expr>* ')' ;                  "
+    " qexpr   : '{' <expr>* '}' ;                  "
+    " expr    : <number>  | <symbol> | <string>    "
+    "         | <comment> | <sexpr>  | <qexpr> ;   "
+    " lispy   : /^/ <expr>* /$/ ;                  ",
+    Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy, NULL);
+
+  printf("%-10s %8s %12s %12s\n", engine, "depth", "ms", "us/level");
+  for (j = 0; j < 6; j++) {
+    double ms;
+    if (depths[j] > max_depth) {
+      printf("%-10s %8d %12s %12s\n", "", depths[j], "-", "-");
+      continue;
+    }
+    ms = parse(Lispy, depths[j]);
+    printf("%-10s %8d %12.3f %12.3f\n", "", depths[j], ms,
+           ms * 1000 / depths[j]);
+  }
+
+  mpc_cleanup(8, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+  return 0;
+}
@@ -0,0 +1,117 @@
+/*
+** Times Lispy expressions read through mpc_parse_pipe
+** from a pipe another process writes into, in MB/s. The
+** top rule frees each expression's AST as soon as it is
+** parsed, so only the input is held, not the trees.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "mpc.h"
+
+static const char* line =
+  "(def {xs} {1 -2 \"three\" (+ 4 5)}) ; a comment\n";
+
+static mpc_val_t* ast_free(mpc_val_t* x) {
+  mpc_ast_delete(x);
+  return NULL;
+}
+
+static mpc_val_t* fold_null(int n, mpc_val_t** xs) {
+  (void)n; (void)xs;
+  return NULL;
+}
+
+/* Writes lines to fd until at least mb megabytes have gone */
+static void writer(int fd, int mb) {
+  size_t len = strlen(line);
+  size_t total = (size_t)mb * 1024 * 1024;
+  size_t sent = 0;
+  char* chunk = malloc(len * 1024);
+  int j;
+  for (j = 0; j < 1024; j++) { memcpy(chunk + len * j, line, len); }
+  while (sent < total) {
+    ssize_t n = write(fd, chunk, len * 1024);
+    if (n <= 0) { break; }
+    sent += n;
+  }
+  free(chunk);
+}
+
+static double parse_pipe(mpc_parser_t* top, int mb) {
+
+  int fds[2];
+  pid_t pid;
+  FILE* f;
+  mpc_result_t r;
+  struct timespec start, end;
+
+  if (pipe(fds) != 0) { exit(1); }
+  pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    writer(fds[1], mb);
+    _exit(0);
+  }
+  close(fds[1]);
+  f = fdopen(fds[0], "r");
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (!mpc_parse_pipe("<pipe>", f, top, &r)) {
+    mpc_err_print(r.error);
+    mpc_err_delete(r.error);
+    exit(1);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  fclose(f);
+  waitpid(pid, NULL, 0);
+  return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+int main(void) {
+
+  mpc_parser_t* Number = mpc_new("number");
+  mpc_parser_t* Symbol = mpc_new("symbol");
+  mpc_parser_t* String = mpc_new("string");
+  mpc_parser_t* Comment = mpc_new("comment");
+  mpc_parser_t* Sexpr = mpc_new("sexpr");
+  mpc_parser_t* Qexpr = mpc_new("qexpr");
+  mpc_parser_t* Expr = mpc_new("expr");
+  mpc_parser_t* top;
+  int sizes[] = { 1, 10, 100 };
+  int j;
+  struct rusage ru;
+
+  mpca_lang(MPCA_LANG_DEFAULT,
+    " number  : /-?[0-9]+/ ;                       "
+    " symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ; "
+    " string  : /\"(\\\\.|[^\"])*\"/ ;             "
+    " comment : /;[^\\r\\n]*/ ;                    "
+    " sexpr   : '(' <expr>* ')' ;                  "
+    " qexpr   : '{' <expr>* '}' ;                  "
+    " expr    : <number>  | <symbol> | <string>    "
+    "         | <comment> | <sexpr>  | <qexpr> ;   ",
+    Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, NULL);
+
+  top = mpc_and(3, fold_null,
+    mpc_soi(), mpc_many(fold_null, mpc_apply(mpc_copy(Expr), ast_free)),
+    mpc_eoi(), free, free);
+
+  printf("%-8s %10s %10s\n", "size", "time", "MB/s");
+  for (j = 0; j < 3; j++) {
+    double secs = parse_pipe(top, sizes[j]);
+    printf("%4d MB  %9.3fs %10.2f\n", sizes[j], secs, sizes[j] / secs);
+  }
+  getrusage(RUSAGE_SELF, &ru);
+  printf("max RSS %ld MB\n", ru.ru_maxrss / 1024);
+
+  mpc_delete(top);
+  mpc_cleanup(7, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr);
+  return 0;
+}
@@ -0,0 +1,67 @@
+/*
+** Times the Lispy token regexes matched through their DFA
+** and through their combinators (MPC_RE_NO_DFA), each over
+** a long run of tokens, one to a line.
+*/
+
+#include <time.h>
+#include "mpc.h"
+
+static mpc_val_t* fold_free(int n, mpc_val_t** xs) {
+  int j;
+  for (j = 0; j < n; j++) { free(xs[j]); }
+  return NULL;
+}
+
+static char* repeat(const char* token, int n) {
+  size_t len = strlen(token);
+  char* s = malloc((len + 1) * n + 1);
+  int j;
+  for (j = 0; j < n; j++) {
+    memcpy(s + (len + 1) * j, token, len);
+    s[(len + 1) * j + len] = '\n';
+  }
+  s[(len + 1) * n] = '\0';
+  return s;
+}
+
+static double time_re(const char* re, int mode, const char* input) {
+
+  mpc_parser_t* p = mpc_many(fold_free,
+    mpc_and(2, fold_free, mpc_re_mode(re, mode), mpc_char('\n'), free));
+  mpc_result_t r;
+  clock_t start = clock();
+  double secs;
+
+  if (!mpc_parse("<bench>", input, p, &r)) {
+    mpc_err_print(r.error);
+    mpc_err_delete(r.error);
+    exit(1);
+  }
+  secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  mpc_delete(p);
+  return secs;
+}
+
+int main(void) {
+
+  const char* cases[][3] = {
+    { "number", "-?[0-9]+", "-1234567890" },
+    { "symbol", "[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+", "some-long-symbol-name!" },
+    { "string", "\"(\\\\.|[^\"])*\"", "\"a string with \\\"escapes\\\"\"" },
+    { "comment", ";[^\\r\\n]*", ";a-comment-that-runs-on" },
+  };
+  int j;
+
+  printf("%-10s %10s %10s\n", "regex", "dfa", "re");
+  for (j = 0; j < 4; j++) {
+    char* input = repeat(cases[j][2], 200000);
+    printf("%-10s %9.3fs %9.3fs\n", cases[j][0],
+           time_re(cases[j][1], MPC_RE_DEFAULT, input),
+           time_re(cases[j][1], MPC_RE_NO_DFA, input));
+    free(input);
+  }
+
+  return 0;
+}
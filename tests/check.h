@@ -0,0 +1,19 @@
+/*
+** The harness each test in tests/ includes. check prints
+** what it checked and whether it held; a test returns
+** failed from main so that run.sh sees any that did not.
+*/
+
+#ifndef check_h
+#define check_h
+
+#include <stdio.h>
+
+static int failed = 0;
+
+static void check(int ok, const char* what) {
+  printf("  %s %s\n", ok ? "ok  " : "FAIL", what);
+  if (!ok) { failed = 1; }
+}
+
+#endif
@@ -0,0 +1,154 @@
+/*
+** Checks the trees and errors a grammar gives, to be
+** built once with each parsing engine (the default
+** iterative one and MPC_PARSE_RECURSIVE), so that both
+** must give exactly the same. Input nested deeper than
+** the C stack allows is only given to the iterative
+** engine, since the recursive one overflows on it.
+*/
+
+#include "mpc.h"
+#include "check.h"
+
+static int error_is(mpc_parser_t* p, const char* s, const char* expected) {
+  mpc_result_t r;
+  char* e;
+  int ok;
+  if (mpc_parse("<test>", s, p, &r)) {
+    mpc_ast_delete(r.output);
+    return 0;
+  }
+  e = mpc_err_string(r.error);
+  ok = strcmp(e, expected) == 0;
+  if (!ok) {
+    printf("Got %sExpected %s", e, expected);
+  }
+  free(e);
+  mpc_err_delete(r.error);
+  return ok;
+}
+
+static int ast_is(mpc_parser_t* p, const char* s, mpc_ast_t* t) {
+  int ok = mpc_test_pass(p, s, t, (int (*)(const void*, const void*))mpc_ast_eq,
+                         (mpc_dtor_t)mpc_ast_delete,
+                         (void (*)(const void*))mpc_ast_print);
+  mpc_ast_delete(t);
+  return ok;
+}
+
+static void maths(int flags, const char* name) {
+
+  mpc_parser_t* Expr = mpc_new("expression");
+  mpc_parser_t* Prod = mpc_new("product");
+  mpc_parser_t* Value = mpc_new("value");
+  mpc_parser_t* Maths = mpc_new("maths");
+
+  mpca_lang(flags,
+    " expression : <product> (('+' | '-') <product>)*; "
+    " product    : <value>   (('*' | '/') <value>)*;   "
+    " value      : /[0-9]+/ | '(' <expression> ')';    "
+    " maths      : /^/ <expression> /$/;               ",
+    Expr, Prod, Value, Maths, NULL);
+
+  printf("maths, %s\n", name);
+
+  check(ast_is(Maths, "24", mpc_ast_build(3, ">",
+    mpc_ast_new("regex", ""),
+    mpc_ast_new("expression|product|value|regex", "24"),
+    mpc_ast_new("regex", ""))), "24");
+
+  check(ast_is(Maths, "(5)", mpc_ast_build(3, ">",
+    mpc_ast_new("regex", ""),
+    mpc_ast_build(3, "expression|product|value|>",
+      mpc_ast_new("char", "("),
+      mpc_ast_new("expression|product|value|regex", "5"),
+      mpc_ast_new("char", ")")),
+    mpc_ast_new("regex", ""))), "(5)");
+
+  check(ast_is(Maths, "1 + 2*3", mpc_ast_build(3, ">",
+    mpc_ast_new("regex", ""),
+    mpc_ast_build(3, "expression|>",
+      mpc_ast_new("product|value|regex", "1"),
+      mpc_ast_new("char", "+"),
+      mpc_ast_build(3, "product|>",
+        mpc_ast_new("value|regex", "2"),
+        mpc_ast_new("char", "*"),
+        mpc_ast_new("value|regex", "3"))),
+    mpc_ast_new("regex", ""))), "1 + 2*3");
+
+  /* Without backtracking the '+' is dropped, as it always has been */
+  if (flags & MPCA_LANG_PREDICTIVE) {
+    check(ast_is(Maths, "1+", mpc_ast_build(3, ">",
+      mpc_ast_new("regex", ""),
+      mpc_ast_new("expression|product|value|regex", "1"),
+      mpc_ast_new("regex", ""))), "1+");
+  } else {
+    check(error_is(Maths, "1+",
+      "<test>:1:3: error: expected one or more of one of '0123456789' or '('"
+      " at end of input\n"), "1+");
+  }
+  check(error_is(Maths, "(1",
+    "<test>:1:3: error: expected one of '0123456789', '*', '/', '+', '-' or"
+    " ')' at end of input\n"), "(1");
+  check(error_is(Maths, "a",
+    "<test>:1:1: error: expected one or more of one of '0123456789' or '('"
+    " at 'a'\n"), "a");
+
+  mpc_cleanup(4, Expr, Prod, Value, Maths);
+}
+
+static mpc_val_t* fold_free(int n, mpc_val_t** xs) {
+  int j;
+  for (j = 0; j < n; j++) { free(xs[j]); }
+  return NULL;
+}
+
+/* Parses n nested parens, returning 1 on success */
+static int nested(int n) {
+
+  mpc_parser_t* e = mpc_new("e");
+  mpc_parser_t* top = mpc_whole(e, free);
+  mpc_result_t r;
+  char* s = malloc(n * 2 + 2);
+  int j, ok;
+
+  mpc_define(e, mpc_or(2,
+    mpc_and(3, fold_free, mpc_char('('), e, mpc_char(')'), free, free),
+    mpc_char('n')));
+
+  for (j = 0; j < n; j++) {
+    s[j] = '(';
+    s[n + 1 + j] = ')';
+  }
+  s[n] = 'n';
+  s[n * 2 + 1] = '\0';
+
+  ok = mpc_parse("<test>", s, top, &r);
+  if (ok) {
+    free(r.output);
+  } else {
+    mpc_err_delete(r.error);
+  }
+
+  free(s);
+  mpc_delete(top);
+  mpc_cleanup(1, e);
+  return ok;
+}
+
+int main(void) {
+
+  maths(MPCA_LANG_DEFAULT, "default");
+  maths(MPCA_LANG_PREDICTIVE, "predictive");
+  maths(MPCA_LANG_PACKRAT, "packrat");
+  maths(MPCA_LANG_ARENA, "arena");
+  maths(MPCA_LANG_PACKRAT | MPCA_LANG_ARENA, "packrat arena");
+
+  puts("deep nesting");
+  check(nested(1000), "1000 levels");
+#ifndef MPC_PARSE_RECURSIVE
+  check(nested(100000), "100000 levels");
+#endif
+
+  return failed;
+}
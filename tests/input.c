@@ -0,0 +1,82 @@
+/*
+** Checks where mpc_parse_file and mpc_parse_pipe leave
+** the stream they were given, so a caller can go on
+** reading after what was parsed.
+*/
+
+#include "mpc.h"
+#include "check.h"
+
+static int parse(mpc_parser_t* p, FILE* f, int pipe) {
+  mpc_result_t r;
+  int ok = pipe ? mpc_parse_pipe("<test>", f, p, &r)
+                : mpc_parse_file("<test>", f, p, &r);
+  if (ok) {
+    free(r.output);
+  } else {
+    mpc_err_delete(r.error);
+  }
+  return ok;
+}
+
+static FILE* input(const char* s) {
+  FILE* f = tmpfile();
+  fputs(s, f);
+  rewind(f);
+  return f;
+}
+
+int main(void) {
+
+  mpc_parser_t* word = mpc_many1(mpcf_strfold, mpc_alpha());
+  mpc_parser_t* words = mpc_and(2, mpcf_strfold,
+    mpc_many1(mpcf_strfold, mpc_alpha()),
+    mpc_many(mpcf_strfold, mpc_and(2, mpcf_strfold,
+      mpc_char(' '), mpc_many1(mpcf_strfold, mpc_alpha()), free)),
+    free);
+  mpc_parser_t* number = mpc_int();
+  FILE* f;
+
+  puts("file");
+
+  f = input("hello world\n");
+  check(parse(word, f, 0), "parses a word");
+  check(ftell(f) == 5, "stops just past it");
+  check(getc(f) == ' ', "leaves the rest to read");
+  fclose(f);
+
+  f = input("hello world and more\n");
+  check(parse(words, f, 0), "parses words");
+  check(ftell(f) == 20, "stops just past them");
+  fclose(f);
+
+  f = input("hello world and more\n");
+  check(!parse(number, f, 0), "fails on a word");
+  check(ftell(f) == 0, "stays where it was");
+  fclose(f);
+
+  f = input("12 hello\n");
+  check(getc(f) == '1', "reads ahead of a parse");
+  check(parse(number, f, 0), "parses from there");
+  check(ftell(f) == 2, "stops just past it");
+  fclose(f);
+
+  puts("pipe");
+
+  f = input("hello world\n");
+  check(parse(word, f, 1), "parses a word");
+  check(getc(f) == ' ', "gives back what it peeked at");
+  fclose(f);
+
+  f = input("hello world and more\nnext\n");
+  check(parse(words, f, 1), "parses words");
+  check(getc(f) == '\n', "does not read ahead to the line end");
+  check(getc(f) == 'n', "leaves the next line");
+  fclose(f);
+
+  mpc_delete(word);
+  mpc_delete(words);
+  mpc_delete(number);
+
+  return failed;
+}
@@ -0,0 +1,87 @@
+/*
+** Checks that a grammar still parses what it should
+** after one of its rules is defined again, once
+** mpc_optimise has built tables for its alternatives.
+*/
+
+#include "mpc.h"
+#include "check.h"
+
+static int parses(mpc_parser_t* p, const char* s) {
+  mpc_result_t r;
+  if (mpc_parse("<test>", s, p, &r)) {
+    mpc_ast_delete(r.output);
+    return 1;
+  }
+  mpc_err_delete(r.error);
+  return 0;
+}
+
+static int error_is(mpc_parser_t* p, const char* s, const char* expected) {
+  mpc_result_t r;
+  char* e;
+  int ok;
+  if (mpc_parse("<test>", s, p, &r)) {
+    mpc_ast_delete(r.output);
+    return 0;
+  }
+  e = mpc_err_string(r.error);
+  ok = strcmp(e, expected) == 0;
+  if (!ok) {
+    printf("Got %sExpected %s", e, expected);
+  }
+  free(e);
+  mpc_err_delete(r.error);
+  return ok;
+}
+
+int main(void) {
+
+  mpc_parser_t* A = mpc_new("a");
+  mpc_parser_t* B = mpc_new("b");
+  mpc_parser_t* AB = mpc_new("ab");
+  mpc_parser_t* Top = mpc_new("top");
+
+  mpca_lang(MPCA_LANG_DEFAULT,
+    " a   : \"xx\" ;                 "
+    " b   : \"yy\" ;                 "
+    " ab  : <a> | <b> ;              "
+    " top : /^/ (<ab> | 'w') /$/ ;   ",
+    A, B, AB, Top, NULL);
+  mpc_optimise(AB);
+  mpc_optimise(Top);
+
+  puts("before");
+  check(parses(Top, "xx"), "xx");
+  check(parses(Top, "yy"), "yy");
+  check(!parses(Top, "zz"), "not zz");
+
+  mpc_undefine(A);
+  mpca_lang(MPCA_LANG_DEFAULT, " a : \"zz\" ; ", A, NULL);
+
+  puts("after redefining a rule used by both");
+  check(parses(Top, "zz"), "zz");
+  check(parses(Top, "yy"), "yy");
+  check(error_is(Top, "xx",
+    "<test>:1:1: error: expected \"zz\", \"yy\" or 'w' at 'x'\n"), "not xx");
+
+  mpc_optimise(AB);
+  mpc_optimise(Top);
+
+  puts("after optimising again");
+  check(parses(Top, "zz"), "zz");
+  check(parses(Top, "yy"), "yy");
+  check(error_is(Top, "xx",
+    "<test>:1:1: error: expected \"zz\", \"yy\" or 'w' at 'x'\n"), "not xx");
+
+  mpc_undefine(B);
+  mpc_define(B, mpc_apply(mpc_string("qq"), mpcf_str_ast));
+
+  puts("after redefining with combinators");
+  check(parses(Top, "qq"), "qq");
+  check(!parses(Top, "yy"), "not yy");
+
+  mpc_cleanup(4, A, B, AB, Top);
+
+  return failed;
+}
@@ -0,0 +1,144 @@
+/*
+** Checks that each regex gives the same results through
+** its DFA as through its combinators (MPC_RE_NO_DFA): the
+** same output, the same place to stop, and the same error,
+** alone and inside an mpc_and and an mpc_or.
+*/
+
+#include "mpc.h"
+#include "check.h"
+
+/* Joins outputs with '|' so where each part stopped shows */
+static mpc_val_t* fold_join(int n, mpc_val_t** xs) {
+  size_t len = 0;
+  char* s;
+  int j;
+  for (j = 0; j < n; j++) { len += strlen(xs[j]) + 1; }
+  s = calloc(len + 1, 1);
+  for (j = 0; j < n; j++) {
+    if (j > 0) { strcat(s, "|"); }
+    strcat(s, xs[j]);
+    free(xs[j]);
+  }
+  return s;
+}
+
+/* What a parser gives for an input, as a string */
+static char* run(mpc_parser_t* p, const char* input) {
+  mpc_result_t r;
+  char* s;
+  if (mpc_parse("<test>", input, p, &r)) {
+    s = malloc(strlen(r.output) + 4);
+    sprintf(s, "ok %s", (char*)r.output);
+    free(r.output);
+  } else {
+    s = mpc_err_string(r.error);
+    mpc_err_delete(r.error);
+  }
+  return s;
+}
+
+static mpc_parser_t* context(int c, mpc_parser_t* re) {
+  mpc_parser_t* rest = mpc_many(mpcf_strfold, mpc_any());
+  switch (c) {
+    case 0:
+      return mpc_and(2, fold_join, re, rest, free);
+    case 1:
+      return mpc_and(3, fold_join, re, mpc_char('b'), rest, free, free);
+    default:
+      return mpc_and(2, fold_join,
+        mpc_or(2, re, mpc_string("ab")), rest, free);
+  }
+}
+
+static unsigned long seed = 1;
+
+static const char* random_input(void) {
+  static const char alphabet[] = "abc1-_ \n\";.";
+  static char s[8];
+  int n, j;
+  seed = seed * 1103515245 + 12345;
+  n = (int)((seed >> 16) % 7);
+  for (j = 0; j < n; j++) {
+    seed = seed * 1103515245 + 12345;
+    s[j] = alphabet[(seed >> 16) % (sizeof(alphabet) - 1)];
+  }
+  s[n] = '\0';
+  return s;
+}
+
+static int compare(mpc_parser_t* d, mpc_parser_t* x, const char* re, int c,
+                   const char* in) {
+  char* a = run(d, in);
+  char* b = run(x, in);
+  int ok = strcmp(a, b) == 0;
+  if (!ok) {
+    printf("  /%s/ in context %d on \"%s\":\n    dfa: %s\n    re:  %s\n",
+           re, c, in, a, b);
+  }
+  free(a);
+  free(b);
+  return ok;
+}
+
+/* Compares both engines on the given inputs and on random ones */
+static int same(const char** res, int mode, const char** inputs) {
+
+  int r, c, j, ok = 1;
+
+  for (r = 0; res[r]; r++) {
+    for (c = 0; c < 3; c++) {
+
+      mpc_parser_t* d = context(c, mpc_re_mode(res[r], mode));
+      mpc_parser_t* x = context(c, mpc_re_mode(res[r], mode | MPC_RE_NO_DFA));
+
+      for (j = 0; ok && inputs[j]; j++) {
+        ok = compare(d, x, res[r], c, inputs[j]);
+      }
+      for (j = 0; ok && j < 200; j++) {
+        ok = compare(d, x, res[r], c, random_input());
+      }
+
+      mpc_delete(d);
+      mpc_delete(x);
+    }
+  }
+
+  return ok;
+}
+
+int main(void) {
+
+  const char* nullable[] = {
+    "", "a*", "a?", "(ab)*", "a*b*", "(a|b)*", "(a|)", "[ab]*c?", "a{0}",
+    NULL };
+  const char* anchors[] = {
+    "^", "$", "^$", "^a", "a$", "^a*$", "a|^b", "(a$|ab)", NULL };
+  const char* classes[] = {
+    ".", "[abc]", "[^abc]", "[a-c]+", "[^\n]*", "[a\\-]+", "[]", "[^]",
+    "\\d+", "\\w+", "\\s", "\\D", "\\S", "\\W", "\\.", "\\(", "\\n", NULL };
+  const char* accept[] = {
+    "ab*", "a(bc)*", "a|ab", "ab|a", "(a|ab)(c|bcd)", "a+b?", "a{2}",
+    "(ab){2}", "a{1,}", "-?[0-9]+", "\"(\\\\.|[^\"])*\"", ";[^\\r\\n]*",
+    "[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+", NULL };
+  const char* inputs[] = {
+    "", "a", "b", "c", "ab", "abc", "aab", "abab", "aba", "abcbc", "abcb",
+    "abcbcd", "\n", "a\n", "a\nb", "1", "-1", "-", "12a", "\"a\"", "\"a",
+    "\"\\\"\"", ";a\nb", "+-", "a_1", " ", ".", "(", NULL };
+
+  puts("nullable regexes");
+  check(same(nullable, MPC_RE_DEFAULT, inputs), "give the same results");
+
+  puts("anchors");
+  check(same(anchors, MPC_RE_DEFAULT, inputs), "give the same results");
+  check(same(anchors, MPC_RE_MULTILINE, inputs), "multiline too");
+
+  puts("character classes");
+  check(same(classes, MPC_RE_DEFAULT, inputs), "give the same results");
+  check(same(classes, MPC_RE_DOTALL, inputs), "dotall too");
+
+  puts("accepting at the end of input");
+  check(same(accept, MPC_RE_DEFAULT, inputs), "give the same results");
+
+  return failed;
+}
@@ -0,0 +1,33 @@
+#!/bin/sh
+# Builds each tests/*.c against mpc.c and runs it.
+#
+# Usage: tests/run.sh [files...]   (from the top folder)
+#
+# Every test is built with the default iterative parsing engine and with
+# MPC_PARSE_RECURSIVE. A test prints what it checks and exits with a failure
+# status if any check fails, using the check function in tests/check.h.
+# Set CC or CFLAGS to change how the tests are built.
+
+cd "$(dirname "$0")/.." || exit 1
+
+FILES=${*:-tests/*.c}
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:-"-std=c11 -O2"}
+BIN=${TMPDIR:-/tmp}/mpc-test.$$
+
+trap 'rm -f "$BIN"' EXIT
+
+failed=0
+for f in $FILES; do
+  for engine in "" "-DMPC_PARSE_RECURSIVE"; do
+    if $CC $CFLAGS $engine -I. "$f" mpc.c -lm -o "$BIN" && "$BIN"; then
+      echo "PASS $f${engine:+ $engine}"
+    else
+      echo "FAIL $f${engine:+ $engine}"
+      failed=1
+    fi
+  done
+done
+
+exit $failed